@@ -21,33 +21,7 @@
  
 #include "HardwareSerial.h"
 #include "Midi.h"
-
-
-// This is used for tracking when we're processing a proprietary stream of data
-//  The assigned value is arbitrary; just for internal use.
-static const int MODE_PROPRIETARY = 0xff;
-
-
-// These are midi status message types as sent on the wire
-static const int STATUS_EVENT_NOTE_OFF        = 0x80;
-static const int STATUS_EVENT_NOTE_ON         = 0x90;
-static const int STATUS_EVENT_VELOCITY_CHANGE = 0xA0;
-static const int STATUS_EVENT_CONTROL_CHANGE  = 0xB0;
-static const int STATUS_EVENT_PROGRAM_CHANGE  = 0xC0;
-static const int STATUS_AFTER_TOUCH           = 0xD0;
-static const int STATUS_PITCH_CHANGE          = 0xE0;
-static const int STATUS_START_PROPRIETARY     = 0xF0;
-static const int STATUS_SONG_POSITION         = 0xF2;
-static const int STATUS_SONG_SELECT           = 0xF3;
-static const int STATUS_TUNE_REQUEST          = 0xF6;
-static const int STATUS_END_PROPRIETARY       = 0xF7;
-static const int STATUS_SYNC                  = 0xF8;
-static const int STATUS_START                 = 0xFA;
-static const int STATUS_CONTINUE              = 0xFB;
-static const int STATUS_STOP                  = 0xFC;
-static const int STATUS_ACTIVE_SENSE          = 0xFE;
-static const int STATUS_RESET                 = 0xFF;
-    
+#include "MidiCapture.h"
 
 
 /******************************************************************************
@@ -70,7 +44,7 @@ Midi::Midi(HardwareSerial &serial) : serial_(serial)
 // Open the serial port and begin processing.
 void Midi::begin(unsigned int channel, unsigned long baud)
 {
-  channelIn_ = channel;
+  parser_.setChannel(channel);
   serial_.begin(baud);
 }
 
@@ -79,12 +53,85 @@ void Midi::begin(unsigned int channel, unsigned long baud)
 void Midi::poll(void)
 {
     int c;
+    unsigned long start = 0;
+    unsigned int checked = 0;
+    bool batch = false;
+#if MIDI_STATS
+    unsigned long elapsed;
+#endif
+
 
+    if (clock_ && (MIDI_STATS || pollTime_)) {
+        start = clock_();
+    }
 
-    // Just keep sucking data from serial port until it runs out, processing
-    //  MIDI messages as we go
+    if (capture_) {
+        capture_->startPoll(clock_ ? clock_() : 0);
+    }
+
+    // Just keep sucking data from serial port until it runs out (or a
+    //  limit is reached), processing MIDI messages as we go
+    received_ = 0;
     while((c = serial_.read()) != -1) {
+        if (!batch && !queue_) {
+            batch = true;
+            handleBatchStart();
+        }
+
+        if (capture_) {
+            capture_->add(c);
+        }
         recvByte(c);
+
+        /* The limits are only looked at as each message finishes */
+        if (received_ != checked) {
+            checked = received_;
+            if ((pollMessages_ && received_ >= pollMessages_)
+                || (pollTime_ && clock_ && clock_() - start >= pollTime_)) {
+                break;
+            }
+        }
+    }
+
+    if (thru_) {
+        thru_->flush();
+    }
+
+    if (batch) {
+        handleBatchEnd();
+    }
+
+#if MIDI_STATS
+    if (clock_) {
+        elapsed = clock_() - start;
+        if (elapsed > parser_.stats().longestPoll) {
+            parser_.stats().longestPoll = elapsed;
+        }
+    }
+#endif
+}
+
+
+// Same as poll(), for bytes that came from somewhere else
+void Midi::receive(const unsigned char *data, unsigned int length)
+{
+    bool batch = length && !queue_;
+
+
+    if (batch) {
+        handleBatchStart();
+    }
+
+    while (length--) {
+        recvByte(*data++);
+    }
+
+    if (thru_) {
+        thru_->flush();
+    }
+
+    if (batch) {
+        handleBatchEnd();
     }
 }
 
@@ -97,6 +144,13 @@ void Midi::sendByte(unsigned char value)
 }
 
 
+// Same thing, for a whole block of data at once
+void Midi::sendBytes(const unsigned char *data, unsigned int length)
+{
+    serial_.write(data, length);
+}
+
+
 /******************************************************************************
  *
  * These are the general MIDI message handling functions; they handle
@@ -114,197 +168,528 @@ void Midi::sendByte(unsigned char value)
 //
 void Midi::recvByte(int value)
 {
-    int tmp;
-    int channel;
-    int bigval;           /*  temp 14-bit value for pitch, song pos */
+    MidiMessage message;
 
 
-    if (recvMode_ & MODE_PROPRIETARY
-      && value != STATUS_END_PROPRIETARY)
-    {
-        /* If proprietary handling compiled in, just pass all data received
-         *  after a START_PROPRIETARY event to proprietary_decode
-         *  until get an END_PROPRIETARY event
-         */
+    if (thru_) {
+        passThru(value);
+    }
 
-#ifdef CONFIG_MIDI_PROPRIETARY
-        proprietaryDecode(value);
+#if MIDI_TIMESTAMPS
+    if (clock_) {
+        parser_.setTime(clock_());
+    }
 #endif
 
+    if (parseByte(value, &message)) {
+        received_++;
+
+        /* SysEx data gets copied, since the parser's buffer gets reused */
+        if (!queue_) {
+            dispatch(message);
+        } else if (message.type == MidiMessage::SYSEX) {
+            queue_->pushSysEx(message, parser_.sysExData(), parser_.sysExLength());
+        } else {
+            queue_->push(message);
+        }
+    }
+}
+
+
+void Midi::passThru(unsigned char value)
+{
+    bool ending;
+
+
+    if (!thruFiltered_) {
+        thru_->thruByte(value);
         return;
     }
 
-    if (value & 0x80) {
-    
-        /* All < 0xf0 events get at least 1 arg byte so
-         *  it's ok to mask off the low 4 bits to figure
-         *  out how to handle the event for < 0xf0 events.
+    if (value >= STATUS_SYNC) {
+        /* Real time messages can go anywhere */
+        if (!parser_.accepts(value)) {
+            return;
+        }
+    } else if (value & 0x80) {
+        /* A system exclusive message that's been passed on needs ending,
+         *  whether or not what ends it gets passed on
          */
+        ending = thruPassing_ && thruStatus_ == STATUS_START_PROPRIETARY;
 
-        tmp = value;
-
-        if (tmp < 0xf0)
-            tmp &= 0xf0;
-
-        switch (tmp) {
-            /* These status events take 2 bytes as arguments */
-            case STATUS_EVENT_NOTE_OFF:
-            case STATUS_EVENT_NOTE_ON:
-            case STATUS_EVENT_VELOCITY_CHANGE:
-            case STATUS_EVENT_CONTROL_CHANGE:
-            case STATUS_PITCH_CHANGE:
-            case STATUS_SONG_POSITION:
-                recvBytesNeeded_ = 2;
-                recvByteCount_ = 0;
-                recvEvent_ = value;
-                break;
-
-            /* 1 byte arguments */
-            case STATUS_EVENT_PROGRAM_CHANGE:
-            case STATUS_AFTER_TOUCH:
-            case STATUS_SONG_SELECT:
-                recvBytesNeeded_ = 1;
-                recvByteCount_ = 0;
-                recvEvent_ = value;
+        thruStatus_ = value;
+        if (value == STATUS_END_PROPRIETARY) {
+            thruPassing_ = false;
+            if (!ending) {
+                return;
+            }
+        } else {
+            thruPassing_ = parser_.accepts(value);
+            if (!thruPassing_) {
+                if (ending) {
+                    thru_->thruByte(STATUS_END_PROPRIETARY);
+                }
                 return;
+            }
+        }
+    } else if (!thruPassing_) {
+        return;
+    }
 
-            /* No arguments ( > 0xf0 events) */
-            case STATUS_START_PROPRIETARY:
-                recvMode_ |= MODE_PROPRIETARY;
+    thru_->thruByte(value);
+}
 
-#ifdef CONFIG_MIDI_PROPRIETARY
-                proprietaryDecodeStart();
-#endif
 
-                break;
-            case STATUS_END_PROPRIETARY:
-                recvMode_ &= ~MODE_PROPRIETARY;
+void Midi::thruByte(unsigned char value)
+{
+    bytesSent_++;
+    MIDI_STAT(parser_.stats().bytesSent++);
+
+    /* The receiver's running status is whatever came through last */
+    if ((value & 0x80) && (value < STATUS_SYNC || value == STATUS_RESET)) {
+        lastStatusSent_ = 0;
+    }
+
+    if (!sendBufferSize_) {
+        sendByte(value);
+        return;
+    }
+
+    if (sendBufferUsed_ == sendBufferSize_) {
+        flush();
+    }
+
+    sendBuffer_[sendBufferUsed_++] = value;
+}
+
+
+void Midi::setThru(Midi *output, bool filtered)
+{
+    thru_ = output;
+    thruFiltered_ = filtered;
+    thruPassing_ = false;
+    thruStatus_ = 0;
+}
+
+
+// The actual decoding is done by the parser; returns true (with message
+//  filled in) when a byte completes a message that we're interested in.
+bool Midi::parseByte(unsigned char value, MidiMessage *message)
+{
+    return parser_.parse(value, message);
+}
+
 
-#ifdef CONFIG_MIDI_PROPRIETARY
-                proprietaryDecodeEnd();
+// Decode a block of data into an array of messages, with no handler calls
+//  or serial port reads in the way.
+unsigned int Midi::decode(const unsigned char *data, unsigned int length,
+                          MidiMessage *messages, unsigned int maxMessages,
+                          unsigned int *bytesUsed)
+{
+    const unsigned char *p = data;
+    const unsigned char *end = data + length;
+    unsigned int count = 0;
+
+
+#if MIDI_TIMESTAMPS
+    /* The whole block arrived at once */
+    if (clock_) {
+        parser_.setTime(clock_());
+    }
 #endif
 
+    while (p != end && count != maxMessages) {
+        if (parseByte(*p++, &messages[count])) {
+            if (messages[count++].type == MidiMessage::SYSEX) {
                 break;
-            case STATUS_TUNE_REQUEST:
-                handleTuneRequest();
-                break;
-            case STATUS_SYNC:
-                handleSync();
-                break;
-            case STATUS_START:
-                handleStart();
-                break;
-            case STATUS_CONTINUE:
-                handleContinue();
-                break;
-            case STATUS_STOP:
-                handleStop();
-                break;
-            case STATUS_ACTIVE_SENSE:
-                handleActiveSense();
-                break;
-            case STATUS_RESET:
-                handleReset();
-                break;
+            }
         }
+    }
 
-        return;
+    if (bytesUsed) {
+        *bytesUsed = p - data;
     }
 
-    if (++recvByteCount_ == recvBytesNeeded_) {
-        /* Copy out the channel (if applicable; in some cases this will be meaningless,
-         *  but in those cases the value will be ignored)
-         */
-        channel = (recvEvent_ & 0x0f) + 1;
+    return count;
+}
+
+
+// Call the right handler for a decoded message
+void Midi::dispatch(const MidiMessage &message)
+{
+    dispatchMessage(message, parser_.sysExData(), parser_.sysExLength());
+}
+
+
+void Midi::dispatchMessage(const MidiMessage &message, const unsigned char *sysExData,
+                           unsigned int sysExLength)
+{
+    unsigned int channel = (message.status & 0x0f) + 1;
+
+
+#if MIDI_TIMESTAMPS
+    messageTime_ = message.time;
+    if (clock_) {
+        updateTimingStats(message.time);
+    }
+#endif
 
-        tmp = recvEvent_;
-        if (tmp < 0xf0) {
-            tmp &= 0xf0;
+    if (listeners_ && message.type != MidiMessage::SYSEX) {
+        for (MidiListener *l = listeners_; l; l = l->nextListener_) {
+            l->midiReceived(message);
         }
+    }
 
-        /* See if this event matches our MIDI channel
-         *  (or we're accepting for all channels)
-         */
-        if (!channelIn_
-             || (channel == channelIn_)
-             || (tmp >= 0xf0))
-        {
-            switch (tmp) {
-                case STATUS_EVENT_NOTE_ON:
-                    /* If velocity is 0, it's actually a note off & should fall thru
-                     *  to the note off case
-                     */
-                    if (value) {
-                        handleNoteOn(channel, recvArg0_, value);
-                        break;
-                    }
-
-                case STATUS_EVENT_NOTE_OFF:
-                    handleNoteOff(channel, recvArg0_, value);
-                    break;
-                case STATUS_EVENT_VELOCITY_CHANGE:
-                    handleVelocityChange(channel, recvArg0_, value);
-                    break;
-                case STATUS_EVENT_CONTROL_CHANGE:
-                    handleControlChange(channel, recvArg0_, value);
-                    break;
-                case STATUS_EVENT_PROGRAM_CHANGE:
-                    handleProgramChange(channel, value);
-                    break;
-                case STATUS_AFTER_TOUCH:
-                    handleAfterTouch(channel, value);
-                    break;
-                case STATUS_PITCH_CHANGE:
-                    bigval = (value << 7) | recvArg0_;
-                    handlePitchChange(bigval);
-                    break;
-                case STATUS_SONG_POSITION:
-                    bigval = (value << 7) | recvArg0_;
-                    handleSongPosition(bigval);
-                    break;
-                case STATUS_SONG_SELECT:
-                    handleSongSelect(value);
-                    break;
+    /* The parser has already worked out which handler this goes to (and
+     *  turned NOTE ONs with velocity 0 into NOTE OFFs)
+     */
+    switch (message.type) {
+        case MidiMessage::NOTE_OFF:
+            handleNoteOff(channel, message.data1, message.data2);
+            break;
+        case MidiMessage::NOTE_ON:
+            handleNoteOn(channel, message.data1, message.data2);
+            break;
+        case MidiMessage::VELOCITY_CHANGE:
+            handleVelocityChange(channel, message.data1, message.data2);
+            break;
+        case MidiMessage::CONTROL_CHANGE:
+            handleControlChange(channel, message.data1, message.data2);
+            break;
+        case MidiMessage::PROGRAM_CHANGE:
+            handleProgramChange(channel, message.data1);
+            break;
+        case MidiMessage::AFTER_TOUCH:
+            handleAfterTouch(channel, message.data1);
+            break;
+        case MidiMessage::PITCH_CHANGE:
+            handlePitchBend(channel, (message.data2 << 7) | message.data1);
+            break;
+        case MidiMessage::TIME_CODE:
+            handleTimeCode(message.data1);
+            break;
+        case MidiMessage::SONG_POSITION:
+            handleSongPosition((message.data2 << 7) | message.data1);
+            break;
+        case MidiMessage::SONG_SELECT:
+            handleSongSelect(message.data1);
+            break;
+        case MidiMessage::TUNE_REQUEST:
+            handleTuneRequest();
+            break;
+        case MidiMessage::SYNC:
+            handleSync();
+            break;
+        case MidiMessage::START:
+            handleStart();
+            break;
+        case MidiMessage::CONTINUE:
+            handleContinue();
+            break;
+        case MidiMessage::STOP:
+            handleStop();
+            break;
+        case MidiMessage::ACTIVE_SENSE:
+            handleActiveSense();
+            break;
+        case MidiMessage::RESET:
+            handleReset();
+            break;
+        case MidiMessage::SYSEX:
+            for (MidiListener *l = listeners_; l; l = l->nextListener_) {
+                l->midiSysEx(sysExData, sysExLength, message.data1);
             }
+            handleSysEx(sysExData, sysExLength, message.data1);
+            break;
+    }
+}
+
+
+void Midi::dispatch(const MidiMessage *messages, unsigned int count)
+{
+    while (count--) {
+        dispatch(*messages++);
+    }
+}
+
+
+void Midi::addListener(MidiListener *listener)
+{
+    listener->nextListener_ = listeners_;
+    listeners_ = listener;
+}
+
+
+void Midi::removeListener(MidiListener *listener)
+{
+    MidiListener **l;
+
+
+    for (l = &listeners_; *l; l = &(*l)->nextListener_) {
+        if (*l == listener) {
+            *l = listener->nextListener_;
+            listener->nextListener_ = 0;
+            return;
         }
+    }
+}
 
-        /* Just reset the byte count; keep the same event -- might get more messages
-            trailing from current event.
-         */
-        recvByteCount_ = 0;
+
+void Midi::notifySent(unsigned char status, unsigned char data1, unsigned char data2)
+{
+    MidiMessage message;
+
+
+    message.status = status;
+    message.data1 = data1;
+    message.data2 = data2;
+    message.type = MidiParser::messageType(status, data2);
+#if MIDI_TIMESTAMPS
+    message.time = clock_ ? clock_() : 0;
+#endif
+
+    for (MidiListener *l = listeners_; l; l = l->nextListener_) {
+        l->midiSent(message);
     }
-    
-    recvArg0_ = value;
+}
+
+
+void Midi::setClock(MidiClock clock)
+{
+    clock_ = clock;
+}
+
+
+#if MIDI_TIMESTAMPS
+// Keep track of how late each message is being handled, and how steadily
+//  they're arriving
+void Midi::updateTimingStats(unsigned long arrival)
+{
+    unsigned long interval;
+
+
+    latency_.add(clock_() - arrival);
+
+    if (latency_.count > 1) {
+        interval = arrival - lastArrival_;
+
+        if (latency_.count > 2) {
+            jitter_.add(interval > lastInterval_ ? interval - lastInterval_
+                                                 : lastInterval_ - interval);
+        }
+
+        lastInterval_ = interval;
+    }
+
+    lastArrival_ = arrival;
+}
+
+
+void Midi::resetTimingStats(void)
+{
+    latency_.reset();
+    jitter_.reset();
+}
+#endif
+
+
+void Midi::setQueue(MidiQueue *queue)
+{
+    queue_ = queue;
+}
+
+
+// Pull messages out of the queue & hand them to the handlers
+unsigned int Midi::dispatchQueued(unsigned int maxMessages)
+{
+    MidiMessage message;
+    unsigned int count = 0;
+
+
+    if (!queue_) {
+        return 0;
+    }
+
+    while ((!maxMessages || count < maxMessages) && queue_->pull(&message)) {
+        if (!count) {
+            handleBatchStart();
+        }
+        dispatchMessage(message, queue_->sysExData(), queue_->sysExLength());
+        count++;
+    }
+
+    /* Done with the last SysEx piece, so its space can be used again */
+    queue_->releaseSysEx();
+
+    if (count) {
+        handleBatchEnd();
+    }
+
+    return count;
+}
+
+
+void Midi::setSysExBuffer(unsigned char *buffer, unsigned int size)
+{
+    parser_.setSysExBuffer(buffer, size);
+}
+
+
+void Midi::setSysExFilter(const unsigned char *prefix, unsigned int length)
+{
+    parser_.setSysExFilter(prefix, length);
+}
+
+
+// Send a complete message -- either right away, or into the send buffer if
+//  there is one
+void Midi::sendMessage(const unsigned char *data, unsigned int length)
+{
+    unsigned char *p;
+
+
+    bytesSent_ += length;
+    MIDI_STAT(parser_.stats().bytesSent += length);
+
+    /* Channel messages have already been passed to the listeners (they
+     *  might not have a status byte by now); system exclusive data isn't
+     *  passed along at all
+     */
+    if (listeners_ && data[0] > STATUS_START_PROPRIETARY
+      && data[0] != STATUS_END_PROPRIETARY)
+    {
+        notifySent(data[0], length > 1 ? data[1] : 0, length > 2 ? data[2] : 0);
+    }
+
+    /* System common messages cancel running status, and so does a reset (it
+     *  puts the receiver back to how it was at power up); other real time
+     *  messages can go anywhere without disturbing it.
+     */
+    if (data[0] >= 0xf0
+      && (data[0] < STATUS_SYNC || data[0] == STATUS_RESET))
+    {
+        lastStatusSent_ = 0;
+    }
+
+    if (!sendBufferSize_) {
+        while (length--) {
+            sendByte(*data++);
+        }
+        return;
+    }
+
+    if (sendBufferUsed_ + length > sendBufferSize_) {
+        flush();
+
+        /* Too big to ever fit; don't bother buffering it */
+        if (length > sendBufferSize_) {
+            sendBytes(data, length);
+            return;
+        }
+    }
+
+    p = sendBuffer_ + sendBufferUsed_;
+    sendBufferUsed_ += length;
+
+    while (length--) {
+        *p++ = *data++;
+    }
+}
+
+
+// Send a message that goes to a particular channel.  length is the total
+//  length of the message, including the status byte.
+void Midi::sendChannelMessage(unsigned char status, unsigned char data1,
+                              unsigned char data2, unsigned int length)
+{
+    unsigned char msg[3];
+    unsigned char *p = msg;
+
+
+    if (listeners_) {
+        notifySent(status, data1, length == 3 ? data2 : 0);
+    }
+
+    if (sendFullCommands_
+      || (lastStatusSent_ != status)
+      || (runningStatusRefresh_ && runningStatusCount_ >= runningStatusRefresh_))
+    {
+        *p++ = status;
+        lastStatusSent_ = status;
+        runningStatusCount_ = 0;
+    } else {
+        runningStatusCount_++;
+        bytesSaved_++;
+    }
+
+    *p++ = data1;
+    if (length == 3) {
+        *p++ = data2;
+    }
+
+    sendMessage(msg, p - msg);
+}
+
+
+void Midi::setSendBuffer(unsigned char *buffer, unsigned int size)
+{
+    flush();
+
+    sendBuffer_ = buffer;
+    sendBufferSize_ = buffer ? size : 0;
+    sendBufferUsed_ = 0;
+}
+
+
+// Hand everything in the send buffer over to the serial port
+void Midi::flush(void)
+{
+    if (sendBufferUsed_) {
+        sendBytes(sendBuffer_, sendBufferUsed_);
+        sendBufferUsed_ = 0;
+    }
+}
+
+
+// Send a message given as a MidiMessage (e.g. from decode())
+void Midi::send(const MidiMessage &message)
+{
+    unsigned char msg[3];
+    unsigned int length;
+
+
+    if (!(message.status & 0x80)) {
+        return;
+    }
+
+    length = MidiParser::messageLength(message.status);
+
+    if (message.status < 0xf0) {
+        sendChannelMessage(message.status, message.data1, message.data2, length);
+        return;
+    }
+
+    msg[0] = message.status;
+    msg[1] = message.data1;
+    msg[2] = message.data2;
+
+    sendMessage(msg, length);
 }
 
 
 // Send Midi NOTE OFF message to a given channel, with note 0-127 and velocity 0-127
 void Midi::sendNoteOff(unsigned int channel, unsigned int note, unsigned int velocity)
 {
-    int status = STATUS_EVENT_NOTE_OFF | ((channel - 1) & 0x0f);
-    
-    
-    if (sendFullCommands_ || (lastStatusSent_ != status)) {
-        sendByte(status);
-    }
-    
-    sendByte(note & 0x7f);
-    sendByte(velocity & 0x7f);
+    sendChannelMessage(STATUS_EVENT_NOTE_OFF | ((channel - 1) & 0x0f),
+                       note & 0x7f, velocity & 0x7f, 3);
 }
 
 
 // Send Midi NOTE ON message to a given channel, with note 0-127 and velocity 0-127
 void Midi::sendNoteOn(unsigned int channel, unsigned int note, unsigned int velocity)
 {
-    int status = STATUS_EVENT_NOTE_ON | ((channel - 1) & 0x0f);
-    
-    
-    if (sendFullCommands_ || (lastStatusSent_ != status)) {
-        sendByte(status);
-    }
-    
-    sendByte(note & 0x7f);
-    sendByte(velocity & 0x7f);
+    sendChannelMessage(STATUS_EVENT_NOTE_ON | ((channel - 1) & 0x0f),
+                       note & 0x7f, velocity & 0x7f, 3);
 }
 
 
@@ -312,15 +697,8 @@ void Midi::sendNoteOn(unsigned int channel, unsigned int note, unsigned int velo
 //  and new velocity 0-127
 void Midi::sendVelocityChange(unsigned int channel, unsigned int note, unsigned int velocity)
 {
-    int status = STATUS_EVENT_VELOCITY_CHANGE | ((channel - 1) & 0x0f);
-    
-    
-    if (sendFullCommands_ || (lastStatusSent_ != status)) {
-        sendByte(status);
-    }
-    
-    sendByte(note & 0x7f);
-    sendByte(velocity & 0x7f);
+    sendChannelMessage(STATUS_EVENT_VELOCITY_CHANGE | ((channel - 1) & 0x0f),
+                       note & 0x7f, velocity & 0x7f, 3);
 }
 
 
@@ -328,140 +706,267 @@ void Midi::sendVelocityChange(unsigned int channel, unsigned int note, unsigned
 //  value 0-127
 void Midi::sendControlChange(unsigned int channel, unsigned int controller, unsigned int value)
 {
-    int status = STATUS_EVENT_CONTROL_CHANGE | ((channel - 1) & 0x0f);
-    
-    
-    if (sendFullCommands_ || (lastStatusSent_ != status)) {
-        sendByte(status);
-    }
-    
-    sendByte(controller & 0x7f);
-    sendByte(value & 0x7f);
+    sendChannelMessage(STATUS_EVENT_CONTROL_CHANGE | ((channel - 1) & 0x0f),
+                       controller & 0x7f, value & 0x7f, 3);
 }
 
 
 // Send a Midi PROGRAM CHANGE message to given channel, with program ID 0-127
 void Midi::sendProgramChange(unsigned int channel, unsigned int program)
 {
-    int status = STATUS_EVENT_PROGRAM_CHANGE | ((channel - 1) & 0x0f);
-    
-    
-    if (sendFullCommands_ || (lastStatusSent_ != status)) {
-        sendByte(status);
-    }
-
-    sendByte(program & 0x7f);
+    sendChannelMessage(STATUS_EVENT_PROGRAM_CHANGE | ((channel - 1) & 0x0f),
+                       program & 0x7f, 0, 2);
 }
 
 
 // Send a Midi AFTER TOUCH message to given channel, with velocity 0-127
 void Midi::sendAfterTouch(unsigned int channel, unsigned int velocity)
 {
-    int status = STATUS_AFTER_TOUCH | ((channel - 1) & 0x0f);
-    
-    
-    if (sendFullCommands_ || (lastStatusSent_ != status)) {
-        sendByte(status);
-    }
+    sendChannelMessage(STATUS_AFTER_TOUCH | ((channel - 1) & 0x0f),
+                       velocity & 0x7f, 0, 2);
+}
+
+
+unsigned long Midi::bytesSent(void)
+{
+    return bytesSent_;
+}
+
 
-    sendByte(velocity & 0x7f);
+unsigned long Midi::bytesSaved(void)
+{
+    return bytesSaved_;
+}
+
+
+void Midi::resetSendCounts(void)
+{
+    bytesSent_ = 0;
+    bytesSaved_ = 0;
 }
 
 
-// Send a Midi PITCH CHANGE message, with a 14-bit pitch (always for all channels)
+// Send a Midi PITCH CHANGE message to a given channel, with a 14-bit bend
+//  (8192 for none)
+void Midi::sendPitchBend(unsigned int channel, unsigned int bend)
+{
+    sendChannelMessage(STATUS_PITCH_CHANGE | ((channel - 1) & 0x0f),
+                       bend & 0x7f, (bend >> 7) & 0x7f, 3);
+}
+
+
+// Send a Midi PITCH CHANGE message on channel 1, with a 14-bit pitch
 void Midi::sendPitchChange(unsigned int pitch)
 {
-    sendByte(STATUS_PITCH_CHANGE);
-    sendByte(pitch & 0x7f);
-    sendByte((pitch >> 7) & 0x7f);
+    sendPitchBend(1, pitch);
+}
+
+
+// Send a Midi TIME CODE quarter frame message, with the 7-bit piece of time
+//  code (always for all channels)
+void Midi::sendTimeCode(unsigned int value)
+{
+    unsigned char msg[2];
+
+
+    msg[0] = STATUS_TIME_CODE;
+    msg[1] = value & 0x7f;
+
+    sendMessage(msg, 2);
 }
 
 
 // Send a Midi SONG POSITION message, with a 14-bit position (always for all channels)
 void Midi::sendSongPosition(unsigned int position)
 {
-    sendByte(STATUS_SONG_POSITION);
-    sendByte(position & 0x7f);
-    sendByte((position >> 7) & 0x7f);
+    unsigned char msg[3];
+
+
+    msg[0] = STATUS_SONG_POSITION;
+    msg[1] = position & 0x7f;
+    msg[2] = (position >> 7) & 0x7f;
+
+    sendMessage(msg, 3);
 }
 
 
 // Send a Midi SONG SELECT message, with a song ID of 0-127 (always for all channels)
 void Midi::sendSongSelect(unsigned int song)
 {
-    sendByte(STATUS_SONG_SELECT);
-    sendByte(song & 0x7f);
+    unsigned char msg[2];
+
+
+    msg[0] = STATUS_SONG_SELECT;
+    msg[1] = song & 0x7f;
+
+    sendMessage(msg, 2);
+}
+
+
+// Send a single-byte message
+void Midi::sendStatus(unsigned char status)
+{
+    sendMessage(&status, 1);
+}
+
+
+// Send a system exclusive message from a buffer.  The data goes out as one
+//  piece, so it's sent straight from data if it's too big for the send
+//  buffer.
+void Midi::sendSysEx(const unsigned char *data, unsigned int length)
+{
+    sendStatus(STATUS_START_PROPRIETARY);
+
+    if (length) {
+        sendMessage(data, length);
+    }
+
+    sendStatus(STATUS_END_PROPRIETARY);
+}
+
+
+// Send a system exclusive message, getting the data from source a piece at a
+//  time.  With a send buffer, source fills the buffer in directly.
+void Midi::sendSysEx(MidiSysExSource source, void *context)
+{
+    unsigned char chunk[16];
+    unsigned int length;
+
+
+    sendStatus(STATUS_START_PROPRIETARY);
+
+    if (sendBufferSize_) {
+        for (;;) {
+            if (sendBufferUsed_ == sendBufferSize_) {
+                flush();
+            }
+
+            length = source(sendBuffer_ + sendBufferUsed_,
+                            sendBufferSize_ - sendBufferUsed_, context);
+            if (!length) {
+                break;
+            }
+
+            sendBufferUsed_ += length;
+            bytesSent_ += length;
+            MIDI_STAT(parser_.stats().bytesSent += length);
+        }
+    } else {
+        while ((length = source(chunk, sizeof(chunk), context))) {
+            sendMessage(chunk, length);
+        }
+    }
+
+    sendStatus(STATUS_END_PROPRIETARY);
+}
+
+
+// Send one piece of a system exclusive message, as handed to handleSysEx()
+void Midi::sendSysExChunk(const unsigned char *data, unsigned int length, unsigned int flags)
+{
+    if (flags & MidiMessage::SYSEX_FIRST) {
+        sendStatus(STATUS_START_PROPRIETARY);
+    }
+
+    if (length) {
+        sendMessage(data, length);
+    }
+
+    /* A message that was cut off still needs ending here */
+    if (flags & (MidiMessage::SYSEX_LAST | MidiMessage::SYSEX_ABORTED)) {
+        sendStatus(STATUS_END_PROPRIETARY);
+    }
 }
 
 
 // Send a Midi TUNE REQUEST message (TUNE REQUEST is always for all channels)
 void Midi::sendTuneRequest(void)
 {
-    sendByte(STATUS_TUNE_REQUEST);
+    sendStatus(STATUS_TUNE_REQUEST);
 }
 
 
 // Send a Midi SYNC message (SYNC is always for all channels)
 void Midi::sendSync(void)
 {
-    sendByte(STATUS_SYNC);
+    sendStatus(STATUS_SYNC);
 }
 
 
 // Send a Midi START message (START is always for all channels)
 void Midi::sendStart(void)
 {
-    sendByte(STATUS_START);
+    sendStatus(STATUS_START);
 }
 
 
 // Send a Midi CONTINUE message (CONTINUE is always for all channels)
 void Midi::sendContinue(void)
 {
-    sendByte(STATUS_CONTINUE);
+    sendStatus(STATUS_CONTINUE);
 }
 
 
 // Send a Midi STOP message (STOP is always for all channels)
 void Midi::sendStop(void)
 {
-    sendByte(STATUS_STOP);
+    sendStatus(STATUS_STOP);
 }
 
 
 // Send a Midi ACTIVE SENSE message (ACTIVE SENSE is always for all channels)
 void Midi::sendActiveSense(void)
 {
-    sendByte(STATUS_ACTIVE_SENSE);
+    sendStatus(STATUS_ACTIVE_SENSE);
 }
 
 
 // Send a Midi RESET message (RESET is always for all channels)
 void Midi::sendReset(void)
 {
-    sendByte(STATUS_RESET);
+    sendStatus(STATUS_RESET);
 }
 
 
 void Midi::init()
 {
-    /* Not in proprietary stream */
-    recvMode_ = 0;
-    /* No bytes recevied */
-    recvByteCount_ = 0;
-    /* Not processing an event */
-    recvEvent_ = 0;
-    /* No arguments to the event we haven't received */
-    recvArg0_ = 0;
-    /* Not waiting for bytes to complete a message */
-    recvBytesNeeded_ = 0;
-    // There was no last event.
-    lastStatusSent_ = false;
+    /* Not in the middle of any message */
+    parser_.reset();
     // Don't send the extra bytes; just send deltas
     sendFullCommands_ = false;
+    // There was no last event.
+    lastStatusSent_ = 0;
+    runningStatusCount_ = 0;
+    // Never resend the status byte unless it's changed
+    runningStatusRefresh_ = 0;
+    /* Nothing sent yet */
+    bytesSent_ = 0;
+    bytesSaved_ = 0;
+    /* No send buffer; everything goes out right away */
+    sendBuffer_ = 0;
+    sendBufferSize_ = 0;
+    sendBufferUsed_ = 0;
 
     /* Listening to all channels */
-    channelIn_ = 0;
+    parser_.setChannel(0);
+    /* Handlers get called straight from poll() */
+    queue_ = 0;
+    /* No clock */
+    clock_ = 0;
+    /* Nobody watching */
+    listeners_ = 0;
+    /* No THRU */
+    setThru(0);
+    /* Not capturing */
+    capture_ = 0;
+    /* poll() reads everything there is */
+    pollMessages_ = 0;
+    pollTime_ = 0;
+    received_ = 0;
+#if MIDI_TIMESTAMPS
+    messageTime_ = 0;
+    resetTimingStats();
+#endif
 
 }
 
@@ -476,18 +981,34 @@ void Midi::setParam(unsigned int param, unsigned int val)
             sendFullCommands_ = false;
         }
     } else if (param == PARAM_CHANNEL_IN) {
-        channelIn_ = val;
+        parser_.setChannel(val);
+    } else if (param == PARAM_RUNNING_STATUS_REFRESH) {
+        runningStatusRefresh_ = val;
     }
 }
 
 
+void Midi::setChannelFilter(unsigned int status, unsigned int channels)
+{
+    parser_.setChannelFilter(status, channels);
+}
+
+
+void Midi::setSystemFilter(unsigned int mask)
+{
+    parser_.setSystemFilter(mask);
+}
+
+
 // Get (package-specific) parameters for the Midi instance
 unsigned int Midi::getParam(unsigned int param)
 {
     if (param == PARAM_SEND_FULL_COMMANDS) {
         return sendFullCommands_;
     } else if (param == PARAM_CHANNEL_IN) {
-        return channelIn_;
+        return parser_.channel();
+    } else if (param == PARAM_RUNNING_STATUS_REFRESH) {
+        return runningStatusRefresh_;
     }
     
     return 0;
@@ -511,7 +1032,9 @@ void Midi::handleVelocityChange(unsigned int channel, unsigned int note, unsigne
 void Midi::handleControlChange(unsigned int channel, unsigned int controller, unsigned int value) {}
 void Midi::handleProgramChange(unsigned int channel, unsigned int program) {}
 void Midi::handleAfterTouch(unsigned int channel, unsigned int velocity) {}
+void Midi::handlePitchBend(unsigned int channel, unsigned int bend) { handlePitchChange(bend); }
 void Midi::handlePitchChange(unsigned int pitch) {}
+void Midi::handleTimeCode(unsigned int value) {}
 void Midi::handleSongPosition(unsigned int position) {}
 void Midi::handleSongSelect(unsigned int song) {}
 void Midi::handleTuneRequest(void) {}
@@ -521,3 +1044,6 @@ void Midi::handleContinue(void) {}
 void Midi::handleStop(void) {}
 void Midi::handleActiveSense(void) {}
 void Midi::handleReset(void) {}
+void Midi::handleSysEx(const unsigned char *data, unsigned int length, unsigned int flags) {}
+void Midi::handleBatchStart(void) {}
+void Midi::handleBatchEnd(void) {}
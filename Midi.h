@@ -24,6 +24,14 @@
 #define MIDI_H
 
 #include "HardwareSerial.h"
+#include "MidiParser.h"
+#include "MidiQueue.h"
+#include "MidiSysEx.h"
+#include "MidiTiming.h"
+#include "MidiListener.h"
+
+
+class MidiCaptureWriter;
 
 
 /*
@@ -91,16 +99,56 @@ protected:
     
     /* Private Receive Parameters */
 
-    // The channel this Midi instance receives data for (0 means all channels)
-    int channelIn_;
+    // Keeps track of partial Midi messages as bytes come in, and which
+    //  channel this Midi instance receives data for
+    MidiParser parser_;
 
-    // These are for keeping track of partial Midi messages as bytes come in
-    int recvMode_;
-    int recvByteCount_;
-    int recvEvent_;
-    int recvArg0_;
-    int recvBytesNeeded_;
-    int lastStatusSent_;
+    // If set, decoded messages are put here instead of being handed to the
+    //  handle functions right away
+    MidiQueue *queue_;
+
+    // Where the time comes from (0 if nowhere)
+    MidiClock clock_;
+
+    // Start of the list of things watching the messages go by
+    MidiListener *listeners_;
+
+    // Where received bytes are passed straight on to (0 if nowhere), and
+    //  whether only bytes of messages that get through the receive filters
+    //  are.  For filtering, the last status byte received & whether the
+    //  bytes after it are being passed on.
+    Midi *thru_;
+    bool thruFiltered_;
+    bool thruPassing_;
+    unsigned char thruStatus_;
+
+    // Where the bytes read by poll() are captured, with their timing (0
+    //  if nowhere)
+    MidiCaptureWriter *capture_;
+
+    // Most messages, and longest time (in clock units), one poll() handles
+    //  before leaving the rest for next time (0 for no limit), and the
+    //  number of messages recvByte() has finished in this poll()
+    unsigned int pollMessages_;
+    unsigned long pollTime_;
+    unsigned int received_;
+
+#if MIDI_TIMESTAMPS
+    // Time the message being handled arrived
+    unsigned long messageTime_;
+
+    // Arrival time of the last message handled, and the time between it &
+    //  the one before
+    unsigned long lastArrival_;
+    unsigned long lastInterval_;
+
+    // How long messages wait between arriving & being handled, and how much
+    //  the time between messages changes from one to the next
+    MidiTimingStats latency_;
+    MidiTimingStats jitter_;
+
+    void updateTimingStats(unsigned long arrival);
+#endif
 
     /* Private Send Parameters */
     
@@ -109,15 +157,70 @@ protected:
     //  sending the command each time)
     bool sendFullCommands_;
 
+    // The status byte the receiver on the other end is currently using for
+    //  running status (0 if there isn't one), and how many messages have gone
+    //  out in a row without it
+    int lastStatusSent_;
+    unsigned int runningStatusCount_;
+
+    // Send the status byte again after this many messages without it, in
+    //  case the receiver missed it (0 means never)
+    unsigned int runningStatusRefresh_;
+
+    // Counts of bytes sent, and bytes that didn't need to be thanks to
+    //  running status
+    unsigned long bytesSent_;
+    unsigned long bytesSaved_;
+
+    // Optional buffer that outgoing messages are collected in until flush()
+    //  is called (or it fills up); if there's no buffer, each byte goes
+    //  straight out through sendByte()
+    unsigned char *sendBuffer_;
+    unsigned int sendBufferSize_;
+    unsigned int sendBufferUsed_;
+
     /* Internal functions */
     
     // Called whenever data is read from the serial port
     virtual void recvByte(int value);
+
+    // Does the work of decoding for recvByte() and decode(); returns true &
+    //  fills in message when value completes a message
+    bool parseByte(unsigned char value, MidiMessage *message);
     
+    // Does the work of dispatch(), with the data for a SYSEX message (which
+    //  comes from the queue when there is one)
+    void dispatchMessage(const MidiMessage &message, const unsigned char *sysExData,
+                         unsigned int sysExLength);
+
+    // Pass a received byte on to the THRU output (if it should be)
+    void passThru(unsigned char value);
+
+    // Send a byte passed on from another Midi instance's input
+    void thruByte(unsigned char value);
+
     // Called to send bytes to the serial port.  Moved out to separate function
     //  to allow other hardware interfaces to be defined in subclasses.
     virtual void sendByte(unsigned char b);
 
+    // Called to send a whole buffer full of bytes to the serial port, when
+    //  the send buffer is flushed.  If you override sendByte() for other
+    //  hardware and use a send buffer, override this too.
+    virtual void sendBytes(const unsigned char *data, unsigned int length);
+
+    // All of the send functions end up here, with the complete message
+    void sendMessage(const unsigned char *data, unsigned int length);
+
+    // Builds & sends a channel message (status + 1 or 2 data bytes)
+    void sendChannelMessage(unsigned char status, unsigned char data1,
+                            unsigned char data2, unsigned int length);
+
+    // Sends a message that's just a status byte
+    void sendStatus(unsigned char status);
+
+    // Tell the listeners about a message that's been sent
+    void notifySent(unsigned char status, unsigned char data1, unsigned char data2);
+
     // This doesn't work -- by making it protected, we ensure nobody ever calls it
     Midi();
     
@@ -134,6 +237,12 @@ public:
     // Use this parameter to update the channel the MIDI code is looking for messages
     //  to.  0 means "all channels".
     static const unsigned int PARAM_CHANNEL_IN         = 0x1001;
+
+    // When running status is being used (PARAM_SEND_FULL_COMMANDS is 0), send
+    //  the status byte again anyway after this many messages in a row have
+    //  gone without it, so a receiver that missed it (e.g. was plugged in
+    //  partway through) can pick up again.  0 (the default) means never.
+    static const unsigned int PARAM_RUNNING_STATUS_REFRESH = 0x1002;
     
     
     // Constructor -- generally just use e.g. "Midi midi(Serial);"
@@ -141,16 +250,42 @@ public:
     
     // Call to start the serial port, at given baud.  For many applications
     //  the default parameters are just fine (which will cause messages for all
-    //  MIDI channels to be delivered)
+    //  MIDI channels to be delivered).  A channel other than 0-16 leaves the
+    //  channel filters as they were.
     void begin(unsigned int channel = 0, unsigned long baud = 31250);
     
     
-    // Changes the updateable parameters (params are Midi::PARAM_SEND_FULL_COMMANDS or 
-    //  Midi::PARAM_CHANNEL_IN -- see above for what they mean)
+    // Changes the updateable parameters (params are Midi::PARAM_SEND_FULL_COMMANDS,
+    //  Midi::PARAM_CHANNEL_IN, etc. -- see above for what they mean)
     void setParam(unsigned int param, unsigned int val);
     
     // Get current values for the user updateable parameters (params, etc same as above)
     unsigned int getParam(unsigned int param);
+
+    // Finer grained control over which messages are received than
+    //  PARAM_CHANNEL_IN: only channel messages with the given status (e.g.
+    //  STATUS_EVENT_CONTROL_CHANGE, or 0 for all of them) for the channels
+    //  set in channels (bit 0 for channel 1; 0xffff for all) are handled.
+    //  e.g. to only get notes on channels 1 & 10, and nothing else:
+    //
+    //   midi.setChannelFilter(0, 0);
+    //   midi.setChannelFilter(STATUS_EVENT_NOTE_ON, 0x0201);
+    //   midi.setChannelFilter(STATUS_EVENT_NOTE_OFF, 0x0201);
+    //
+    //  Messages are filtered as soon as their status byte comes in, so the
+    //  rest of their bytes are just counted & skipped.  Setting
+    //  PARAM_CHANNEL_IN replaces all of the channel filters, and getParam()
+    //  gives -1 for it if they don't come down to a single channel or all
+    //  of them.  channelFilter(0) gives the channels every kind of channel
+    //  message gets through for.
+    void setChannelFilter(unsigned int status, unsigned int channels);
+    unsigned int channelFilter(unsigned int status) const { return parser_.channelFilter(status); }
+
+    // Only handle system messages with status 0xf0 + n if bit n of mask is
+    //  set, e.g. midi.setSystemFilter(0xffff & ~(1 << 0x0e)) to ignore
+    //  ACTIVE SENSE.  Bit 0 is for system exclusive messages.
+    void setSystemFilter(unsigned int mask);
+    unsigned int systemFilter() const { return parser_.systemFilter(); }
     
     
     // poll() should be called every time through loop() IF dealing with incoming MIDI
@@ -158,14 +293,160 @@ public:
     //  poll); it causes data to be read from the serial port and processed.
     void poll();
 
-    // Call these to send MIDI messages of the given types
+    // Take in bytes as if poll() had just read them from the serial port
+    //  (e.g. from another kind of port, or from a capture being replayed)
+    void receive(const unsigned char *data, unsigned int length);
+
+    // Stop each poll() once it's handled maxMessages messages, or once
+    //  maxTime has gone by (in units of the clock given to setClock(), and
+    //  only checked as each message finishes), leaving the rest in the
+    //  serial port for next time; 0 means no limit.  This keeps a burst of
+    //  incoming data from holding up the rest of loop() for too long.
+    void setPollLimits(unsigned int maxMessages, unsigned long maxTime = 0)
+    {
+        pollMessages_ = maxMessages;
+        pollTime_ = maxTime;
+    }
+
+    // Decode a whole block of Midi data at once, without calling any of the
+    //  handle functions; each complete message is stored in messages (which
+    //  has room for maxMessages of them).  Returns the number of messages
+    //  stored.  Decoding stops early if messages fills up; if bytesUsed is
+    //  given, it's set to how much of data was used, so the rest can be
+    //  passed in next time.
+    //
+    // Partial messages at the end of data are remembered, so a stream can be
+    //  decoded in blocks of any size.  This shares state with poll(), so
+    //  don't mix the two on the same stream.
+    //
+    // Decoding also stops right after a SYSEX message, since the data it
+    //  refers to is only there until the next byte is decoded; dispatch it
+    //  (or look at sysExData()) before calling decode() again.
+    unsigned int decode(const unsigned char *data, unsigned int length,
+                        MidiMessage *messages, unsigned int maxMessages,
+                        unsigned int *bytesUsed = 0);
+
+    // Call the matching handle function for a decoded message (or each of
+    //  an array of count messages)
+    void dispatch(const MidiMessage &message);
+    void dispatch(const MidiMessage *messages, unsigned int count);
+
+    // Give the Midi instance a queue to put decoded messages into, rather
+    //  than calling the handle functions from inside poll() (pass 0 to go
+    //  back to calling them right away).  poll() can then be called from a
+    //  timer interrupt or a separate thread to keep the serial port drained,
+    //  and dispatchQueued() called from loop() to run the handlers.  If the
+    //  queue fills up, new messages are dropped (see MidiQueue::overflows()).
+    //  System exclusive pieces need room in the queue's SysEx buffer as
+    //  well, and are dropped if it doesn't have one.
+    void setQueue(MidiQueue *queue);
+
+    // Run the handle functions for messages waiting in the queue -- all of
+    //  them, or at most maxMessages if that's not 0.  Returns the number of
+    //  messages handled.
+    unsigned int dispatchQueued(unsigned int maxMessages = 0);
+
+    // MIDI THRU: pass every byte received on to output (another Midi
+    //  instance, or this one) as soon as it's read, before it's decoded,
+    //  so that a chain of devices only adds a byte's worth of delay at each
+    //  step.  Decoding & handle functions go on as usual.  With filtered,
+    //  only the bytes of messages that get through the receive filters
+    //  (begin()'s channel, setChannelFilter() & setSystemFilter(); not
+    //  setSysExFilter()) are passed on.  Pass 0 to turn THRU off.
+    //
+    //  Messages sent on output directly go in amongst the passed on bytes,
+    //  so only send real time messages there, or only send when nothing is
+    //  partway through coming in.  If output has a send buffer, it's
+    //  flushed at the end of each poll().
+    void setThru(Midi *output, bool filtered = false);
+
+    // Keep a copy of every byte poll() reads, and when it was read (using
+    //  the clock given to setClock()), in capture; see MidiCapture.h.
+    //  Pass 0 to stop.
+    void setCapture(MidiCaptureWriter *capture) { capture_ = capture; }
+
+    // Have listener see every message received (just before its handle
+    //  function is called) and sent; see MidiListener.h.  A listener can
+    //  only be added to one Midi instance at a time.
+    void addListener(MidiListener *listener);
+    void removeListener(MidiListener *listener);
+
+    // Give the Midi instance a clock to use (e.g. micros); with
+    //  MIDI_TIMESTAMPS turned on in MidiConfig.h, every incoming message is
+    //  stamped with the time its first byte was read.
+    void setClock(MidiClock clock);
+
+#if MIDI_TIMESTAMPS
+    // The time the message being handled arrived (call from a handle
+    //  function)
+    unsigned long messageTime() const { return messageTime_; }
+
+    // Statistics on the time between each message arriving & its handle
+    //  function being called (latency), and on how much the time between
+    //  one message and the next changes from message to message (jitter)
+    const MidiTimingStats &latencyStats() const { return latency_; }
+    const MidiTimingStats &jitterStats() const { return jitter_; }
+    void resetTimingStats();
+#endif
+
+#if MIDI_STATS
+    // A copy of the counts kept with MIDI_STATS turned on in MidiConfig.h
+    //  (take it from the same place poll() is called from, so it isn't
+    //  changing while it's being copied), and starting the counts over
+    MidiStats stats() const { return parser_.stats(); }
+    void resetStats() { parser_.stats().reset(); }
+#endif
+
+    // Give the Midi instance a buffer to collect incoming system exclusive
+    //  data in (pass 0 to ignore system exclusive data, which is how things
+    //  start out).  handleSysEx() gets called with what's in the buffer each
+    //  time it fills up, and at the end of each message.  With a queue,
+    //  each piece is copied into the queue's own SysEx buffer (see
+    //  MidiQueue::setSysExBuffer()) and handled by dispatchQueued() like
+    //  everything else.
+    void setSysExBuffer(unsigned char *buffer, unsigned int size);
+
+    // Only collect system exclusive messages that start with the given bytes
+    //  (usually a 1 or 3 byte manufacturer ID); the rest are skipped without
+    //  being copied.  A length of 0 (the default) collects everything.
+    void setSysExFilter(const unsigned char *prefix, unsigned int length);
+
+    // The data for the SYSEX message just decoded (see decode())
+    const unsigned char *sysExData() const { return parser_.sysExData(); }
+    unsigned int sysExLength() const { return parser_.sysExLength(); }
+
+    // Give the Midi instance a buffer to collect outgoing messages in, so
+    //  they can be sent to the serial port in one go by flush() instead of a
+    //  byte at a time.  Messages are never split; if one doesn't fit in
+    //  what's left of the buffer, the buffer is flushed first.  Passing a
+    //  size of 0 goes back to sending everything right away (flushing
+    //  anything that's still waiting).
+    void setSendBuffer(unsigned char *buffer, unsigned int size);
+
+    // Send everything waiting in the send buffer
+    void flush();
+
+    // Send a message in the same form as decode() produces
+    void send(const MidiMessage &message);
+
+    // Number of bytes sent since the last resetSendCounts(), and number of
+    //  status bytes that didn't need to be sent because of running status
+    unsigned long bytesSent();
+    unsigned long bytesSaved();
+    void resetSendCounts();
+
+    // Call these to send MIDI messages of the given types.  sendPitchBend()
+    //  takes a 14-bit bend (8192 is the middle); sendPitchChange() is the
+    //  same thing always on channel 1.
     void sendNoteOff(unsigned int channel, unsigned int note, unsigned int velocity);
     void sendNoteOn(unsigned int channel, unsigned int note, unsigned int velocity);
     void sendVelocityChange(unsigned int channel, unsigned int note, unsigned int velocity);
     void sendControlChange(unsigned int channel, unsigned int controller, unsigned int value);
     void sendProgramChange(unsigned int channel, unsigned int program);
     void sendAfterTouch(unsigned int channel, unsigned int velocity);
+    void sendPitchBend(unsigned int channel, unsigned int bend);
     void sendPitchChange(unsigned int pitch);
+    void sendTimeCode(unsigned int value);
     void sendSongPosition(unsigned int position);
     void sendSongSelect(unsigned int song);
     void sendTuneRequest(void);
@@ -175,15 +456,33 @@ public:
     void sendStop(void);
     void sendActiveSense(void);
     void sendReset(void);
+
+    // Send a system exclusive message; data holds length bytes to go
+    //  between the START & END_PROPRIETARY status bytes (each with the top
+    //  bit clear -- see midiSysExPack() for sending 8-bit data).  The second
+    //  form gets the data a piece at a time from source, so it doesn't all
+    //  have to be in memory at once.
+    void sendSysEx(const unsigned char *data, unsigned int length);
+    void sendSysEx(MidiSysExSource source, void *context);
+
+    // Send a piece of a system exclusive message, with the same arguments
+    //  handleSysEx() gets: the START_PROPRIETARY goes out with the first
+    //  piece, and the END_PROPRIETARY with the last (or one that was cut
+    //  off).  Nothing but real time messages should be sent in between.
+    void sendSysExChunk(const unsigned char *data, unsigned int length, unsigned int flags);
     
-    // Overload these in a subclass to get MIDI messages when they come in
+    // Overload these in a subclass to get MIDI messages when they come in.
+    //  handlePitchBend() calls handlePitchChange() (without the channel)
+    //  unless it's overloaded.
     virtual void handleNoteOff(unsigned int channel, unsigned int note, unsigned int velocity);
     virtual void handleNoteOn(unsigned int channel, unsigned int note, unsigned int velocity);
     virtual void handleVelocityChange(unsigned int channel, unsigned int note, unsigned int velocity);
     virtual void handleControlChange(unsigned int channel, unsigned int controller, unsigned int value);
     virtual void handleProgramChange(unsigned int channel, unsigned int program);
     virtual void handleAfterTouch(unsigned int channel, unsigned int velocity);
+    virtual void handlePitchBend(unsigned int channel, unsigned int bend);
     virtual void handlePitchChange(unsigned int pitch);
+    virtual void handleTimeCode(unsigned int value);
     virtual void handleSongPosition(unsigned int position);
     virtual void handleSongSelect(unsigned int song);
     virtual void handleTuneRequest(void);
@@ -193,6 +492,21 @@ public:
     virtual void handleStop(void);
     virtual void handleActiveSense(void);
     virtual void handleReset(void);
+
+    // data holds length bytes of a system exclusive message (without the
+    //  START / END_PROPRIETARY status bytes); flags is made up of
+    //  MidiMessage::SYSEX_FIRST (first piece of a message), SYSEX_LAST (end
+    //  of the message) and SYSEX_ABORTED (the message was cut off).
+    virtual void handleSysEx(const unsigned char *data, unsigned int length, unsigned int flags);
+
+    // Called before & after each batch of handle function calls: a poll()
+    //  or receive() that has anything to read, or a dispatchQueued() that
+    //  has anything to dispatch (poll() doesn't call them when there's a
+    //  queue, since every handler, handleSysEx() included, is then called
+    //  from dispatchQueued()).  Handlers can just note what needs
+    //  changing, and handleBatchEnd() do it once for the whole batch.
+    virtual void handleBatchStart(void);
+    virtual void handleBatchEnd(void);
 };
 
 #endif /* #ifndef MIDI_H ... */
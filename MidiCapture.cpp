@@ -0,0 +1,424 @@
+/*  MidiCapture.cpp: Captures the raw bytes a Midi instance reads, with their timing
+ *
+ *             (c) 2003-2011 Tymm Twillman <tymmothy@gmail.com>
+ *
+ *  This file is part of Tymm's Arduino Midi Library.
+ *
+ *  Tymm's Arduino Midi Library is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation, either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  Tymm's Arduino Midi Library is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Tymm's Arduino Midi Library.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "MidiCapture.h"
+
+
+static const unsigned char CAPTURE_MAGIC[8] = { 'M', 'I', 'D', 'I', 'C', 'A', 'P', 'T' };
+static const unsigned char CAPTURE_VERSION = 1;
+
+// Most bytes a record's time can take
+static const unsigned int MAX_TIME_SIZE = 5;
+
+
+static inline void put32(unsigned char *p, unsigned long value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+
+static inline unsigned long get32(const unsigned char *p)
+{
+    return p[0] | ((unsigned long)p[1] << 8) | ((unsigned long)p[2] << 16)
+           | ((unsigned long)p[3] << 24);
+}
+
+
+/******************************************************************************
+ *
+ * Writing
+ *
+ *****************************************************************************/
+
+
+MidiCaptureWriter::MidiCaptureWriter(unsigned char *buffer, unsigned int size)
+  : buffer_(buffer), half_(size / 2), writer_(0), context_(0),
+    capturing_(false), failed_(false), current_(0),
+    used_(MIDI_CAPTURE_CHUNK_HEADER_SIZE), countAt_(0), recordLeft_(0),
+    pollTime_(0), lastTime_(0), chunkTime_(0), chunkBytes_(0),
+    lost_(false), lostBytes_(0), writeNext_(0), written_(0)
+{
+    full_[0] = full_[1] = false;
+}
+
+
+bool MidiCaptureWriter::start(MidiFileWriter writer, void *context,
+                              unsigned long clockRate, unsigned long offset)
+{
+    unsigned char header[MIDI_CAPTURE_HEADER_SIZE];
+
+
+    if (capturing_ || half_ < MIDI_CAPTURE_CHUNK_HEADER_SIZE + MAX_TIME_SIZE + 2) {
+        return false;
+    }
+
+    writer_ = writer;
+    context_ = context;
+    written_ = offset;
+    failed_ = false;
+
+    current_ = 0;
+    used_ = MIDI_CAPTURE_CHUNK_HEADER_SIZE;
+    recordLeft_ = 0;
+    chunkBytes_ = 0;
+    lost_ = false;
+    lostBytes_ = 0;
+    full_[0] = full_[1] = false;
+    writeNext_ = 0;
+
+    if (!offset) {
+        memcpy(header, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+        header[8] = CAPTURE_VERSION;
+        header[9] = header[10] = header[11] = 0;
+        put32(header + 12, clockRate);
+
+        if (writer_(0, header, sizeof(header), context_) != sizeof(header)) {
+            failed_ = true;
+            return false;
+        }
+        written_ = sizeof(header);
+    }
+
+    capturing_ = true;
+
+    return true;
+}
+
+
+void MidiCaptureWriter::startPoll(unsigned long now)
+{
+    pollTime_ = now;
+    recordLeft_ = 0;
+}
+
+
+void MidiCaptureWriter::add(unsigned char value)
+{
+    unsigned char *p = chunk();
+
+
+    if (!recordLeft_) {
+        addRecord(value);
+        return;
+    }
+
+    p[used_++] = value;
+    p[countAt_]++;
+    recordLeft_--;
+    chunkBytes_++;
+}
+
+
+// Start a new record (and a new chunk, if there isn't room for one) for a
+//  byte from a new poll(), or one that doesn't fit in the latest record
+void MidiCaptureWriter::addRecord(unsigned char value)
+{
+    unsigned char *p;
+    unsigned long delta;
+    unsigned int room;
+
+
+    if (!capturing_) {
+        return;
+    }
+
+    if (used_ + MAX_TIME_SIZE + 2 > half_) {
+        closeChunk();
+    }
+
+    /* Both halves waiting to be written: nowhere to put it */
+    if (full_[current_]) {
+        lost_ = true;
+        lostBytes_++;
+        return;
+    }
+
+    p = chunk();
+
+    if (used_ == MIDI_CAPTURE_CHUNK_HEADER_SIZE) {
+        chunkTime_ = lastTime_ = pollTime_;
+    }
+
+    delta = pollTime_ - lastTime_;
+    lastTime_ = pollTime_;
+
+    while (delta >= 0x80) {
+        p[used_++] = 0x80 | (delta & 0x7f);
+        delta >>= 7;
+    }
+    p[used_++] = delta;
+
+    countAt_ = used_++;
+    p[countAt_] = 1;
+    p[used_++] = value;
+    chunkBytes_++;
+
+    room = half_ - used_;
+    recordLeft_ = room < MAX_RECORD - 1 ? room : MAX_RECORD - 1;
+}
+
+
+// Fill in the header of the chunk being filled, and hand it over to be
+//  written
+void MidiCaptureWriter::closeChunk()
+{
+    unsigned char *p = chunk();
+
+
+    recordLeft_ = 0;
+
+    if (used_ == MIDI_CAPTURE_CHUNK_HEADER_SIZE) {
+        return;
+    }
+
+    put32(p, used_ - MIDI_CAPTURE_CHUNK_HEADER_SIZE);
+    put32(p + 4, chunkTime_);
+    put32(p + 8, chunkBytes_);
+    put32(p + 12, lost_ ? CHUNK_LOST : 0);
+
+    MIDI_QUEUE_RELEASE();
+    full_[current_] = true;
+
+    current_ ^= 1;
+    used_ = MIDI_CAPTURE_CHUNK_HEADER_SIZE;
+    chunkBytes_ = 0;
+    lost_ = false;
+}
+
+
+unsigned int MidiCaptureWriter::service()
+{
+    const unsigned char *p;
+    unsigned int length;
+    unsigned int done = 0;
+
+
+    while (full_[writeNext_] && !failed_) {
+        MIDI_QUEUE_ACQUIRE();
+
+        p = buffer_ + writeNext_ * half_;
+        length = MIDI_CAPTURE_CHUNK_HEADER_SIZE + get32(p);
+
+        if (writer_(written_, p, length, context_) != length) {
+            failed_ = true;
+            capturing_ = false;
+            break;
+        }
+
+        written_ += length;
+        done += length;
+
+        MIDI_QUEUE_RELEASE();
+        full_[writeNext_] = false;
+        writeNext_ ^= 1;
+    }
+
+    return done;
+}
+
+
+bool MidiCaptureWriter::flush()
+{
+    closeChunk();
+    service();
+
+    return !failed_;
+}
+
+
+bool MidiCaptureWriter::stop()
+{
+    bool ok;
+
+
+    if (!capturing_) {
+        return false;
+    }
+
+    ok = flush();
+    capturing_ = false;
+
+    return ok;
+}
+
+
+/******************************************************************************
+ *
+ * Replaying
+ *
+ *****************************************************************************/
+
+
+MidiCaptureReplay::MidiCaptureReplay()
+  : data_(0), length_(0), clockRate_(0)
+{
+    rewind();
+}
+
+
+bool MidiCaptureReplay::open(const unsigned char *data, unsigned long length)
+{
+    if (length < MIDI_CAPTURE_HEADER_SIZE || memcmp(data, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC))
+        || data[8] != CAPTURE_VERSION) {
+        return false;
+    }
+
+    data_ = data;
+    length_ = length;
+    clockRate_ = get32(data + 12);
+    rewind();
+
+    return true;
+}
+
+
+void MidiCaptureReplay::rewind()
+{
+    position_ = MIDI_CAPTURE_HEADER_SIZE;
+    record_ = chunkEnd_ = 0;
+    hasPending_ = false;
+    time_ = 0;
+    timing_ = false;
+    startTime_ = captureStart_ = 0;
+    started_ = false;
+    lostChunks_ = 0;
+}
+
+
+// Move on to the next chunk; returns false if there isn't a whole one
+bool MidiCaptureReplay::nextChunk()
+{
+    unsigned long length;
+
+
+    if (!data_ || length_ - position_ < MIDI_CAPTURE_CHUNK_HEADER_SIZE) {
+        return false;
+    }
+
+    length = get32(data_ + position_);
+    if (length > length_ - position_ - MIDI_CAPTURE_CHUNK_HEADER_SIZE) {
+        return false;
+    }
+
+    time_ = get32(data_ + position_ + 4);
+    if (get32(data_ + position_ + 12) & MidiCaptureWriter::CHUNK_LOST) {
+        lostChunks_++;
+    }
+
+    record_ = data_ + position_ + MIDI_CAPTURE_CHUNK_HEADER_SIZE;
+    chunkEnd_ = record_ + length;
+    position_ += MIDI_CAPTURE_CHUNK_HEADER_SIZE + length;
+
+    return true;
+}
+
+
+// Read in the next record, if it isn't already; returns false at the end
+//  of the capture (or where it stops making sense)
+bool MidiCaptureReplay::peek()
+{
+    unsigned long delta = 0;
+    unsigned int shift = 0;
+    unsigned int length;
+
+
+    if (hasPending_) {
+        return true;
+    }
+
+    while (record_ == chunkEnd_) {
+        if (!nextChunk()) {
+            return false;
+        }
+    }
+
+    do {
+        if (record_ == chunkEnd_ || shift > 28) {
+            record_ = chunkEnd_ = 0;
+            position_ = length_;
+            return false;
+        }
+        delta |= (unsigned long)(*record_ & 0x7f) << shift;
+        shift += 7;
+    } while (*record_++ & 0x80);
+
+    if (record_ == chunkEnd_ || !(length = *record_++)
+        || length > (unsigned long)(chunkEnd_ - record_)) {
+        record_ = chunkEnd_ = 0;
+        position_ = length_;
+        return false;
+    }
+
+    time_ += delta;
+
+    pending_ = record_;
+    pendingLength_ = length;
+    pendingTime_ = time_;
+    hasPending_ = true;
+    record_ += length;
+
+    return true;
+}
+
+
+bool MidiCaptureReplay::next(const unsigned char **data, unsigned int *length,
+                             unsigned long *time)
+{
+    if (!peek()) {
+        return false;
+    }
+
+    *data = pending_;
+    *length = pendingLength_;
+    *time = pendingTime_;
+    hasPending_ = false;
+
+    return true;
+}
+
+
+void MidiCaptureReplay::start(unsigned long now)
+{
+    timing_ = true;
+    startTime_ = now;
+    started_ = false;
+}
+
+
+bool MidiCaptureReplay::due(unsigned long now)
+{
+    if (!timing_ || !peek()) {
+        return false;
+    }
+
+    /* The first record sets where the capture's time lines up with ours */
+    if (!started_) {
+        captureStart_ = pendingTime_;
+        started_ = true;
+    }
+
+    return (long)((now - startTime_) - (pendingTime_ - captureStart_)) >= 0;
+}
@@ -0,0 +1,279 @@
+/*
+ *  MidiCapture.h: Captures the raw bytes a Midi instance reads, with their
+ *                 timing, and plays them back
+ *
+ *             (c) 2003-2011 Tymm Twillman <tymmothy@gmail.com>
+ *
+ *  This file is part of Tymm's Arduino Midi Library.
+ *
+ *  Tymm's Arduino Midi Library is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation, either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  Tymm's Arduino Midi Library is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Tymm's Arduino Midi Library.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef MIDICAPTURE_H
+#define MIDICAPTURE_H
+
+#include "MidiFileRecorder.h"
+#include "MidiQueue.h"
+
+
+/*
+ * A capture is a file holding exactly what Midi::poll() read from the
+ *  serial port, and when, so that it can be fed back in later byte for
+ *  byte (to track down a problem, or to test the parser).  All numbers in
+ *  it are little-endian.  It starts with a 16 byte header:
+ *
+ *   "MIDICAPT", a version number byte (1), 3 zero bytes, and the number of
+ *   clock units per second (4 bytes)
+ *
+ *  followed by any number of chunks, each one written in one go (so a file
+ *  can be added to by writing more chunks on the end, and is never left
+ *  with half a chunk in it).  A chunk has a 16 byte header:
+ *
+ *   the number of bytes in the chunk after the header (4 bytes), the time
+ *   of its first record (4 bytes), the number of MIDI bytes in it (4
+ *   bytes), and flags (4 bytes; CHUNK_LOST if bytes had to be thrown away
+ *   just before it)
+ *
+ *  and then a record for each call to poll() that read anything: the time
+ *  since the record before (as a variable length number, 7 bits per byte,
+ *  lowest first, with the top bit set on all but the last byte), the
+ *  number of bytes (1 to 255; more than that makes more than one record),
+ *  and the bytes themselves.
+ */
+
+// Sizes of the file & chunk headers
+static const unsigned int MIDI_CAPTURE_HEADER_SIZE = 16;
+static const unsigned int MIDI_CAPTURE_CHUNK_HEADER_SIZE = 16;
+
+
+/*
+ * A MidiCaptureWriter writes captures; give it to Midi::setCapture() (and
+ *  give the Midi instance a clock with Midi::setClock()).
+ *
+ * Like a MidiFileRecorder, it never writes from inside poll(): the buffer
+ *  given to it is split in two, each half holding a chunk, and service()
+ *  (called from loop()) writes each half out once it's full while the
+ *  other one fills.  If both are full, bytes are thrown away until one has
+ *  been written, and the next chunk is marked with CHUNK_LOST.  poll()
+ *  can be called from a thread or interrupt, except on AVR, where poll()
+ *  & service() need to be called from the same place; flush() & stop()
+ *  always do.
+ */
+
+class MidiCaptureWriter {
+public:
+    // Chunk flags
+    enum {
+        CHUNK_LOST = 0x01
+    };
+
+    // Most bytes in one record
+    static const unsigned int MAX_RECORD = 255;
+
+private:
+    unsigned char *buffer_;
+    unsigned int half_;
+
+    MidiFileWriter writer_;
+    void *context_;
+
+    volatile bool capturing_;
+    bool failed_;
+
+    // The half being filled, how much of it is used, and where the count
+    //  of bytes in the latest record is
+    unsigned int current_;
+    unsigned int used_;
+    unsigned int countAt_;
+
+    // Bytes that can go in the latest record before another is needed (0
+    //  when the next byte needs a new record)
+    unsigned int recordLeft_;
+
+    // The time of the poll() bytes are coming in from, the time of the
+    //  latest record, & the time of the chunk being filled
+    unsigned long pollTime_;
+    unsigned long lastTime_;
+    unsigned long chunkTime_;
+
+    // MIDI bytes in the chunk being filled, whether bytes have been thrown
+    //  away since the last chunk, & how many altogether
+    unsigned long chunkBytes_;
+    bool lost_;
+    unsigned long lostBytes_;
+
+    // Whether each half is full & waiting to be written, and which one is
+    //  to be written next
+    volatile bool full_[2];
+    unsigned int writeNext_;
+
+    unsigned long written_;
+
+    unsigned char *chunk() const { return buffer_ + current_ * half_; }
+    void addRecord(unsigned char value);
+    void closeChunk();
+
+public:
+    // buffer holds size bytes, which is split into two chunks; a few
+    //  hundred bytes (or a card's block size) for each works well
+    MidiCaptureWriter(unsigned char *buffer, unsigned int size);
+
+    // Start capturing into a file written through writer, whose clock has
+    //  clockRate units per second (1000000 for micros()).  offset is where
+    //  the file ends: at 0, the file header is written first; otherwise
+    //  the chunks are added on to what's there.  Returns false if the
+    //  header couldn't be written.
+    bool start(MidiFileWriter writer, void *context,
+               unsigned long clockRate = 1000000UL, unsigned long offset = 0);
+
+    // Write out what's been captured, and stop.  Returns false if anything
+    //  couldn't be written.
+    bool stop();
+
+    // Write out each half of the buffer as it fills; call this every time
+    //  through loop().  Returns the number of bytes written.
+    unsigned int service();
+
+    // Write out the chunk being filled now, full or not
+    bool flush();
+
+    bool capturing() const { return capturing_; }
+    bool failed() const { return failed_; }
+
+    // Bytes written to the file so far (including anything there before),
+    //  and MIDI bytes thrown away because the buffer was full
+    unsigned long length() const { return written_; }
+    unsigned long lost() const { return lostBytes_; }
+
+    // Called by Midi::poll(): the time bytes are being read at, and each
+    //  byte read.  These are virtual only so that a Midi instance that
+    //  never captures doesn't bring the capture code in with it.
+    virtual void startPoll(unsigned long now);
+    virtual void add(unsigned char value);
+
+    virtual ~MidiCaptureWriter() {}
+};
+
+
+/*
+ * A MidiCaptureReplay feeds a capture that's in memory (e.g. a file mapped
+ *  into memory on a host machine) back in through a Midi or StaticMidi
+ *  instance's receive(), a record at a time, the same way poll() read it:
+ *  either as fast as it can go with replay(), or with the same timing as
+ *  when it was captured, with start() & service().
+ */
+
+class MidiCaptureReplay {
+private:
+    const unsigned char *data_;
+    unsigned long length_;
+    unsigned long clockRate_;
+
+    // Where the next chunk starts, and the next record & the end of the
+    //  chunk it's in
+    unsigned long position_;
+    const unsigned char *record_;
+    const unsigned char *chunkEnd_;
+
+    // The record read in but not fed in yet (if there is one)
+    const unsigned char *pending_;
+    unsigned int pendingLength_;
+    unsigned long pendingTime_;
+    bool hasPending_;
+
+    // The time of the latest record read in, and for replaying in real
+    //  time, whether start() has been called, when the first record was
+    //  fed in & the time it was captured
+    unsigned long time_;
+    bool timing_;
+    unsigned long startTime_;
+    unsigned long captureStart_;
+    bool started_;
+
+    unsigned long lostChunks_;
+
+    bool nextChunk();
+    bool peek();
+
+public:
+    MidiCaptureReplay();
+
+    // Use the capture at data; returns false if it isn't one
+    bool open(const unsigned char *data, unsigned long length);
+
+    // Go back to the start of the capture (call start() again to replay it
+    //  in real time)
+    void rewind();
+
+    // The next record: its bytes, how many, and when they were captured.
+    //  Returns false at the end of the capture.
+    bool next(const unsigned char **data, unsigned int *length, unsigned long *time);
+
+    // Feed the whole capture (from where it's up to) in through midi as
+    //  fast as possible.  Returns the number of bytes fed in.
+    template <class Target>
+    unsigned long replay(Target &midi)
+    {
+        const unsigned char *data;
+        unsigned int length;
+        unsigned long time;
+        unsigned long total = 0;
+
+
+        while (next(&data, &length, &time)) {
+            midi.receive(data, length);
+            total += length;
+        }
+
+        return total;
+    }
+
+    // Replay in real time: the first record is due at now, and the rest at
+    //  the same spacing as they were captured (in clock units, so use a
+    //  clock with the same rate).  service() feeds in whatever is due by
+    //  now, and returns the number of bytes fed in; call it every time
+    //  through loop().
+    void start(unsigned long now);
+
+    template <class Target>
+    unsigned long service(Target &midi, unsigned long now)
+    {
+        unsigned long total = 0;
+
+
+        while (due(now)) {
+            midi.receive(pending_, pendingLength_);
+            total += pendingLength_;
+            hasPending_ = false;
+        }
+
+        return total;
+    }
+
+    // Whether the next record is due by now (in real time); never before
+    //  start()
+    bool due(unsigned long now);
+
+    // Whether there's nothing more to replay
+    bool finished() { return !peek(); }
+
+    // Clock units per second the capture was made with, and the number of
+    //  chunks so far that followed bytes being thrown away
+    unsigned long clockRate() const { return clockRate_; }
+    unsigned long lostChunks() const { return lostChunks_; }
+};
+
+#endif /* #ifndef MIDICAPTURE_H ... */
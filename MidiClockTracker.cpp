@@ -0,0 +1,242 @@
+/*  MidiClockTracker.cpp: Follows an incoming MIDI clock
+ *
+ *             (c) 2003-2011 Tymm Twillman <tymmothy@gmail.com>
+ *
+ *  This file is part of Tymm's Arduino Midi Library.
+ *
+ *  Tymm's Arduino Midi Library is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation, either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  Tymm's Arduino Midi Library is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Tymm's Arduino Midi Library.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+#include "MidiClockTracker.h"
+
+
+MidiClockTracker::MidiClockTracker(unsigned long clockRate)
+  : clockRate_(clockRate)
+{
+    reset();
+}
+
+
+void MidiClockTracker::reset(void)
+{
+    state_ = WAITING;
+    settleCount_ = 0;
+    errorAverage8_ = 0;
+    period_ = 0;
+    lastTick_ = 0;
+    nextTick_ = 0;
+    lastArrival_ = 0;
+
+    running_ = false;
+    holdTick_ = false;
+    position_ = 0;
+
+    outStarted_ = false;
+}
+
+
+// Start tracking over from scratch, taking the time since the last tick as
+//  the period (or measuring again if there wasn't any)
+void MidiClockTracker::acquire(unsigned long now)
+{
+    unsigned long period = now - lastArrival_;
+
+
+    period_ = period << PERIOD_SHIFT;
+    lastTick_ = now;
+    nextTick_ = now + period;
+    lastArrival_ = now;
+    settleCount_ = 0;
+    errorAverage8_ = 0;
+    state_ = period ? TRACKING : MEASURING;
+}
+
+
+void MidiClockTracker::tick(unsigned long now)
+{
+    long period = period_ >> PERIOD_SHIFT;
+    long error;
+
+
+    if (running_) {
+        if (holdTick_) {
+            holdTick_ = false;
+        } else {
+            position_++;
+        }
+    }
+
+    switch (state_) {
+        case WAITING:
+            lastTick_ = now;
+            lastArrival_ = now;
+            state_ = MEASURING;
+            return;
+
+        case MEASURING:
+            acquire(now);
+            return;
+    }
+
+    /* How late (or early, if negative) the tick is */
+    error = (long)(now - nextTick_);
+
+    /* Way off -- the tempo jumped, or ticks went missing; start over */
+    if (error > period / 2 || error < -period / 2) {
+        acquire(now);
+        return;
+    }
+
+    /* Move the period a little way towards what it looks like it should
+     *  be, and the phase a bit further
+     */
+    period_ += error * (1L << (PERIOD_SHIFT - PERIOD_GAIN_SHIFT));
+    lastTick_ = nextTick_ + error / (1L << PHASE_GAIN_SHIFT);
+    nextTick_ = lastTick_ + (period_ >> PERIOD_SHIFT);
+    lastArrival_ = now;
+
+    errorAverage8_ += (error < 0 ? -error : error) - (errorAverage8_ >> 3);
+    if (settleCount_ < LOCK_TICKS) {
+        settleCount_++;
+    }
+}
+
+
+// START: the song starts from the beginning at the next tick
+void MidiClockTracker::start(void)
+{
+    running_ = true;
+    holdTick_ = true;
+    position_ = 0;
+}
+
+
+void MidiClockTracker::stop(void)
+{
+    running_ = false;
+}
+
+
+// CONTINUE: the song carries on from where it is at the next tick
+void MidiClockTracker::resume(void)
+{
+    running_ = true;
+    holdTick_ = true;
+}
+
+
+void MidiClockTracker::songPosition(unsigned int position)
+{
+    position_ = (unsigned long)position * TICKS_PER_SONG_POSITION;
+}
+
+
+bool MidiClockTracker::process(const MidiMessage &message, unsigned long now)
+{
+    switch (message.type) {
+        case MidiMessage::SYNC:
+            tick(now);
+            return true;
+        case MidiMessage::START:
+            start();
+            return true;
+        case MidiMessage::CONTINUE:
+            resume();
+            return true;
+        case MidiMessage::STOP:
+            stop();
+            return true;
+        case MidiMessage::SONG_POSITION:
+            songPosition((message.data2 << 7) | message.data1);
+            return true;
+    }
+
+    return false;
+}
+
+
+float MidiClockTracker::bpm(void) const
+{
+    if (state_ != TRACKING || !period_) {
+        return 0;
+    }
+
+    return (float)clockRate_ * 60.0f * (1 << PERIOD_SHIFT)
+           / ((float)period_ * TICKS_PER_BEAT);
+}
+
+
+unsigned int MidiClockTracker::phase(unsigned long now) const
+{
+    unsigned long period = period_ >> PERIOD_SHIFT;
+    long elapsed = (long)(now - lastTick_);
+
+
+    if (state_ != TRACKING || !period || elapsed < 0) {
+        return 0;
+    }
+
+    if ((unsigned long)elapsed >= period) {
+        return 255;
+    }
+
+    return ((unsigned long)elapsed << 8) / period;
+}
+
+
+bool MidiClockTracker::clockDue(unsigned long now)
+{
+    long period = period_ >> PERIOD_SHIFT;
+    long error;
+
+
+    /* Only send once the tempo has settled, and while the incoming clock
+     *  is still coming in; with no time between ticks there'd be no end to
+     *  the ticks due
+     */
+    if (period <= 0 || settleCount_ < LOCK_TICKS
+        || (long)(now - lastArrival_) > period * 4) {
+        outStarted_ = false;
+        return false;
+    }
+
+    /* Start (or after falling way behind, start over) in line with the
+     *  next incoming tick
+     */
+    if (!outStarted_ || (long)(now - outNext_) > period * 4) {
+        outNext_ = nextTick_;
+        outStarted_ = true;
+    }
+
+    if ((long)(now - outNext_) < 0) {
+        return false;
+    }
+
+    outNext_ += period;
+
+    /* Pull our clock a bit towards the predicted incoming ticks (whichever
+     *  one is closest)
+     */
+    error = (long)(nextTick_ - outNext_);
+    while (error > period / 2) {
+        error -= period;
+    }
+    while (error < -period / 2) {
+        error += period;
+    }
+    outNext_ += error / (1L << PHASE_GAIN_SHIFT);
+
+    return true;
+}
@@ -0,0 +1,183 @@
+/*
+ *  MidiClockTracker.h: Follows an incoming MIDI clock, working out a steady
+ *                      tempo from the (jittery) times the ticks arrive
+ *
+ *             (c) 2003-2011 Tymm Twillman <tymmothy@gmail.com>
+ *
+ *  This file is part of Tymm's Arduino Midi Library.
+ *
+ *  Tymm's Arduino Midi Library is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation, either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  Tymm's Arduino Midi Library is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Tymm's Arduino Midi Library.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MIDICLOCKTRACKER_H
+#define MIDICLOCKTRACKER_H
+
+#include "MidiParser.h"
+
+
+/*
+ * MIDI clock (SYNC) messages come 24 times per quarter note, but they
+ *  rarely arrive exactly on time -- a busy sender, a busy link and a busy
+ *  receiver all add jitter.  A MidiClockTracker smooths that out with a
+ *  phase locked loop: it predicts when each tick should arrive, and nudges
+ *  its idea of the tick period & phase by a fraction of how far off each
+ *  prediction was.  That gives a stable tempo & a position within each
+ *  tick, which can also be used to send out a clean clock of our own.
+ *
+ * Times are in whatever units the clock used to measure them is in (e.g.
+ *  micros()); the tracker is told how many of those there are per second
+ *  only so that it can work out the tempo in BPM.  It's fed from the handle
+ *  functions, e.g.
+ *
+ *   void handleSync(void) { tracker.tick(micros()); }
+ *   void handleStart(void) { tracker.start(); }
+ *
+ *  or with process() for each message from decode().  Everything is done
+ *  with shifts & adds, except for working out the BPM & sub-tick phase.
+ */
+
+class MidiClockTracker {
+public:
+    // MIDI clock ticks per quarter note
+    static const unsigned int TICKS_PER_BEAT = 24;
+
+    // Ticks per song position unit (a 16th note)
+    static const unsigned int TICKS_PER_SONG_POSITION = 6;
+
+    // Bits of fraction kept in the tick period
+    static const unsigned int PERIOD_SHIFT = 8;
+
+private:
+    // How much of each prediction error goes into the phase (1/4) and into
+    //  the period (1/32).  Bigger shifts filter more jitter but take longer
+    //  to follow tempo changes.
+    static const unsigned int PHASE_GAIN_SHIFT = 2;
+    static const unsigned int PERIOD_GAIN_SHIFT = 5;
+
+    // Number of ticks the tracker needs to settle after picking up a new
+    //  tempo, and how close (on average) ticks then need to be to where they
+    //  were expected for it to count as locked: within 1/8 of a tick
+    static const unsigned int LOCK_TICKS = 8;
+    static const unsigned int LOCK_ERROR_SHIFT = 3;
+
+    enum {
+        WAITING,     // haven't had a tick yet
+        MEASURING,   // had one tick; the next (later) one gives the first period
+        TRACKING     // have a period, which is never 0
+    };
+
+    unsigned long clockRate_;
+
+    unsigned char state_;
+
+    // Ticks since the tempo was last picked up from scratch (stops counting
+    //  at LOCK_TICKS), and the running average of how far off the
+    //  predictions have been (times 8, and 1/8 weight for each new tick)
+    unsigned char settleCount_;
+    unsigned long errorAverage8_;
+
+    // The tick period (times 2^PERIOD_SHIFT), the smoothed time of the last
+    //  tick, when the next one is expected, and when the last one really
+    //  arrived
+    unsigned long period_;
+    unsigned long lastTick_;
+    unsigned long nextTick_;
+    unsigned long lastArrival_;
+
+    // Transport state: whether the sequence is running, how many ticks into
+    //  the song it is, and whether the next tick is the one the song starts
+    //  (or continues) from rather than one that moves it along
+    bool running_;
+    bool holdTick_;
+    unsigned long position_;
+
+    // When the next tick of our own clock is due (see sendClock()), and
+    //  whether it's been started
+    unsigned long outNext_;
+    bool outStarted_;
+
+    void acquire(unsigned long now);
+
+public:
+    // clockRate is the number of clock units per second (1000000 for
+    //  micros())
+    MidiClockTracker(unsigned long clockRate = 1000000UL);
+
+    // Forget everything & wait for clock ticks to come in again
+    void reset();
+
+    // Feed in the incoming messages.  now is the time the message arrived.
+    void tick(unsigned long now);
+    void start();
+    void stop();
+    void resume();
+    void songPosition(unsigned int position);
+
+    // Feed in any decoded message (ones that aren't about clock or
+    //  transport are ignored).  Returns true if it was one of ours.
+    bool process(const MidiMessage &message, unsigned long now);
+
+    // Whether the tracker has a tempo yet, and whether the ticks have been
+    //  steady enough for a while to trust it
+    bool tracking() const { return state_ == TRACKING; }
+    bool locked() const
+    {
+        return settleCount_ >= LOCK_TICKS
+               && (errorAverage8_ >> 3) < (period_ >> (PERIOD_SHIFT + LOCK_ERROR_SHIFT));
+    }
+
+    // The smoothed time between ticks, in clock units (with
+    //  PERIOD_SHIFT bits of fraction in the second one)
+    unsigned long tickPeriod() const { return period_ >> PERIOD_SHIFT; }
+    unsigned long tickPeriodFraction() const { return period_; }
+
+    // Tempo in quarter notes per minute (0 if there isn't one yet)
+    float bpm() const;
+
+    // How far through the current tick now is, from 0 to 255
+    unsigned int phase(unsigned long now) const;
+
+    // Transport: whether the sequence is running, and the number of ticks
+    //  from the start of the song (song position * 6)
+    bool running() const { return running_; }
+    unsigned long position() const { return position_; }
+
+    // Send our own clock, at the tracked tempo & lined up with the incoming
+    //  ticks, but without their jitter: call this often (e.g. every time
+    //  through loop()) with out being a Midi or StaticMidi instance, and it
+    //  calls out.sendSync() whenever a tick is due.  Nothing is sent until
+    //  the tracker has settled on a tempo, or once the incoming clock has
+    //  stopped for more than a few ticks.  Returns the number of ticks
+    //  sent.
+    template <class Output>
+    unsigned int sendClock(Output &out, unsigned long now)
+    {
+        unsigned int sent = 0;
+
+
+        while (clockDue(now)) {
+            out.sendSync();
+            sent++;
+        }
+
+        return sent;
+    }
+
+    // Returns true (& moves on to the next tick) if a tick of our own clock
+    //  is due; sendClock() uses this
+    bool clockDue(unsigned long now);
+};
+
+#endif /* #ifndef MIDICLOCKTRACKER_H ... */
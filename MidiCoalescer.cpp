@@ -0,0 +1,330 @@
+/*  MidiCoalescer.cpp: Holds outgoing messages until there is room to send them
+ *
+ *             (c) 2003-2011 Tymm Twillman <tymmothy@gmail.com>
+ *
+ *  This file is part of Tymm's Arduino Midi Library.
+ *
+ *  Tymm's Arduino Midi Library is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation, either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  Tymm's Arduino Midi Library is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Tymm's Arduino Midi Library.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+#include "MidiCoalescer.h"
+
+
+// Parts of a MidiCoalescedValue waiting to go out
+static const unsigned char PENDING_VALUE  = 0x01;
+static const unsigned char PENDING_VALUE2 = 0x02;
+
+static const unsigned char CONTROLLER_DATA_ENTRY = 6;
+
+
+// Whether only the latest of a kind of message needs to go out, and if so,
+//  what it's kept under & which part of the value it sets
+static bool coalescable(const MidiMessage &message, unsigned char *key, unsigned char *part)
+{
+    unsigned char controller = message.data1;
+
+
+    *key = 0;
+    *part = PENDING_VALUE;
+
+    switch (message.status & 0xf0) {
+        case STATUS_EVENT_VELOCITY_CHANGE:
+            *key = message.data1;
+            return true;
+
+        case STATUS_AFTER_TOUCH:
+        case STATUS_PITCH_CHANGE:
+            return true;
+
+        case STATUS_EVENT_CONTROL_CHANGE:
+            /* The 14-bit controllers (apart from data entry, which goes
+             *  with whatever parameter was picked before it), the sound
+             *  controllers and the effects depths
+             */
+            if (controller < 64 && (controller & 0x1f) != CONTROLLER_DATA_ENTRY) {
+                *key = controller & 0x1f;
+                if (controller >= 32) {
+                    *part = PENDING_VALUE2;
+                }
+                return true;
+            }
+
+            if ((controller >= 70 && controller <= 79)
+              || (controller >= 91 && controller <= 95))
+            {
+                *key = controller;
+                return true;
+            }
+            return false;
+
+        default:
+            return false;
+    }
+}
+
+
+MidiCoalescer::MidiCoalescer(MidiMessage *queue, unsigned int queueSize,
+                             MidiCoalescedValue *values, unsigned int valuesSize)
+  : queue_(queue), queueSize_(queueSize), values_(values), valuesSize_(valuesSize)
+{
+    clear();
+}
+
+
+void MidiCoalescer::clear(void)
+{
+    queueHead_ = 0;
+    queueCount_ = 0;
+    valuesCount_ = 0;
+    coalesced_ = 0;
+    overflows_ = 0;
+}
+
+
+void MidiCoalescer::enqueue(const MidiMessage &message)
+{
+    unsigned int tail = queueHead_ + queueCount_;
+
+
+    if (tail >= queueSize_) {
+        tail -= queueSize_;
+    }
+
+    queue_[tail] = message;
+    queueCount_++;
+}
+
+
+void MidiCoalescer::removeValue(unsigned int index)
+{
+    valuesCount_--;
+
+    for (; index < valuesCount_; index++) {
+        values_[index] = values_[index + 1];
+    }
+}
+
+
+// Fill in the message for the next part of value to go out; returns its
+//  pending flag
+unsigned int MidiCoalescer::valueMessage(const MidiCoalescedValue &value, MidiMessage *message)
+{
+    message->status = value.status;
+    message->type = MidiMessage::NONE;
+
+    switch (value.status & 0xf0) {
+        case STATUS_EVENT_CONTROL_CHANGE:
+            if (value.pending & PENDING_VALUE) {
+                message->data1 = value.key;
+                message->data2 = value.value;
+                return PENDING_VALUE;
+            }
+
+            message->data1 = value.key + 32;
+            message->data2 = value.value2;
+            return PENDING_VALUE2;
+
+        case STATUS_EVENT_VELOCITY_CHANGE:
+            message->data1 = value.key;
+            message->data2 = value.value;
+            break;
+
+        case STATUS_AFTER_TOUCH:
+            message->data1 = value.value;
+            message->data2 = 0;
+            break;
+
+        default:
+            message->data1 = value.value;
+            message->data2 = value.value2;
+            break;
+    }
+
+    return PENDING_VALUE;
+}
+
+
+// Move values waiting for a channel into the queue, ahead of a message for
+//  that channel that's about to go in
+void MidiCoalescer::flushChannel(unsigned char channel)
+{
+    MidiMessage message;
+    unsigned int i = 0;
+
+
+    while (i < valuesCount_) {
+        MidiCoalescedValue &value = values_[i];
+
+
+        if ((value.status & 0x0f) != channel) {
+            i++;
+            continue;
+        }
+
+        while (value.pending) {
+            value.pending &= ~valueMessage(value, &message);
+            enqueue(message);
+        }
+
+        removeValue(i);
+    }
+}
+
+
+bool MidiCoalescer::send(const MidiMessage &message)
+{
+    unsigned char key;
+    unsigned char part;
+    unsigned int needed = 1;
+    unsigned int i;
+
+
+    /* System exclusive data doesn't fit in a MidiMessage */
+    if (message.status == STATUS_START_PROPRIETARY
+      || message.status == STATUS_END_PROPRIETARY)
+    {
+        return false;
+    }
+
+    if (coalescable(message, &key, &part)) {
+        unsigned char data = (message.status & 0xf0) == STATUS_AFTER_TOUCH
+                             || (message.status & 0xf0) == STATUS_PITCH_CHANGE
+                             ? message.data1 : message.data2;
+
+
+        for (i = 0; i < valuesCount_; i++) {
+            MidiCoalescedValue &value = values_[i];
+
+
+            if (value.status != message.status || value.key != key) {
+                continue;
+            }
+
+            /* A new MSB sets the LSB to 0 at the other end, so an LSB
+             *  that's waiting is no use any more
+             */
+            if (value.pending & part) {
+                coalesced_++;
+            }
+            if (part == PENDING_VALUE && (value.pending & PENDING_VALUE2)
+              && (message.status & 0xf0) == STATUS_EVENT_CONTROL_CHANGE)
+            {
+                value.pending &= ~PENDING_VALUE2;
+                coalesced_++;
+            }
+
+            if (part == PENDING_VALUE) {
+                value.value = data;
+                if ((message.status & 0xf0) == STATUS_PITCH_CHANGE) {
+                    value.value2 = message.data2;
+                }
+            } else {
+                value.value2 = data;
+            }
+            value.pending |= part;
+
+            return true;
+        }
+
+        if (valuesCount_ < valuesSize_) {
+            MidiCoalescedValue &value = values_[valuesCount_++];
+
+
+            value.status = message.status;
+            value.key = key;
+            value.value = part == PENDING_VALUE ? data : 0;
+            value.value2 = part == PENDING_VALUE2 ? data : 0;
+            if ((message.status & 0xf0) == STATUS_PITCH_CHANGE) {
+                value.value2 = message.data2;
+            }
+            value.pending = part;
+
+            return true;
+        }
+
+        /* Nowhere to keep it; it goes in the queue like anything else */
+    }
+
+    /* Values waiting for the same channel go ahead of it, so there has to
+     *  be room for those too
+     */
+    if (message.status < 0xf0) {
+        for (i = 0; i < valuesCount_; i++) {
+            if ((values_[i].status & 0x0f) == (message.status & 0x0f)) {
+                needed += (values_[i].pending == (PENDING_VALUE | PENDING_VALUE2)) ? 2 : 1;
+            }
+        }
+    }
+
+    if (queueCount_ + needed > queueSize_) {
+        overflows_++;
+        return false;
+    }
+
+    if (message.status < 0xf0) {
+        flushChannel(message.status & 0x0f);
+    }
+
+    enqueue(message);
+
+    return true;
+}
+
+
+bool MidiCoalescer::next(MidiMessage *message, unsigned int maxLength)
+{
+    unsigned int part;
+
+
+    if (queueCount_) {
+        if (maxLength && MidiParser::messageLength(queue_[queueHead_].status) > maxLength) {
+            return false;
+        }
+
+        *message = queue_[queueHead_];
+        if (++queueHead_ == queueSize_) {
+            queueHead_ = 0;
+        }
+        queueCount_--;
+        return true;
+    }
+
+    if (!valuesCount_) {
+        return false;
+    }
+
+    /* The value that's been waiting longest.  A 14-bit controller whose
+     *  LSB is still waiting after its MSB goes to the back of the line for
+     *  it, so that a controller whose MSB keeps changing can't keep the
+     *  front to itself.
+     */
+    part = valueMessage(values_[0], message);
+    if (maxLength && MidiParser::messageLength(message->status) > maxLength) {
+        return false;
+    }
+
+    values_[0].pending &= ~part;
+    if (values_[0].pending) {
+        MidiCoalescedValue value = values_[0];
+
+
+        removeValue(0);
+        values_[valuesCount_++] = value;
+    } else {
+        removeValue(0);
+    }
+
+    return true;
+}
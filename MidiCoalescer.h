@@ -0,0 +1,210 @@
+/*
+ *  MidiCoalescer.h: Holds outgoing messages until there is room to send them,
+ *                   keeping only the latest value of each controller
+ *
+ *             (c) 2003-2011 Tymm Twillman <tymmothy@gmail.com>
+ *
+ *  This file is part of Tymm's Arduino Midi Library.
+ *
+ *  Tymm's Arduino Midi Library is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation, either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  Tymm's Arduino Midi Library is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Tymm's Arduino Midi Library.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef MIDICOALESCER_H
+#define MIDICOALESCER_H
+
+#include "MidiParser.h"
+
+
+// The latest value waiting to go out for one controller (or pitch bend, or
+//  aftertouch) on one channel
+struct MidiCoalescedValue {
+    unsigned char status;
+
+    // Controller number (the MSB's number for 14-bit controllers), or note
+    //  for polyphonic aftertouch
+    unsigned char key;
+
+    // The value (the MSB for 14-bit controllers, and the low 7 bits for
+    //  pitch bend), and the LSB for 14-bit controllers (high 7 bits for
+    //  pitch bend)
+    unsigned char value;
+    unsigned char value2;
+
+    // Which of those are waiting to be sent
+    unsigned char pending;
+};
+
+
+/*
+ * A MidiCoalescer sits between a sketch and a Midi (or StaticMidi) instance,
+ *  for when messages are being made faster than the link can carry them
+ *  (e.g. while a knob is being turned quickly).  Messages are handed to it
+ *  with send() or the send functions below, and go out as there's room from
+ *  service(), which should be called every time through loop().
+ *
+ * Continuous controllers, pitch bend and aftertouch only keep their latest
+ *  value: a new value for something that's still waiting to go out just
+ *  replaces the old one, in the same place in line, so however fast things
+ *  change, the wait is never longer than it takes to send one value for
+ *  everything that's moving.  Those that are waiting go out in the order
+ *  they first changed, taking turns.
+ *
+ * Everything else (notes, program changes, switch controllers like the
+ *  sustain pedal, RPN / NRPN & data entry, system messages) goes through a
+ *  plain first in, first out queue, and is never dropped or reordered.
+ *  Queued messages go out ahead of waiting values, except that values for
+ *  a channel that were changed before a message for that channel was
+ *  queued go into the queue ahead of it, so e.g. a pitch bend still goes
+ *  out before the note it was set up for.
+ *
+ * 14-bit controllers (0-31 paired with 32-63) share a place in line, and
+ *  go out MSB first; the LSB then waits its turn at the back of the line
+ *  like any other value.  Since receiving an MSB sets the LSB to 0, a new
+ *  MSB drops an LSB that's still waiting.
+ *
+ * Storage for both is given by the user.  Values that don't fit in the
+ *  values array go through the queue like everything else.
+ */
+
+class MidiCoalescer {
+private:
+    MidiMessage *queue_;
+    unsigned int queueSize_;
+    unsigned int queueHead_;
+    unsigned int queueCount_;
+
+    // Values waiting, oldest first
+    MidiCoalescedValue *values_;
+    unsigned int valuesSize_;
+    unsigned int valuesCount_;
+
+    unsigned long coalesced_;
+    unsigned long overflows_;
+
+    void enqueue(const MidiMessage &message);
+    void flushChannel(unsigned char channel);
+    void removeValue(unsigned int index);
+    static unsigned int valueMessage(const MidiCoalescedValue &value, MidiMessage *message);
+
+    void sendChannelMessage(unsigned char status, unsigned char data1, unsigned char data2)
+    {
+        MidiMessage message;
+
+
+        message.status = status;
+        message.data1 = data1 & 0x7f;
+        message.data2 = data2 & 0x7f;
+        message.type = MidiMessage::NONE;
+        send(message);
+    }
+
+public:
+    // queue holds room for queueSize messages, and values for valuesSize
+    //  values
+    MidiCoalescer(MidiMessage *queue, unsigned int queueSize,
+                  MidiCoalescedValue *values, unsigned int valuesSize);
+
+    // Add a message to go out (in the same form as Midi::send() takes).
+    //  Returns false (and counts an overflow) if there's no room in the
+    //  queue for it; values that replace one that's waiting always fit.
+    //  SYSEX messages can't be sent this way.
+    bool send(const MidiMessage &message);
+
+    // These match the Midi send functions
+    void sendNoteOff(unsigned int channel, unsigned int note, unsigned int velocity)
+    {
+        sendChannelMessage(STATUS_EVENT_NOTE_OFF | ((channel - 1) & 0x0f), note, velocity);
+    }
+
+    void sendNoteOn(unsigned int channel, unsigned int note, unsigned int velocity)
+    {
+        sendChannelMessage(STATUS_EVENT_NOTE_ON | ((channel - 1) & 0x0f), note, velocity);
+    }
+
+    void sendVelocityChange(unsigned int channel, unsigned int note, unsigned int velocity)
+    {
+        sendChannelMessage(STATUS_EVENT_VELOCITY_CHANGE | ((channel - 1) & 0x0f), note, velocity);
+    }
+
+    void sendControlChange(unsigned int channel, unsigned int controller, unsigned int value)
+    {
+        sendChannelMessage(STATUS_EVENT_CONTROL_CHANGE | ((channel - 1) & 0x0f), controller, value);
+    }
+
+    void sendProgramChange(unsigned int channel, unsigned int program)
+    {
+        sendChannelMessage(STATUS_EVENT_PROGRAM_CHANGE | ((channel - 1) & 0x0f), program, 0);
+    }
+
+    void sendAfterTouch(unsigned int channel, unsigned int velocity)
+    {
+        sendChannelMessage(STATUS_AFTER_TOUCH | ((channel - 1) & 0x0f), velocity, 0);
+    }
+
+    void sendPitchBend(unsigned int channel, unsigned int bend)
+    {
+        sendChannelMessage(STATUS_PITCH_CHANGE | ((channel - 1) & 0x0f), bend, bend >> 7);
+    }
+
+    void sendPitchChange(unsigned int pitch) { sendPitchBend(1, pitch); }
+
+    // Take the next message to go out, if there is one that's no more than
+    //  maxLength bytes long (0 for any length)
+    bool next(MidiMessage *message, unsigned int maxLength = 0);
+
+    // Send what's waiting through out (a Midi or StaticMidi instance, or
+    //  anything else with a send(const MidiMessage &)), stopping before
+    //  going over maxBytes if that's not 0 -- e.g. pass
+    //  Serial.availableForWrite() to only send what the serial port can
+    //  take without waiting.  Returns the number of messages sent.
+    template <class Output>
+    unsigned int service(Output &out, unsigned int maxBytes = 0)
+    {
+        MidiMessage message;
+        unsigned int sent = 0;
+        unsigned int length;
+
+
+        while (next(&message, maxBytes)) {
+            out.send(message);
+            sent++;
+
+            if (maxBytes) {
+                length = MidiParser::messageLength(message.status);
+                if (length >= maxBytes) {
+                    break;
+                }
+                maxBytes -= length;
+            }
+        }
+
+        return sent;
+    }
+
+    // Throw away everything waiting
+    void clear();
+
+    // Number of messages waiting in the queue, and values waiting
+    unsigned int queued() const { return queueCount_; }
+    unsigned int pending() const { return valuesCount_; }
+
+    // Number of values that were replaced before they went out, and
+    //  messages that didn't fit in the queue
+    unsigned long coalesced() const { return coalesced_; }
+    unsigned long overflows() const { return overflows_; }
+};
+
+#endif /* #ifndef MIDICOALESCER_H ... */
@@ -0,0 +1,55 @@
+/*
+ *  MidiConfig.h: Compile time options for the Midi library
+ *
+ *             (c) 2003-2011 Tymm Twillman <tymmothy@gmail.com>
+ *
+ *  This file is part of Tymm's Arduino Midi Library.
+ *
+ *  Tymm's Arduino Midi Library is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation, either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  Tymm's Arduino Midi Library is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Tymm's Arduino Midi Library.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MIDICONFIG_H
+#define MIDICONFIG_H
+
+/*
+ * Features that cost RAM or time on every message, and so are left out
+ *  unless asked for.  Change the values here (or define them on the
+ *  compiler's command line) to turn them on.
+ */
+
+
+// Set to 1 to have every decoded message stamped with the time its first
+//  byte was read (see Midi::setClock()), and keep statistics on how long
+//  messages wait to be handled.  This makes each MidiMessage 4 bytes bigger.
+#ifndef MIDI_TIMESTAMPS
+#define MIDI_TIMESTAMPS 0
+#endif
+
+// Set to 1 to keep counts of bytes & messages received and sent, and of
+//  problems with the incoming data (see MidiStats in MidiParser.h)
+#ifndef MIDI_STATS
+#define MIDI_STATS 0
+#endif
+
+
+// Wraps a statement that updates a statistics counter, so that it
+//  disappears entirely when MIDI_STATS is turned off
+#if MIDI_STATS
+#define MIDI_STAT(statement) statement
+#else
+#define MIDI_STAT(statement)
+#endif
+
+#endif /* #ifndef MIDICONFIG_H ... */
@@ -0,0 +1,185 @@
+/*  MidiControllers.cpp: Keeps the current value of every controller
+ *
+ *             (c) 2003-2011 Tymm Twillman <tymmothy@gmail.com>
+ *
+ *  This file is part of Tymm's Arduino Midi Library.
+ *
+ *  Tymm's Arduino Midi Library is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation, either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  Tymm's Arduino Midi Library is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Tymm's Arduino Midi Library.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+#include "MidiControllers.h"
+
+
+MidiControllers::MidiControllers(MidiControllerChannel *storage, unsigned int count)
+  : channels_(storage), count_(count > 16 ? 16 : count)
+{
+    reset();
+}
+
+
+// Remember a controller's new value, keeping track of which parameter
+//  data entry is for
+void MidiControllers::store(MidiControllerChannel &channel, unsigned int controller,
+                            unsigned int value)
+{
+    unsigned int parameter;
+    unsigned int data;
+
+
+    if (controller < 32) {
+        channel.values[controller] = value;
+        channel.values[controller + 32] = 0;
+        channel.known |= 1UL << controller;
+        return;
+    }
+
+    switch (controller) {
+        case DATA_INCREMENT:
+        case DATA_DECREMENT:
+            if (channel.parameter & NO_PARAMETER) {
+                break;
+            }
+
+            data = value14(channel, DATA_ENTRY);
+            if (controller == DATA_INCREMENT && data < 0x3fff) {
+                data++;
+            } else if (controller == DATA_DECREMENT && data > 0) {
+                data--;
+            }
+
+            channel.values[DATA_ENTRY] = data >> 7;
+            channel.values[DATA_ENTRY + 32] = data & 0x7f;
+            break;
+
+        case NRPN_LSB:
+        case NRPN_MSB:
+        case RPN_LSB:
+        case RPN_MSB:
+            channel.values[controller] = value;
+
+            /* Both halves come from the same kind of parameter number (the
+             *  other half is whatever was sent for it last)
+             */
+            if (controller >= RPN_LSB) {
+                parameter = RPN | (channel.values[RPN_MSB] << 7) | channel.values[RPN_LSB];
+                if ((parameter & 0x3fff) == NULL_PARAMETER) {
+                    parameter = NO_PARAMETER;
+                }
+            } else {
+                parameter = NRPN | (channel.values[NRPN_MSB] << 7) | channel.values[NRPN_LSB];
+            }
+
+            /* A different parameter has its own value at the other end */
+            if (parameter != channel.parameter) {
+                channel.parameter = parameter;
+                channel.known &= ~(1UL << DATA_ENTRY);
+            }
+            break;
+
+        case RESET_ALL:
+            channel.values[controller] = value;
+            channel.parameter = NO_PARAMETER;
+            break;
+
+        default:
+            channel.values[controller] = value;
+            break;
+    }
+}
+
+
+void MidiControllers::process(const MidiMessage &message)
+{
+    unsigned int channel = message.status & 0x0f;
+    /* Messages built by hand (rather than decoded) might not have clean
+     *  data bytes, and the controller number is used as an index
+     */
+    unsigned int controller = message.data1 & 0x7f;
+    MidiControllerChannel *ch;
+
+
+    if (message.type != MidiMessage::CONTROL_CHANGE) {
+        if (message.type == MidiMessage::RESET) {
+            reset();
+        }
+        return;
+    }
+
+    if (channel >= count_) {
+        return;
+    }
+
+    ch = &channels_[channel];
+    store(*ch, controller, message.data2 & 0x7f);
+
+    /* Data entry goes to the parameter that's picked, if there is one */
+    if (controller == DATA_ENTRY || controller == DATA_ENTRY + 32
+      || controller == DATA_INCREMENT || controller == DATA_DECREMENT)
+    {
+        if (!(ch->parameter & NO_PARAMETER)) {
+            if (ch->parameter & NRPN) {
+                handleNrpn(channel + 1, ch->parameter & 0x3fff, value14(*ch, DATA_ENTRY));
+            } else {
+                handleRpn(channel + 1, ch->parameter & 0x3fff, value14(*ch, DATA_ENTRY));
+            }
+            return;
+        }
+    }
+
+    if (controller < 64) {
+        controller &= 0x1f;
+        handleControlChange14(channel + 1, controller, value14(*ch, controller));
+    }
+}
+
+
+unsigned int MidiControllers::value(unsigned int channel, unsigned int controller) const
+{
+    channel = (channel - 1) & 0x0f;
+
+    return channel < count_ ? channels_[channel].values[controller & 0x7f] : 0;
+}
+
+
+unsigned int MidiControllers::value14(unsigned int channel, unsigned int controller) const
+{
+    channel = (channel - 1) & 0x0f;
+
+    return channel < count_ ? value14(channels_[channel], controller & 0x1f) : 0;
+}
+
+
+unsigned int MidiControllers::parameter(unsigned int channel) const
+{
+    channel = (channel - 1) & 0x0f;
+
+    return channel < count_ ? channels_[channel].parameter : NO_PARAMETER;
+}
+
+
+void MidiControllers::reset(void)
+{
+    for (unsigned int c = 0; c < count_; c++) {
+        MidiControllerChannel &channel = channels_[c];
+
+
+        for (unsigned int i = 0; i < 128; i++) {
+            channel.values[i] = 0;
+        }
+
+        channel.parameter = NO_PARAMETER;
+        channel.known = 0;
+    }
+}
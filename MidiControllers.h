@@ -0,0 +1,270 @@
+/*
+ *  MidiControllers.h: Keeps the current value of every controller, and puts
+ *                     together 14-bit values and RPN / NRPN changes
+ *
+ *             (c) 2003-2011 Tymm Twillman <tymmothy@gmail.com>
+ *
+ *  This file is part of Tymm's Arduino Midi Library.
+ *
+ *  Tymm's Arduino Midi Library is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation, either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  Tymm's Arduino Midi Library is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Tymm's Arduino Midi Library.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef MIDICONTROLLERS_H
+#define MIDICONTROLLERS_H
+
+#include "MidiListener.h"
+
+
+// Everything kept for one channel
+struct MidiControllerChannel {
+    unsigned char values[128];
+
+    // The RPN or NRPN that data entry changes (see MidiControllers::RPN etc.)
+    unsigned int parameter;
+
+    // Bit n is set once controller n (0-31) has a value that the other end
+    //  knows about
+    unsigned long known;
+};
+
+
+/*
+ * MidiControllers keeps the latest value of each controller on each
+ *  channel, and puts together the pieces of the controllers that are sent
+ *  in more than one message:
+ *
+ *  - Controllers 0-31 are the most significant 7 bits of 14-bit values,
+ *    with the least significant 7 bits in controllers 32-63.  Receiving
+ *    the MSB sets the LSB back to 0, so the LSB only needs sending for
+ *    fine adjustments.
+ *
+ *  - Registered and non-registered parameters (RPN / NRPN) are picked with
+ *    controllers 101 & 100 (RPN MSB & LSB) or 99 & 98 (NRPN), and then set
+ *    with data entry (controllers 6 & 38) or stepped with data increment /
+ *    decrement (96 & 97).
+ *
+ * To use it, subclass it and overload the handle functions below, and add
+ *  it to a Midi instance with addListener() (or pass it messages from a
+ *  StaticMidi instance with process()).  The storage is given by the user,
+ *  one MidiControllerChannel (134 bytes on AVR) per channel; channels past
+ *  the number given are ignored, so e.g. only channel 1 can be kept on
+ *  boards without much memory.
+ *
+ * The send functions do the reverse, using what they've sent before to
+ *  leave out messages that wouldn't change anything (e.g. the MSB of a
+ *  14-bit controller that's only moved by a little, or the parameter
+ *  number when it's the same parameter as last time).  A MidiControllers
+ *  instance used for sending shouldn't also be following received messages.
+ */
+
+class MidiControllers : public MidiListener {
+private:
+    MidiControllerChannel *channels_;
+    unsigned int count_;
+
+    void store(MidiControllerChannel &channel, unsigned int controller,
+               unsigned int value);
+
+    // Value for a controller that's the MSB of a 14-bit pair
+    static unsigned int value14(const MidiControllerChannel &channel,
+                                unsigned int controller)
+    {
+        return (channel.values[controller] << 7) | channel.values[controller + 32];
+    }
+
+    // Send a controller through out, and remember it like it was received
+    template <class Output>
+    void sendStored(Output &out, unsigned int channel, unsigned int controller,
+                    unsigned int value)
+    {
+        out.sendControlChange(channel + 1, controller, value);
+        store(channels_[channel], controller, value);
+    }
+
+    // Pick parameter (type included) for data entry, leaving out the MSB
+    //  if it's the same as the one picked already
+    template <class Output>
+    unsigned int sendParameter(Output &out, unsigned int channel, unsigned int parameter)
+    {
+        MidiControllerChannel &ch = channels_[channel];
+        unsigned int msb = (parameter & NRPN) ? NRPN_MSB : RPN_MSB;
+        unsigned int sent = 0;
+
+
+        if (ch.parameter == parameter) {
+            return 0;
+        }
+
+        if ((ch.parameter & ~0x7f) != (parameter & ~0x7f)) {
+            sendStored(out, channel, msb, (parameter >> 7) & 0x7f);
+            sent++;
+        }
+
+        sendStored(out, channel, msb - 1, parameter & 0x7f);
+
+        return sent + 1;
+    }
+
+    // Send a 14-bit value for an MSB controller, leaving out the MSB when
+    //  it's already there (or the whole thing when nothing's changed)
+    template <class Output>
+    unsigned int send14(Output &out, unsigned int channel, unsigned int controller,
+                        unsigned int value)
+    {
+        MidiControllerChannel &ch = channels_[channel];
+        unsigned int msb = (value >> 7) & 0x7f;
+        unsigned int lsb = value & 0x7f;
+        unsigned int sent = 0;
+
+
+        if (!(ch.known & (1UL << controller)) || ch.values[controller] != msb) {
+            sendStored(out, channel, controller, msb);
+            sent++;
+        }
+
+        /* A new MSB sets the LSB to 0 at the other end, but not everything
+         *  follows that rule, so the LSB always goes with a new MSB
+         */
+        if (sent || ch.values[controller + 32] != lsb) {
+            sendStored(out, channel, controller + 32, lsb);
+            sent++;
+        }
+
+        return sent;
+    }
+
+    // Set parameter (type included) to a 14-bit value
+    template <class Output>
+    unsigned int sendData(Output &out, unsigned int channel, unsigned int parameter,
+                          unsigned int value)
+    {
+        unsigned int sent;
+
+
+        channel = (channel - 1) & 0x0f;
+        if (channel >= count_) {
+            out.sendControlChange(channel + 1, (parameter & NRPN) ? NRPN_MSB : RPN_MSB, (parameter >> 7) & 0x7f);
+            out.sendControlChange(channel + 1, (parameter & NRPN) ? NRPN_LSB : RPN_LSB, parameter & 0x7f);
+            out.sendControlChange(channel + 1, DATA_ENTRY, (value >> 7) & 0x7f);
+            out.sendControlChange(channel + 1, DATA_ENTRY + 32, value & 0x7f);
+            return 4;
+        }
+
+        sent = sendParameter(out, channel, parameter);
+
+        return sent + send14(out, channel, DATA_ENTRY, value);
+    }
+
+public:
+    // Controllers with special meanings
+    static const unsigned int DATA_ENTRY     = 6;
+    static const unsigned int DATA_INCREMENT = 96;
+    static const unsigned int DATA_DECREMENT = 97;
+    static const unsigned int NRPN_LSB       = 98;
+    static const unsigned int NRPN_MSB       = 99;
+    static const unsigned int RPN_LSB        = 100;
+    static const unsigned int RPN_MSB        = 101;
+    static const unsigned int RESET_ALL      = 121;
+
+    // MidiControllerChannel::parameter holds the 14-bit parameter number
+    //  along with one of these
+    static const unsigned int RPN            = 0x0000;
+    static const unsigned int NRPN           = 0x4000;
+    static const unsigned int NO_PARAMETER   = 0x8000;
+
+    // RPN 127/127, which picks no parameter at all
+    static const unsigned int NULL_PARAMETER = 0x3fff;
+
+    // storage holds count channels (starting with channel 1)
+    MidiControllers(MidiControllerChannel *storage, unsigned int count = 16);
+    virtual ~MidiControllers() {}
+
+    // Update from a message (CONTROL CHANGE, and RESET which sets
+    //  everything back to 0), calling the handle functions below
+    void process(const MidiMessage &message);
+
+    void midiReceived(const MidiMessage &message) { process(message); }
+
+    // The latest value of a controller on a channel (1-16), the 14-bit
+    //  value of an MSB controller (0-31) & its LSB, and the RPN / NRPN
+    //  picked for data entry (NO_PARAMETER if there isn't one).  Channels
+    //  that aren't kept read as 0.
+    unsigned int value(unsigned int channel, unsigned int controller) const;
+    unsigned int value14(unsigned int channel, unsigned int controller) const;
+    unsigned int parameter(unsigned int channel) const;
+
+    // Set everything back to 0, with no parameter picked
+    void reset();
+
+    // Overload these in a subclass to hear about changes.  A controller
+    //  0-31 (or its LSB, 32-63) changing gives its whole 14-bit value; data
+    //  entry, increment & decrement while a parameter is picked give the
+    //  14-bit value for the parameter instead.
+    virtual void handleControlChange14(unsigned int channel, unsigned int controller, unsigned int value) {}
+    virtual void handleRpn(unsigned int channel, unsigned int parameter, unsigned int value) {}
+    virtual void handleNrpn(unsigned int channel, unsigned int parameter, unsigned int value) {}
+
+    // Send a 14-bit value for controller 0-31 on channel (1-16) through out
+    //  (a Midi or StaticMidi instance).  Returns the number of messages
+    //  sent: 0 if the value hasn't changed since last time, 1 if only the
+    //  LSB has changed, otherwise 2.
+    template <class Output>
+    unsigned int sendControlChange14(Output &out, unsigned int channel,
+                                     unsigned int controller, unsigned int value)
+    {
+        channel = (channel - 1) & 0x0f;
+        if (channel >= count_) {
+            out.sendControlChange(channel + 1, controller & 0x1f, (value >> 7) & 0x7f);
+            out.sendControlChange(channel + 1, (controller & 0x1f) + 32, value & 0x7f);
+            return 2;
+        }
+
+        return send14(out, channel, controller & 0x1f, value);
+    }
+
+    // Set a registered or non-registered parameter to a 14-bit value; the
+    //  parameter number is only sent if it's different from last time.
+    //  Returns the number of messages sent.
+    template <class Output>
+    unsigned int sendRpn(Output &out, unsigned int channel, unsigned int parameter,
+                         unsigned int value)
+    {
+        return sendData(out, channel, RPN | (parameter & 0x3fff), value);
+    }
+
+    template <class Output>
+    unsigned int sendNrpn(Output &out, unsigned int channel, unsigned int parameter,
+                          unsigned int value)
+    {
+        return sendData(out, channel, NRPN | (parameter & 0x3fff), value);
+    }
+
+    // Pick no parameter (RPN 127/127), so that stray data entry messages
+    //  don't change anything.  This is always sent.
+    template <class Output>
+    void sendNullParameter(Output &out, unsigned int channel)
+    {
+        out.sendControlChange(channel, RPN_MSB, 0x7f);
+        out.sendControlChange(channel, RPN_LSB, 0x7f);
+
+        channel = (channel - 1) & 0x0f;
+        if (channel < count_) {
+            channels_[channel].parameter = NO_PARAMETER;
+        }
+    }
+};
+
+#endif /* #ifndef MIDICONTROLLERS_H ... */
@@ -0,0 +1,649 @@
+/*  MidiFilePlayer.cpp: Plays Standard MIDI Files, reading them a little at a time
+ *
+ *             (c) 2003-2011 Tymm Twillman <tymmothy@gmail.com>
+ *
+ *  This file is part of Tymm's Arduino Midi Library.
+ *
+ *  Tymm's Arduino Midi Library is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation, either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  Tymm's Arduino Midi Library is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Tymm's Arduino Midi Library.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "MidiFilePlayer.h"
+
+
+// Meta event types the player cares about
+static const unsigned char META_END_OF_TRACK = 0x2f;
+static const unsigned char META_TEMPO        = 0x51;
+
+// Most of a file in memory handed to a track at once (so the count fits
+//  in an int on small boards)
+static const unsigned int MAX_MEMORY_CHUNK = 0x7fff;
+
+
+// A big-endian 32 bit number, as used in file chunk headers
+static inline unsigned long read32(const unsigned char *p)
+{
+    return ((unsigned long)p[0] << 24) | ((unsigned long)p[1] << 16)
+           | ((unsigned long)p[2] << 8) | p[3];
+}
+
+
+MidiFilePlayer::MidiFilePlayer(MidiFileTrack *tracks, unsigned int maxTracks,
+                               unsigned char *buffer, unsigned int bufferSize)
+{
+    unsigned int i;
+
+
+    tracks_ = tracks;
+    maxTracks_ = maxTracks;
+    trackCount_ = 0;
+
+    /* Each track gets an equal share of the buffer */
+    bufferSize_ = (buffer && maxTracks) ? bufferSize / maxTracks : 0;
+    for (i = 0; i < maxTracks; i++) {
+        tracks_[i].buffer = buffer ? buffer + i * bufferSize_ : 0;
+        tracks_[i].status = 0;
+    }
+
+    memory_ = 0;
+    memoryLength_ = 0;
+    reader_ = 0;
+    context_ = 0;
+
+    format_ = 0;
+    division_ = 1;
+    smpte_ = false;
+    setTempo(DEFAULT_TEMPO);
+
+    playing_ = false;
+    tick_ = 0;
+    time_ = 0;
+    fraction_ = 0;
+    next_ = NONE;
+    nextTime_ = 0;
+    nextFraction_ = 0;
+
+    sysExTrack_ = NONE;
+    sysExFirst_ = false;
+    sysExOpen_ = false;
+}
+
+
+bool MidiFilePlayer::open(const unsigned char *data, unsigned long length)
+{
+    memory_ = data;
+    memoryLength_ = length;
+    reader_ = 0;
+    context_ = 0;
+
+    return readHeader();
+}
+
+
+bool MidiFilePlayer::open(MidiFileReader reader, void *context)
+{
+    memory_ = 0;
+    memoryLength_ = 0;
+    reader_ = reader;
+    context_ = context;
+
+    return readHeader();
+}
+
+
+// Read the header chunk, and find where each track is
+bool MidiFilePlayer::readHeader()
+{
+    unsigned char header[14];
+    unsigned long offset;
+    unsigned long length;
+    unsigned int count;
+    unsigned int division;
+    unsigned int fps;
+
+
+    /* Anything half sent gets cut off before the new file starts */
+    if (sysExTrack_ != NONE) {
+        sysExOpen_ = true;
+        sysExTrack_ = NONE;
+    }
+    stop();
+    trackCount_ = 0;
+
+    if (!memory_ && !bufferSize_) {
+        return false;
+    }
+
+    if (!readAt(0, header, sizeof(header)) || memcmp(header, "MThd", 4)) {
+        return false;
+    }
+
+    length = read32(header + 4);
+    format_ = (header[8] << 8) | header[9];
+    count = (header[10] << 8) | header[11];
+    division = (header[12] << 8) | header[13];
+
+    if (length < 6 || format_ > 1 || !count || count > maxTracks_) {
+        return false;
+    }
+
+    if (division & 0x8000) {
+        /*
+         * SMPTE timing: the top byte is minus the frames per second, and
+         *  the bottom one ticks per frame.  Ticks are counted per second
+         *  instead of per quarter note, and 29.97 frames per second (given
+         *  as 29) runs at 30 with each second 1.001 seconds long.
+         */
+        fps = 256 - (division >> 8);
+        division &= 0xff;
+        if (!division) {
+            return false;
+        }
+
+        smpte_ = true;
+        if (fps == 29) {
+            division_ = 30 * division;
+            setTempo(1001000UL);
+        } else {
+            division_ = fps * division;
+            setTempo(1000000UL);
+        }
+    } else {
+        if (!division) {
+            return false;
+        }
+
+        smpte_ = false;
+        division_ = division;
+        setTempo(DEFAULT_TEMPO);
+    }
+
+    /* Skip over any chunks that aren't tracks */
+    offset = 8 + length;
+    while (trackCount_ < count && readAt(offset, header, 8)) {
+        length = read32(header + 4);
+
+        if (!memcmp(header, "MTrk", 4)) {
+            MidiFileTrack &track = tracks_[trackCount_++];
+
+            track.start = offset + 8;
+            track.end = track.start + length;
+            if (memory_ && track.end > memoryLength_) {
+                track.end = memoryLength_;
+            }
+            track.status = 0;
+        }
+
+        offset += 8 + length;
+    }
+
+    return trackCount_ != 0;
+}
+
+
+// Read length bytes from offset bytes into the file
+bool MidiFilePlayer::readAt(unsigned long offset, unsigned char *buffer, unsigned int length)
+{
+    unsigned int got;
+
+
+    if (memory_) {
+        if (offset > memoryLength_ || memoryLength_ - offset < length) {
+            return false;
+        }
+        memcpy(buffer, memory_ + offset, length);
+        return true;
+    }
+
+    while (length) {
+        got = reader_(offset, buffer, length, context_);
+        if (!got) {
+            return false;
+        }
+        offset += got;
+        buffer += got;
+        length -= got;
+    }
+
+    return true;
+}
+
+
+// Get the next piece of a track; returns false at the end of it
+bool MidiFilePlayer::fill(MidiFileTrack &track)
+{
+    unsigned long left;
+    unsigned int size;
+
+
+    if (track.position >= track.end) {
+        return false;
+    }
+
+    left = track.end - track.position;
+
+    if (memory_) {
+        size = left > MAX_MEMORY_CHUNK ? MAX_MEMORY_CHUNK : left;
+        track.data = memory_ + track.position;
+    } else {
+        size = left > bufferSize_ ? bufferSize_ : left;
+        size = reader_(track.position, track.buffer, size, context_);
+        if (!size) {
+            track.position = track.end;
+            return false;
+        }
+        track.data = track.buffer;
+    }
+
+    track.position += size;
+    track.available = size;
+
+    return true;
+}
+
+
+// The next byte of a track, or -1 at the end of it
+inline int MidiFilePlayer::readByte(MidiFileTrack &track)
+{
+    if (!track.available && !fill(track)) {
+        return -1;
+    }
+
+    track.available--;
+
+    return *track.data++;
+}
+
+
+// A variable length number (7 bits per byte, top bit set on all but the
+//  last byte, at most 4 bytes)
+bool MidiFilePlayer::readLength(MidiFileTrack &track, unsigned long *value)
+{
+    unsigned long result = 0;
+    unsigned int i;
+    int c;
+
+
+    for (i = 0; i < 4; i++) {
+        if ((c = readByte(track)) < 0) {
+            return false;
+        }
+
+        result = (result << 7) | (c & 0x7f);
+
+        if (!(c & 0x80)) {
+            *value = result;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+// Skip over bytes of a track without reading them in
+void MidiFilePlayer::skip(MidiFileTrack &track, unsigned long length)
+{
+    if (length <= track.available) {
+        track.data += length;
+        track.available -= length;
+        return;
+    }
+
+    length -= track.available;
+    track.available = 0;
+
+    if (length > track.end - track.position) {
+        track.position = track.end;
+    } else {
+        track.position += length;
+    }
+}
+
+
+// Read in a track's next event (all of it for channel messages, and up to
+//  the data for the others); the track ends if there isn't a whole one
+void MidiFilePlayer::advance(MidiFileTrack &track)
+{
+    unsigned long delta;
+    int c;
+
+
+    if (!readLength(track, &delta) || (c = readByte(track)) < 0) {
+        track.status = 0;
+        return;
+    }
+
+    track.tick += delta;
+
+    if (c >= 0xf0) {
+        /* System exclusive & meta events cancel running status */
+        track.runningStatus = 0;
+        track.status = c;
+
+        if (c == STATUS_RESET) {
+            if ((c = readByte(track)) < 0) {
+                track.status = 0;
+                return;
+            }
+            track.data1 = c;
+        } else if (c != STATUS_START_PROPRIETARY && c != STATUS_END_PROPRIETARY) {
+            track.status = 0;
+            return;
+        }
+
+        if (!readLength(track, &track.length)) {
+            track.status = 0;
+        }
+        return;
+    }
+
+    if (c & 0x80) {
+        track.status = track.runningStatus = c;
+        c = readByte(track);
+    } else if (track.runningStatus) {
+        track.status = track.runningStatus;
+    } else {
+        c = -1;
+    }
+
+    if (c < 0) {
+        track.status = 0;
+        return;
+    }
+
+    track.data1 = c & 0x7f;
+    track.data2 = 0;
+
+    if (MidiParser::messageLength(track.status) == 3) {
+        if ((c = readByte(track)) < 0) {
+            track.status = 0;
+            return;
+        }
+        track.data2 = c & 0x7f;
+    }
+}
+
+
+// Pick the track with the earliest event (the first one, if more than one
+//  are at the same tick) and work out when that event is due
+void MidiFilePlayer::findNext()
+{
+    unsigned long delta;
+    unsigned long step;
+    unsigned long time;
+    unsigned long fraction;
+    unsigned int i;
+
+
+    next_ = NONE;
+
+    for (i = 0; i < trackCount_; i++) {
+        if (tracks_[i].status && (next_ == NONE || tracks_[i].tick < tracks_[next_].tick)) {
+            next_ = i;
+        }
+    }
+
+    if (next_ == NONE) {
+        playing_ = false;
+        return;
+    }
+
+    /*
+     * Ticks are turned into microseconds a piece at a time, small enough
+     *  that the leftover fractions can't overflow
+     */
+    delta = tracks_[next_].tick - tick_;
+    time = time_;
+    fraction = fraction_;
+
+    while (delta) {
+        step = delta > 0xffff ? 0xffff : delta;
+
+        time += step * tickTime_;
+        fraction += step * tickRemainder_;
+        time += fraction / division_;
+        fraction %= division_;
+
+        delta -= step;
+    }
+
+    nextTime_ = time;
+    nextFraction_ = fraction;
+}
+
+
+void MidiFilePlayer::setTempo(unsigned long tempo)
+{
+    tempo_ = tempo;
+    tickTime_ = tempo / division_;
+    tickRemainder_ = tempo % division_;
+}
+
+
+void MidiFilePlayer::start(unsigned long now)
+{
+    unsigned int i;
+
+
+    /* Anything half sent gets cut off before the song starts again */
+    if (sysExTrack_ != NONE) {
+        sysExOpen_ = true;
+        sysExTrack_ = NONE;
+    }
+
+    for (i = 0; i < trackCount_; i++) {
+        MidiFileTrack &track = tracks_[i];
+
+        track.position = track.start;
+        track.available = 0;
+        track.tick = 0;
+        track.runningStatus = 0;
+        advance(track);
+    }
+
+    if (!smpte_) {
+        setTempo(DEFAULT_TEMPO);
+    }
+
+    tick_ = 0;
+    time_ = now;
+    fraction_ = 0;
+    playing_ = true;
+
+    findNext();
+}
+
+
+void MidiFilePlayer::stop()
+{
+    playing_ = false;
+}
+
+
+bool MidiFilePlayer::nextTime(unsigned long *time) const
+{
+    if (sysExTrack_ != NONE || (sysExOpen_ && !playing_)) {
+        *time = time_;
+        return true;
+    }
+
+    if (!playing_) {
+        return false;
+    }
+
+    *time = nextTime_;
+
+    return true;
+}
+
+
+// Fill in event as a piece of a system exclusive message
+static void sysExEvent(MidiFileEvent *event, const unsigned char *data,
+                       unsigned int length, unsigned int flags)
+{
+    event->message.status = STATUS_START_PROPRIETARY;
+    event->message.data1 = 0;
+    event->message.data2 = 0;
+    event->message.type = MidiMessage::SYSEX;
+    event->data = data;
+    event->length = length;
+    event->flags = flags;
+}
+
+
+// The next piece of the system exclusive event being sent; once it's all
+//  gone, the track moves on & this returns false (that can't happen any
+//  sooner, as the piece may be in the track's buffer)
+bool MidiFilePlayer::nextSysEx(MidiFileEvent *event)
+{
+    MidiFileTrack &track = tracks_[sysExTrack_];
+    const unsigned char *data;
+    unsigned int length;
+    unsigned int flags = sysExFirst_ ? MidiMessage::SYSEX_FIRST : 0;
+
+
+    if (!track.length && !sysExFirst_) {
+        sysExTrack_ = NONE;
+        advance(track);
+        findNext();
+        return false;
+    }
+
+    if (track.length && !track.available && !fill(track)) {
+        /* The file ends part way through */
+        track.status = 0;
+        sysExTrack_ = NONE;
+        sysExOpen_ = false;
+        findNext();
+        sysExEvent(event, 0, 0, flags | MidiMessage::SYSEX_ABORTED);
+        return true;
+    }
+
+    length = track.length < track.available ? track.length : track.available;
+    data = track.data;
+    track.data += length;
+    track.available -= length;
+    track.length -= length;
+    sysExFirst_ = false;
+
+    /* It's finished if it ends with 0xF7; otherwise more is to come later */
+    if (!track.length) {
+        if (length && data[length - 1] == STATUS_END_PROPRIETARY) {
+            length--;
+            flags |= MidiMessage::SYSEX_LAST;
+            sysExOpen_ = false;
+        } else {
+            sysExOpen_ = true;
+        }
+    }
+
+    sysExEvent(event, data, length, flags);
+
+    return true;
+}
+
+
+bool MidiFilePlayer::next(unsigned long now, MidiFileEvent *event)
+{
+    MidiFileTrack *track;
+    int tempo[3];
+
+
+    if (sysExTrack_ != NONE && nextSysEx(event)) {
+        return true;
+    }
+
+    while (playing_ && (long)(now - nextTime_) >= 0) {
+        track = &tracks_[next_];
+
+        /*
+         * A system exclusive message waiting for the rest of it is cut off
+         *  by anything but more of it (or a meta event, which isn't sent)
+         */
+        if (sysExOpen_ && track->status != STATUS_END_PROPRIETARY
+            && track->status != STATUS_RESET) {
+            sysExOpen_ = false;
+            sysExEvent(event, 0, 0, MidiMessage::SYSEX_ABORTED);
+            return true;
+        }
+
+        tick_ = track->tick;
+        time_ = nextTime_;
+        fraction_ = nextFraction_;
+
+        switch (track->status) {
+        case STATUS_RESET:
+            /* Meta event */
+            if (track->data1 == META_TEMPO && track->length == 3 && !smpte_) {
+                tempo[0] = readByte(*track);
+                tempo[1] = readByte(*track);
+                tempo[2] = readByte(*track);
+                if ((tempo[0] | tempo[1] | tempo[2]) >= 0) {
+                    setTempo(((unsigned long)tempo[0] << 16) | (tempo[1] << 8) | tempo[2]);
+                }
+            } else {
+                skip(*track, track->length);
+            }
+
+            if (track->data1 == META_END_OF_TRACK) {
+                track->status = 0;
+            } else {
+                advance(*track);
+            }
+            findNext();
+            break;
+
+        case STATUS_START_PROPRIETARY:
+        case STATUS_END_PROPRIETARY:
+            /* An 0xF7 event that doesn't carry on a message is an escape */
+            if (track->status == STATUS_END_PROPRIETARY && !sysExOpen_) {
+                skip(*track, track->length);
+                advance(*track);
+                findNext();
+                break;
+            }
+
+            sysExTrack_ = next_;
+            sysExFirst_ = (track->status == STATUS_START_PROPRIETARY);
+            if (nextSysEx(event)) {
+                return true;
+            }
+            break;
+
+        default:
+            event->message.status = track->status;
+            event->message.data1 = track->data1;
+            event->message.data2 = track->data2;
+            event->message.type = MidiParser::messageType(track->status, track->data2);
+#if MIDI_TIMESTAMPS
+            event->message.time = time_;
+#endif
+            advance(*track);
+            findNext();
+            return true;
+        }
+    }
+
+    /* Cut off a message that was waiting for more when the song stopped */
+    if (!playing_ && sysExOpen_) {
+        sysExOpen_ = false;
+        sysExEvent(event, 0, 0, MidiMessage::SYSEX_ABORTED);
+        return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,229 @@
+/*
+ *  MidiFilePlayer.h: Plays Standard MIDI Files, reading them a little at a
+ *                    time
+ *
+ *             (c) 2003-2011 Tymm Twillman <tymmothy@gmail.com>
+ *
+ *  This file is part of Tymm's Arduino Midi Library.
+ *
+ *  Tymm's Arduino Midi Library is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation, either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  Tymm's Arduino Midi Library is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Tymm's Arduino Midi Library.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef MIDIFILEPLAYER_H
+#define MIDIFILEPLAYER_H
+
+#include "MidiParser.h"
+
+
+// Called by a MidiFilePlayer to read from a file that isn't in memory (e.g.
+//  on an SD card): fill in up to size bytes at buffer from offset bytes into
+//  the file, and return how many there were (0 at the end of the file, or if
+//  it can't be read).  context is whatever was passed to open().
+typedef unsigned int (*MidiFileReader)(unsigned long offset, unsigned char *buffer,
+                                       unsigned int size, void *context);
+
+
+// Where a MidiFilePlayer is up to in one track of the file
+struct MidiFileTrack {
+    // Where the track's events start & end in the file, and where the next
+    //  bytes to go into the buffer come from
+    unsigned long start;
+    unsigned long end;
+    unsigned long position;
+
+    // Bytes read from the file but not used yet (pointing into the file
+    //  itself if it's in memory)
+    unsigned char *buffer;
+    const unsigned char *data;
+    unsigned int available;
+
+    // The track's next event: when it's due, in ticks from the start of the
+    //  song, its status (0 once the track has ended) & data bytes (the meta
+    //  event type for meta events), and for system exclusive & meta events,
+    //  the number of bytes of it still to be read
+    unsigned long tick;
+    unsigned long length;
+    unsigned char status;
+    unsigned char data1;
+    unsigned char data2;
+
+    unsigned char runningStatus;
+};
+
+
+// One thing for a MidiFilePlayer's user to send; message.type is
+//  MidiMessage::SYSEX for a piece of a system exclusive message, with the
+//  piece in data, length & flags (see Midi::sendSysExChunk())
+struct MidiFileEvent {
+    MidiMessage message;
+
+    const unsigned char *data;
+    unsigned int length;
+    unsigned int flags;
+};
+
+
+/*
+ * A MidiFilePlayer plays a Standard MIDI File (format 0 or 1) through a Midi
+ *  or StaticMidi instance, with the tracks merged together and the timing
+ *  following the file's tempo changes.  The file is never loaded whole:
+ *  each track is read a buffer full at a time as it's played, either
+ *  straight out of memory (flash, or a file mapped into memory on a host
+ *  machine) or through a MidiFileReader, so the RAM needed depends only on
+ *  the number of tracks and the size of the buffers, however big the file
+ *  is.
+ *
+ * Times are in microseconds (i.e. from micros()), and can wrap around.
+ *  service() should be called every time through loop(); it sends whatever
+ *  is due and never waits.  Finding the next event to go out looks at every
+ *  track, so it takes time in proportion to the number of tracks.
+ *
+ * Meta events other than tempo changes & the ends of tracks are skipped, as
+ *  are escaped (0xF7) events that aren't the continuation of a system
+ *  exclusive message.  A file with SMPTE timing plays at the frame rate
+ *  given, and ignores tempo changes.
+ */
+
+class MidiFilePlayer {
+public:
+    // No track
+    static const unsigned int NONE = 0xffff;
+
+    // Tempo until the file sets one: 120 quarter notes per minute
+    static const unsigned long DEFAULT_TEMPO = 500000UL;
+
+private:
+    MidiFileTrack *tracks_;
+    unsigned int maxTracks_;
+    unsigned int trackCount_;
+    unsigned int bufferSize_;
+
+    // Where the file is: in memory, or read through reader_
+    const unsigned char *memory_;
+    unsigned long memoryLength_;
+    MidiFileReader reader_;
+    void *context_;
+
+    unsigned int format_;
+
+    // Ticks per quarter note, and microseconds per quarter note (the
+    //  tempo), split into whole microseconds per tick & what's left over;
+    //  with SMPTE timing, the ticks & microseconds are per second instead
+    unsigned int division_;
+    unsigned long tempo_;
+    unsigned long tickTime_;
+    unsigned long tickRemainder_;
+    bool smpte_;
+
+    bool playing_;
+
+    // The song position (in ticks) & time of the last event played, and
+    //  the fraction of a microsecond (in 1/division_ units) left over
+    unsigned long tick_;
+    unsigned long time_;
+    unsigned long fraction_;
+
+    // The track with the next event to play, and when it's due
+    unsigned int next_;
+    unsigned long nextTime_;
+    unsigned long nextFraction_;
+
+    // The track whose system exclusive event is being sent (NONE if there
+    //  isn't one), whether the next piece is its first, and whether a system
+    //  exclusive message is still waiting for the rest of it to come in a
+    //  later (0xF7) event
+    unsigned int sysExTrack_;
+    bool sysExFirst_;
+    bool sysExOpen_;
+
+    bool readAt(unsigned long offset, unsigned char *buffer, unsigned int length);
+    bool fill(MidiFileTrack &track);
+    int readByte(MidiFileTrack &track);
+    bool readLength(MidiFileTrack &track, unsigned long *value);
+    void skip(MidiFileTrack &track, unsigned long length);
+    void advance(MidiFileTrack &track);
+    void findNext();
+    void setTempo(unsigned long tempo);
+    bool readHeader();
+    bool nextSysEx(MidiFileEvent *event);
+
+public:
+    // tracks has room for the most tracks a file can have; buffer (of
+    //  bufferSize bytes) is shared out between them for reading files that
+    //  aren't in memory.  32 bytes or so for each track is plenty.
+    MidiFilePlayer(MidiFileTrack *tracks, unsigned int maxTracks,
+                   unsigned char *buffer = 0, unsigned int bufferSize = 0);
+
+    // Open a file that's in memory, or one that's read through reader.
+    //  Returns false if it isn't a format 0 or 1 MIDI file, or has more
+    //  tracks than there's room for.
+    bool open(const unsigned char *data, unsigned long length);
+    bool open(MidiFileReader reader, void *context);
+
+    // Start playing from the beginning, with the first events due at now,
+    //  and stop playing.  If a system exclusive message is being sent when
+    //  playing stops, the rest of it is still sent (or it's cut off, if it
+    //  was waiting for more to come from the file).
+    void start(unsigned long now);
+    void stop();
+
+    // Whether the song is playing (it stops by itself at the end)
+    bool playing() const { return playing_; }
+
+    // Take the next thing that's due by now; returns false if nothing is
+    //  due.  The pieces of a system exclusive message come one after
+    //  another, whatever the time.
+    bool next(unsigned long now, MidiFileEvent *event);
+
+    // The time the next event is due (returns false if there isn't one)
+    bool nextTime(unsigned long *time) const;
+
+    // Send everything that's due by now through out (a Midi or StaticMidi
+    //  instance, or anything else with send(const MidiMessage &) and
+    //  sendSysExChunk()), or at most maxEvents of it if that's not 0.
+    //  Returns the number of events (and system exclusive pieces) sent.
+    template <class Output>
+    unsigned int service(Output &out, unsigned long now, unsigned int maxEvents = 0)
+    {
+        MidiFileEvent event;
+        unsigned int sent = 0;
+
+
+        while ((!maxEvents || sent < maxEvents) && next(now, &event)) {
+            if (event.message.type == MidiMessage::SYSEX) {
+                out.sendSysExChunk(event.data, event.length, event.flags);
+            } else {
+                out.send(event.message);
+            }
+            sent++;
+        }
+
+        return sent;
+    }
+
+    // The file's format (0 or 1), number of tracks & ticks per quarter note
+    //  (per second with SMPTE timing)
+    unsigned int format() const { return format_; }
+    unsigned int trackCount() const { return trackCount_; }
+    unsigned int division() const { return division_; }
+
+    // Microseconds per quarter note, and the position of the last event
+    //  played, in ticks from the start of the song
+    unsigned long tempo() const { return tempo_; }
+    unsigned long tick() const { return tick_; }
+};
+
+#endif /* #ifndef MIDIFILEPLAYER_H ... */
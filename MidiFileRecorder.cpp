@@ -0,0 +1,384 @@
+/*  MidiFileRecorder.cpp: Records what a Midi instance receives to a Standard MIDI File
+ *
+ *             (c) 2003-2011 Tymm Twillman <tymmothy@gmail.com>
+ *
+ *  This file is part of Tymm's Arduino Midi Library.
+ *
+ *  Tymm's Arduino Midi Library is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation, either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  Tymm's Arduino Midi Library is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Tymm's Arduino Midi Library.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+#include "MidiFileRecorder.h"
+
+
+// The header chunk, & the start of the track chunk up to its length
+static const unsigned char FILE_HEADER[] = {
+    'M', 'T', 'h', 'd', 0, 0, 0, 6,
+    0, 0,    // format 0
+    0, 1,    // one track
+    0, 0,    // division, filled in
+    'M', 'T', 'r', 'k'
+};
+
+// Where the track's length goes, and where the track starts
+static const unsigned long TRACK_LENGTH_OFFSET = 18;
+static const unsigned long TRACK_START = 22;
+
+// The track's first event: the tempo
+static const unsigned char TEMPO_EVENT[] = {
+    0, 0xff, 0x51, 3,
+    (MidiFileRecorder::TEMPO >> 16) & 0xff,
+    (MidiFileRecorder::TEMPO >> 8) & 0xff,
+    MidiFileRecorder::TEMPO & 0xff
+};
+
+static const unsigned char END_OF_TRACK[] = { 0xff, 0x2f, 0 };
+
+// Ends a system exclusive message that's been started in the file: an
+//  0xF7 event carrying on from it with just the 0xF7, at no extra time.
+//  Room for it is kept free while a message is open.
+static const unsigned char SYSEX_END[] = { 0, 0xf7, 1, 0xf7 };
+
+
+// Number of bytes a variable length number takes
+static inline unsigned int lengthSize(unsigned long value)
+{
+    unsigned int size = 1;
+
+
+    while (value >>= 7) {
+        size++;
+    }
+
+    return size;
+}
+
+
+MidiFileRecorder::MidiFileRecorder(unsigned char *buffer, unsigned int size,
+                                   unsigned int division)
+  : buffer_(buffer), mask_(size - 1), head_(0), tail_(0),
+    writer_(0), context_(0), clock_(0), division_(division),
+    recording_(false), failed_(false), written_(0), overflows_(0)
+{
+    setClock(0);
+}
+
+
+void MidiFileRecorder::setClock(MidiClock clock, unsigned long clockRate)
+{
+    clock_ = clock;
+    quarter_ = clockRate / 2;
+}
+
+
+// Put a variable length number (7 bits per byte, highest first, with the
+//  top bit set on all but the last byte) in the buffer
+unsigned int MidiFileRecorder::putLength(unsigned int head, unsigned long value)
+{
+    unsigned int shift = (lengthSize(value) - 1) * 7;
+
+
+    for (; shift; shift -= 7) {
+        head = put(head, 0x80 | ((value >> shift) & 0x7f));
+    }
+
+    return put(head, value & 0x7f);
+}
+
+
+// Add the time since the last message to the ticks waiting to be written.
+//  Each quarter note's worth of clock units is whole ticks; the rest is
+//  kept in fractions of a tick so that rounding doesn't add up over a long
+//  recording.
+void MidiFileRecorder::advanceTime(unsigned long now)
+{
+    unsigned long elapsed = now - lastTime_;
+
+
+    /* Ignore anything that seems to have come in before the last message */
+    if ((long)elapsed < 0) {
+        return;
+    }
+
+    lastTime_ = now;
+    fraction_ += (elapsed % quarter_) * division_;
+    delta_ += (elapsed / quarter_) * division_ + fraction_ / quarter_;
+    fraction_ %= quarter_;
+}
+
+
+bool MidiFileRecorder::start(MidiFileWriter writer, void *context)
+{
+    unsigned int head;
+    unsigned int i;
+
+
+    if (recording_ || !clock_ || !quarter_) {
+        return false;
+    }
+
+    writer_ = writer;
+    context_ = context;
+    failed_ = false;
+    written_ = 0;
+    overflows_ = 0;
+
+    lastTime_ = clock_();
+    delta_ = 0;
+    fraction_ = 0;
+    runningStatus_ = 0;
+    sysExOpen_ = false;
+
+    /* The headers go in the buffer like everything else; the track's
+     *  length is filled in by stop()
+     */
+    head_ = tail_ = head = 0;
+    for (i = 0; i < sizeof(FILE_HEADER); i++) {
+        head = put(head, FILE_HEADER[i]);
+    }
+    buffer_[12] = division_ >> 8;
+    buffer_[13] = division_;
+    for (i = 0; i < 4; i++) {
+        head = put(head, 0);
+    }
+    for (i = 0; i < sizeof(TEMPO_EVENT); i++) {
+        head = put(head, TEMPO_EVENT[i]);
+    }
+
+    MIDI_QUEUE_RELEASE();
+    head_ = head;
+    recording_ = true;
+
+    return true;
+}
+
+
+void MidiFileRecorder::midiReceived(const MidiMessage &message)
+{
+    unsigned int length;
+    unsigned int head;
+    bool running;
+
+
+    if (!recording_ || message.status >= 0xf0) {
+        return;
+    }
+
+#if MIDI_TIMESTAMPS
+    advanceTime(message.time);
+#else
+    advanceTime(clock_());
+#endif
+
+    running = (message.status == runningStatus_);
+    length = MidiParser::messageLength(message.status);
+
+    if (space() < lengthSize(delta_) + length - running
+                  + (sysExOpen_ ? sizeof(SYSEX_END) : 0)) {
+        overflows_++;
+        return;
+    }
+
+    head = putLength(head_, delta_);
+    if (!running) {
+        head = put(head, message.status);
+    }
+    head = put(head, message.data1);
+    if (length == 3) {
+        head = put(head, message.data2);
+    }
+
+    MIDI_QUEUE_RELEASE();
+    head_ = head;
+
+    delta_ = 0;
+    runningStatus_ = message.status;
+}
+
+
+// Pieces of a system exclusive message go in as an 0xF0 event followed by
+//  0xF7 events carrying on from it, with the 0xF7 at the end of the last
+void MidiFileRecorder::midiSysEx(const unsigned char *data, unsigned int length,
+                                 unsigned int flags)
+{
+    unsigned int total;
+    unsigned int head;
+    unsigned int i;
+    bool last = flags & (MidiMessage::SYSEX_LAST | MidiMessage::SYSEX_ABORTED);
+
+
+    /* Pieces of a message whose start didn't make it in are left out too */
+    if (!recording_ || (!(flags & MidiMessage::SYSEX_FIRST) && !sysExOpen_)) {
+        return;
+    }
+
+    /* Pieces don't come with a timestamp; reading the clock would put them
+     *  after messages still waiting in the queue, so they go in with the
+     *  message before them instead
+     */
+#if !MIDI_TIMESTAMPS
+    advanceTime(clock_());
+#endif
+
+    /* A piece that doesn't fit ends the message short, in the room kept
+     *  for that, so the file never has an 0xF0 without an 0xF7
+     */
+    total = length + last;
+    if (space() < lengthSize(delta_) + 1 + lengthSize(total) + total
+                  + (last ? 0 : sizeof(SYSEX_END))) {
+        overflows_++;
+        if (sysExOpen_) {
+            endSysEx();
+        }
+        return;
+    }
+
+    head = putLength(head_, delta_);
+    head = put(head, (flags & MidiMessage::SYSEX_FIRST) ? STATUS_START_PROPRIETARY
+                                                        : STATUS_END_PROPRIETARY);
+    head = putLength(head, total);
+    for (i = 0; i < length; i++) {
+        head = put(head, data[i]);
+    }
+    if (last) {
+        head = put(head, STATUS_END_PROPRIETARY);
+    }
+
+    MIDI_QUEUE_RELEASE();
+    head_ = head;
+
+    delta_ = 0;
+    runningStatus_ = 0;
+    sysExOpen_ = !last;
+}
+
+
+void MidiFileRecorder::endSysEx()
+{
+    unsigned int head = head_;
+    unsigned int i;
+
+
+    for (i = 0; i < sizeof(SYSEX_END); i++) {
+        head = put(head, SYSEX_END[i]);
+    }
+
+    MIDI_QUEUE_RELEASE();
+    head_ = head;
+
+    runningStatus_ = 0;
+    sysExOpen_ = false;
+}
+
+
+// Write length bytes from the buffer to the file, in at most two pieces
+//  (if they wrap around the end of the buffer)
+bool MidiFileRecorder::writeOut(unsigned int length)
+{
+    unsigned int tail = tail_;
+    unsigned int start;
+    unsigned int size;
+
+
+    MIDI_QUEUE_ACQUIRE();
+
+    while (length && !failed_) {
+        start = tail & mask_;
+        size = mask_ + 1 - start;
+        if (size > length) {
+            size = length;
+        }
+
+        if (writer_(written_, buffer_ + start, size, context_) != size) {
+            failed_ = true;
+            recording_ = false;
+            break;
+        }
+
+        written_ += size;
+        tail += size;
+        length -= size;
+
+        MIDI_QUEUE_RELEASE();
+        tail_ = tail;
+    }
+
+    return !failed_;
+}
+
+
+unsigned int MidiFileRecorder::service()
+{
+    unsigned int half = (mask_ + 1) / 2;
+    unsigned int done = 0;
+
+
+    while (buffered() >= half && writeOut(half)) {
+        done += half;
+    }
+
+    return done;
+}
+
+
+bool MidiFileRecorder::flush()
+{
+    return writeOut(buffered());
+}
+
+
+bool MidiFileRecorder::stop()
+{
+    unsigned char length[4];
+    unsigned long trackLength;
+    unsigned int head;
+    unsigned int i;
+
+
+    if (!recording_) {
+        return false;
+    }
+
+    /* Once the listener can't add anything more, the buffer's all ours */
+    recording_ = false;
+    if (!flush()) {
+        return false;
+    }
+
+    if (sysExOpen_) {
+        endSysEx();
+    }
+    head = putLength(head_, delta_);
+    for (i = 0; i < sizeof(END_OF_TRACK); i++) {
+        head = put(head, END_OF_TRACK[i]);
+    }
+    head_ = head;
+
+    if (!flush()) {
+        return false;
+    }
+
+    trackLength = written_ - TRACK_START;
+    length[0] = trackLength >> 24;
+    length[1] = trackLength >> 16;
+    length[2] = trackLength >> 8;
+    length[3] = trackLength;
+
+    if (writer_(TRACK_LENGTH_OFFSET, length, 4, context_) != 4) {
+        failed_ = true;
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,169 @@
+/*
+ *  MidiFileRecorder.h: Records what a Midi instance receives to a Standard
+ *                      MIDI File
+ *
+ *             (c) 2003-2011 Tymm Twillman <tymmothy@gmail.com>
+ *
+ *  This file is part of Tymm's Arduino Midi Library.
+ *
+ *  Tymm's Arduino Midi Library is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation, either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  Tymm's Arduino Midi Library is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Tymm's Arduino Midi Library.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef MIDIFILERECORDER_H
+#define MIDIFILERECORDER_H
+
+#include "MidiListener.h"
+#include "MidiQueue.h"
+#include "MidiTiming.h"
+
+
+// Called by a MidiFileRecorder to write to the file: write length bytes of
+//  data at offset bytes into the file, and return how many were written.
+//  Offsets only ever go up, apart from once when recording stops, to fill
+//  in the length of the track near the start of the file.  context is
+//  whatever was passed to start().
+typedef unsigned int (*MidiFileWriter)(unsigned long offset, const unsigned char *data,
+                                       unsigned int length, void *context);
+
+
+/*
+ * A MidiFileRecorder is a MidiListener that writes the messages a Midi
+ *  instance receives to a Standard MIDI File (format 0), as they come in:
+ *
+ *   recorder.setClock(micros);
+ *   midi.addListener(&recorder);
+ *   recorder.start(writeSong, &file);
+ *
+ * Nothing is written to the file from the listener itself (so poll() is
+ *  never held up by a slow card): messages are put in a buffer given by
+ *  the user, and service() writes the buffer out half of it at a time,
+ *  which suits cards that like to be written in blocks.  A message that
+ *  doesn't fit in the buffer is thrown away (and counted); the time it
+ *  would have taken goes to the next one.
+ *
+ * Messages are written with running status, at 120 quarter notes per
+ *  minute, with division ticks per quarter note.  System exclusive
+ *  messages are written a piece at a time as they come in (so a message
+ *  bigger than the Midi instance's SysEx buffer goes into the file in more
+ *  than one event).  System common & real time messages aren't recorded.
+ *
+ * The buffer's size must be a power of 2.  Like a MidiQueue, the buffer can
+ *  be filled from poll() in a thread or interrupt while service() is called
+ *  from loop(), except on AVR, where the buffer indexes can't be read in
+ *  one go & both need to be called from the same place.
+ */
+
+class MidiFileRecorder : public MidiListener {
+public:
+    // The tempo written to the file: 120 quarter notes per minute
+    static const unsigned long TEMPO = 500000UL;
+
+private:
+    // The buffer, & free-running counts of the bytes put in & written out
+    unsigned char *buffer_;
+    unsigned int mask_;
+    volatile unsigned int head_;
+    volatile unsigned int tail_;
+
+    MidiFileWriter writer_;
+    void *context_;
+
+    MidiClock clock_;
+    unsigned long quarter_;
+    unsigned int division_;
+
+    volatile bool recording_;
+    bool failed_;
+
+    // When the last message came in, the ticks since the last one written,
+    //  and the part of a tick left over (in 1/quarter_ ticks)
+    unsigned long lastTime_;
+    unsigned long delta_;
+    unsigned long fraction_;
+
+    unsigned char runningStatus_;
+
+    // Whether a system exclusive message has been started in the file and
+    //  is waiting for the rest of it (while it is, room to end it is kept
+    //  free in the buffer)
+    bool sysExOpen_;
+
+    // Bytes written to the file so far, & messages that didn't fit
+    unsigned long written_;
+    unsigned long overflows_;
+
+    unsigned int space() const { return mask_ + 1 - (head_ - tail_); }
+    unsigned int put(unsigned int head, unsigned char value)
+    {
+        buffer_[head & mask_] = value;
+        return head + 1;
+    }
+    unsigned int putLength(unsigned int head, unsigned long value);
+
+    void advanceTime(unsigned long now);
+
+    // End the open system exclusive message where it is
+    void endSysEx();
+    bool writeOut(unsigned int length);
+
+public:
+    // buffer holds size bytes (a power of 2, at least 32) of messages
+    //  waiting to be written; it needs to be bigger than the biggest piece
+    //  of system exclusive data the Midi instance hands over.  The file has
+    //  division ticks per quarter note (at most 8000; 480 makes each tick a
+    //  little over a millisecond).
+    MidiFileRecorder(unsigned char *buffer, unsigned int size, unsigned int division = 480);
+
+    // The clock message arrival times come from, and how many of its units
+    //  there are per second (1000000 for micros()).  With MIDI_TIMESTAMPS
+    //  turned on, messages are timed with their timestamps instead, so this
+    //  needs to be the same clock the Midi instance was given; system
+    //  exclusive data has no timestamp, so it's only approximately timed,
+    //  at the time of the message before it.
+    void setClock(MidiClock clock, unsigned long clockRate = 1000000UL);
+
+    // Start a new file, written through writer, with times counted from
+    //  now.  Returns false if already recording, or there's no clock.
+    bool start(MidiFileWriter writer, void *context);
+
+    // Write out whatever is buffered, end the track, and fill in its
+    //  length.  This waits for all the writing to be done.  Returns false
+    //  if anything couldn't be written.
+    bool stop();
+
+    // Write the buffer to the file whenever half of it is full; call this
+    //  every time through loop().  Returns the number of bytes written.
+    unsigned int service();
+
+    // Write out everything that's buffered, full or not
+    bool flush();
+
+    // Whether recording is going on, and whether it stopped because a
+    //  write failed
+    bool recording() const { return recording_; }
+    bool failed() const { return failed_; }
+
+    // Bytes written to the file so far, bytes waiting in the buffer, and
+    //  messages thrown away because the buffer was full
+    unsigned long length() const { return written_; }
+    unsigned int buffered() const { return head_ - tail_; }
+    unsigned long overflows() const { return overflows_; }
+
+    virtual void midiReceived(const MidiMessage &message);
+    virtual void midiSysEx(const unsigned char *data, unsigned int length, unsigned int flags);
+};
+
+#endif /* #ifndef MIDIFILERECORDER_H ... */
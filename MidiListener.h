@@ -0,0 +1,59 @@
+/*
+ *  MidiListener.h: Interface for things that want to see every message a
+ *                  Midi instance receives and/or sends
+ *
+ *             (c) 2003-2011 Tymm Twillman <tymmothy@gmail.com>
+ *
+ *  This file is part of Tymm's Arduino Midi Library.
+ *
+ *  Tymm's Arduino Midi Library is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation, either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  Tymm's Arduino Midi Library is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Tymm's Arduino Midi Library.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MIDILISTENER_H
+#define MIDILISTENER_H
+
+#include "MidiParser.h"
+
+
+/*
+ * Helpers that keep track of what's going on (which notes are held etc.)
+ *  are MidiListeners; once added to a Midi instance with
+ *  Midi::addListener(), they get to see each message just before its handle
+ *  function is called, and each message that's sent.  System exclusive
+ *  data that's received goes to midiSysEx() instead (with the same
+ *  arguments as Midi::handleSysEx()); system exclusive data that's sent
+ *  isn't passed along.
+ *
+ * Listeners are kept in a list linked through the listeners themselves, so
+ *  adding them doesn't need any memory, and a Midi instance with no
+ *  listeners pays for one pointer check per message.
+ */
+
+class MidiListener {
+private:
+    friend class Midi;
+
+    MidiListener *nextListener_;
+
+public:
+    MidiListener() : nextListener_(0) {}
+    virtual ~MidiListener() {}
+
+    virtual void midiReceived(const MidiMessage &message) {}
+    virtual void midiSent(const MidiMessage &message) {}
+    virtual void midiSysEx(const unsigned char *data, unsigned int length, unsigned int flags) {}
+};
+
+#endif /* #ifndef MIDILISTENER_H ... */
@@ -0,0 +1,454 @@
+/*  MidiMpe.cpp: MPE zones, voice allocation & per-note expression
+ *
+ *             (c) 2003-2011 Tymm Twillman <tymmothy@gmail.com>
+ *
+ *  This file is part of Tymm's Arduino Midi Library.
+ *
+ *  Tymm's Arduino Midi Library is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation, either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  Tymm's Arduino Midi Library is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Tymm's Arduino Midi Library.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+#include "MidiMpe.h"
+
+
+// Controllers the receiver pays attention to (besides the RPN ones)
+static const unsigned char CONTROLLER_DATA_ENTRY     = 6;
+static const unsigned char CONTROLLER_TIMBRE         = 74;
+static const unsigned char CONTROLLER_NRPN_LSB       = 98;
+static const unsigned char CONTROLLER_NRPN_MSB       = 99;
+static const unsigned char CONTROLLER_RPN_LSB        = 100;
+static const unsigned char CONTROLLER_RPN_MSB        = 101;
+static const unsigned char CONTROLLER_SOUND_OFF      = 120;
+static const unsigned char CONTROLLER_NOTES_OFF      = 123;
+
+// Pitch bend ranges a zone starts out with
+static const unsigned char MEMBER_BEND_RANGE = 48;
+static const unsigned char MASTER_BEND_RANGE = 2;
+
+
+/*****************************************************************************
+ *
+ * Sending
+ *
+ *****************************************************************************/
+
+
+MidiMpeSender::MidiMpeSender()
+{
+    layout_.members[MIDI_MPE_LOWER] = 0;
+    layout_.members[MIDI_MPE_UPPER] = 0;
+
+    reset();
+}
+
+
+void MidiMpeSender::reset()
+{
+    for (unsigned int c = 0; c < 16; c++) {
+        note_[c] = NONE;
+        bend_[c] = 0xffff;
+        pressure_[c] = 0xff;
+        timbre_[c] = 0xff;
+    }
+
+    rebuild();
+}
+
+
+void MidiMpeSender::append(unsigned int list, unsigned int channel)
+{
+    next_[channel] = NONE;
+    prev_[channel] = tail_[list];
+
+    if (tail_[list] == NONE) {
+        head_[list] = channel;
+    } else {
+        next_[tail_[list]] = channel;
+    }
+    tail_[list] = channel;
+}
+
+
+void MidiMpeSender::unlink(unsigned int list, unsigned int channel)
+{
+    if (prev_[channel] == NONE) {
+        head_[list] = next_[channel];
+    } else {
+        next_[prev_[channel]] = next_[channel];
+    }
+
+    if (next_[channel] == NONE) {
+        tail_[list] = prev_[channel];
+    } else {
+        prev_[next_[channel]] = prev_[channel];
+    }
+}
+
+
+// Put every member channel on its zone's free list, in the order they
+//  should be used (outwards from the master channel), with no notes on
+void MidiMpeSender::rebuild()
+{
+    unsigned int i;
+
+
+    for (i = 0; i < 4; i++) {
+        head_[i] = tail_[i] = NONE;
+    }
+
+    for (i = 0; i < layout_.members[MIDI_MPE_LOWER]; i++) {
+        append(MIDI_MPE_LOWER * 2, 1 + i);
+    }
+    for (i = 0; i < layout_.members[MIDI_MPE_UPPER]; i++) {
+        append(MIDI_MPE_UPPER * 2, 14 - i);
+    }
+}
+
+
+unsigned int MidiMpeSender::take(unsigned int zone)
+{
+    unsigned int list = zone * 2;
+    unsigned int channel = head_[list];
+
+
+    /* Nothing free means taking over the oldest busy one */
+    if (channel == NONE) {
+        list++;
+        channel = head_[list];
+        if (channel == NONE) {
+            return NONE;
+        }
+    }
+
+    unlink(list, channel);
+    append(zone * 2 + 1, channel);
+
+    return channel;
+}
+
+
+void MidiMpeSender::release(unsigned int channel)
+{
+    int zone = layout_.zone(channel);
+
+
+    channel = (channel - 1) & 0x0f;
+    if (zone < 0) {
+        return;
+    }
+
+    unlink(zone * 2 + 1, channel);
+    append(zone * 2, channel);
+}
+
+
+/*****************************************************************************
+ *
+ * Receiving
+ *
+ *****************************************************************************/
+
+
+MidiMpeReceiver::MidiMpeReceiver(MidiMpeNote *storage, unsigned int count)
+  : notes_(storage), count_(count < NONE ? count : NONE - 1)
+{
+    layout_.members[MIDI_MPE_LOWER] = 0;
+    layout_.members[MIDI_MPE_UPPER] = 0;
+
+    for (unsigned int c = 0; c < 16; c++) {
+        channels_[c].bendRange = MASTER_BEND_RANGE;
+    }
+
+    reset();
+}
+
+
+void MidiMpeReceiver::reset()
+{
+    for (unsigned int c = 0; c < 16; c++) {
+        Channel &ch = channels_[c];
+
+
+        ch.bend = 8192;
+        ch.pressure = 0;
+        ch.timbre = 64;
+        ch.first = NONE;
+        ch.rpnMsb = ch.rpnLsb = 0x7f;
+    }
+
+    /* All the notes go on the free list */
+    free_ = count_ ? 0 : NONE;
+    for (unsigned int i = 0; i < count_; i++) {
+        notes_[i].next = i + 1 < count_ ? i + 1 : NONE;
+    }
+    active_ = 0;
+}
+
+
+void MidiMpeReceiver::noteOn(unsigned int channel, unsigned int note, unsigned int velocity)
+{
+    Channel &ch = channels_[channel];
+    unsigned int i = free_;
+    MidiMpeNote *n;
+
+
+    if (i == NONE) {
+        return;
+    }
+
+    /* Expression sent on the channel before the note applies to it */
+    n = &notes_[i];
+    free_ = n->next;
+    n->channel = channel + 1;
+    n->note = note;
+    n->velocity = velocity;
+    n->bend = ch.bend;
+    n->pressure = ch.pressure;
+    n->timbre = ch.timbre;
+    n->next = ch.first;
+    ch.first = i;
+    active_++;
+
+    handleNoteStart(*n);
+}
+
+
+void MidiMpeReceiver::noteOff(unsigned int channel, unsigned int note, unsigned int velocity)
+{
+    unsigned char *link = &channels_[channel].first;
+    MidiMpeNote *n;
+
+
+    while (*link != NONE) {
+        n = &notes_[*link];
+        if (n->note == note) {
+            unsigned int i = *link;
+
+
+            *link = n->next;
+            n->velocity = velocity;
+            handleNoteEnd(*n);
+
+            n->next = free_;
+            free_ = i;
+            active_--;
+            return;
+        }
+        link = &n->next;
+    }
+}
+
+
+void MidiMpeReceiver::allNotesOff(unsigned int channel)
+{
+    Channel &ch = channels_[channel];
+
+
+    while (ch.first != NONE) {
+        noteOff(channel, notes_[ch.first].note, 0);
+    }
+}
+
+
+// Copy a channel's expression to the notes on it
+void MidiMpeReceiver::expression(unsigned int channel, unsigned int changed)
+{
+    Channel &ch = channels_[channel];
+    int zone = layout_.zone(channel + 1);
+
+
+    for (unsigned int i = ch.first; i != NONE; i = notes_[i].next) {
+        MidiMpeNote &n = notes_[i];
+
+
+        n.bend = ch.bend;
+        n.pressure = ch.pressure;
+        n.timbre = ch.timbre;
+        handleNoteChange(n, changed);
+    }
+
+    if (zone >= 0 && channel + 1 == MidiMpeLayout::master(zone)) {
+        handleMasterChange(zone, changed);
+    }
+}
+
+
+void MidiMpeReceiver::setZone(unsigned int zone, unsigned int members)
+{
+    unsigned int before = layout_.members[zone ^ 1];
+
+
+    layout_.set(zone, members);
+
+    /* Both zones start out with the default bend ranges */
+    for (unsigned int c = 1; c <= 16; c++) {
+        if (layout_.zone(c) >= 0) {
+            channels_[c - 1].bendRange = c == MidiMpeLayout::master(layout_.zone(c))
+                                         ? MASTER_BEND_RANGE : MEMBER_BEND_RANGE;
+        }
+    }
+
+    handleZoneChange(zone, layout_.members[zone]);
+    if (layout_.members[zone ^ 1] != before) {
+        handleZoneChange(zone ^ 1, layout_.members[zone ^ 1]);
+    }
+}
+
+
+// Data entry MSB for whichever RPN is picked on channel
+void MidiMpeReceiver::dataEntry(unsigned int channel, unsigned int value)
+{
+    Channel &ch = channels_[channel];
+    unsigned int parameter = (ch.rpnMsb << 7) | ch.rpnLsb;
+    int zone = layout_.zone(channel + 1);
+
+
+    switch (parameter) {
+        case MidiMpeSender::RPN_MPE_CONFIG:
+            if (channel == 0) {
+                setZone(MIDI_MPE_LOWER, value);
+            } else if (channel == 15) {
+                setZone(MIDI_MPE_UPPER, value);
+            }
+            break;
+
+        case MidiMpeSender::RPN_BEND_RANGE:
+            /* On any member channel, it's for all of them */
+            if (zone >= 0 && channel + 1 != MidiMpeLayout::master(zone)) {
+                for (unsigned int c = 1; c <= 16; c++) {
+                    if (layout_.zone(c) == zone && c != MidiMpeLayout::master(zone)) {
+                        channels_[c - 1].bendRange = value;
+                    }
+                }
+            } else {
+                ch.bendRange = value;
+            }
+            break;
+    }
+}
+
+
+void MidiMpeReceiver::process(const MidiMessage &message)
+{
+    unsigned int channel = message.status & 0x0f;
+    Channel &ch = channels_[channel];
+    int zone;
+
+
+    switch (message.type) {
+        case MidiMessage::NOTE_ON:
+            noteOn(channel, message.data1, message.data2);
+            break;
+
+        case MidiMessage::NOTE_OFF:
+            noteOff(channel, message.data1, message.data2);
+            break;
+
+        case MidiMessage::PITCH_CHANGE:
+            ch.bend = (message.data2 << 7) | message.data1;
+            expression(channel, PITCH);
+            break;
+
+        case MidiMessage::AFTER_TOUCH:
+            ch.pressure = message.data1;
+            expression(channel, PRESSURE);
+            break;
+
+        case MidiMessage::CONTROL_CHANGE:
+            switch (message.data1) {
+                case CONTROLLER_TIMBRE:
+                    ch.timbre = message.data2;
+                    expression(channel, TIMBRE);
+                    break;
+
+                case CONTROLLER_RPN_MSB:
+                    ch.rpnMsb = message.data2;
+                    break;
+
+                case CONTROLLER_RPN_LSB:
+                    ch.rpnLsb = message.data2;
+                    break;
+
+                /* Data entry is for an NRPN now, which isn't ours */
+                case CONTROLLER_NRPN_MSB:
+                case CONTROLLER_NRPN_LSB:
+                    ch.rpnMsb = ch.rpnLsb = 0x7f;
+                    break;
+
+                case CONTROLLER_DATA_ENTRY:
+                    dataEntry(channel, message.data2);
+                    break;
+
+                /* On a master channel, these are for the whole zone */
+                case CONTROLLER_SOUND_OFF:
+                case CONTROLLER_NOTES_OFF:
+                    zone = layout_.zone(channel + 1);
+                    if (zone >= 0 && channel + 1 == MidiMpeLayout::master(zone)) {
+                        for (unsigned int c = 1; c <= 16; c++) {
+                            if (layout_.zone(c) == zone) {
+                                allNotesOff(c - 1);
+                            }
+                        }
+                    } else {
+                        allNotesOff(channel);
+                    }
+                    break;
+            }
+            break;
+
+        case MidiMessage::RESET:
+            reset();
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+long MidiMpeReceiver::pitch(const MidiMpeNote &note) const
+{
+    unsigned int channel = note.channel;
+    int zone = layout_.zone(channel);
+    const Channel &ch = channels_[(channel - 1) & 0x0f];
+    long pitch = (long)note.note << 8;
+
+
+    /* A full bend (8192) is bendRange semitones, or bendRange * 256 */
+    pitch += ((long)note.bend - 8192) * ch.bendRange / 32;
+
+    if (zone >= 0 && channel != MidiMpeLayout::master(zone)) {
+        const Channel &master = channels_[MidiMpeLayout::master(zone) - 1];
+
+
+        pitch += ((long)master.bend - 8192) * master.bendRange / 32;
+    }
+
+    return pitch;
+}
+
+
+const MidiMpeNote *MidiMpeReceiver::find(unsigned int channel, unsigned int note) const
+{
+    unsigned int i = channels_[(channel - 1) & 0x0f].first;
+
+
+    for (; i != NONE; i = notes_[i].next) {
+        if (notes_[i].note == note) {
+            return &notes_[i];
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,405 @@
+/*
+ *  MidiMpe.h: MPE zones, voice allocation & per-note expression
+ *
+ *             (c) 2003-2011 Tymm Twillman <tymmothy@gmail.com>
+ *
+ *  This file is part of Tymm's Arduino Midi Library.
+ *
+ *  Tymm's Arduino Midi Library is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation, either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  Tymm's Arduino Midi Library is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Tymm's Arduino Midi Library.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#ifndef MIDIMPE_H
+#define MIDIMPE_H
+
+#include "MidiListener.h"
+
+
+/*
+ * MPE (MIDI Polyphonic Expression) gives each sounding note a channel of
+ *  its own, so that pitch bend, channel pressure and timbre (controller 74)
+ *  on that channel bend, press & shape just that note.  The channels are
+ *  split into up to two zones: the lower zone has channel 1 as its master
+ *  channel and channels 2, 3, ... as its member channels (the ones notes
+ *  go on), and the upper zone has channel 16 as its master and 15, 14, ...
+ *  as members.  Messages on a master channel apply to the whole zone.
+ *
+ * A zone is set up by sending registered parameter (RPN) 6 on its master
+ *  channel, with the number of member channels (0 turns it off) as the
+ *  data entry MSB.  Pitch bend range (RPN 0) sent on any member channel
+ *  applies to all of the zone's members; it starts out as 48 semitones for
+ *  members and 2 for the master.
+ */
+
+static const unsigned int MIDI_MPE_LOWER = 0;
+static const unsigned int MIDI_MPE_UPPER = 1;
+
+
+// Which channels belong to which zone
+struct MidiMpeLayout {
+    // Number of member channels in the lower & upper zones (0 if the zone
+    //  isn't in use)
+    unsigned char members[2];
+
+    // Set the number of member channels for a zone (0-15); the other zone
+    //  shrinks (or goes away) if the two would overlap
+    void set(unsigned int zone, unsigned int count)
+    {
+        unsigned int other = zone ^ 1;
+
+
+        if (count > 15) {
+            count = 15;
+        }
+        members[zone] = count;
+        if (count && members[other] + count > 14) {
+            members[other] = count < 14 ? 14 - count : 0;
+        }
+    }
+
+    // The zone a channel (1-16) is in, as master or member, or -1 if none
+    int zone(unsigned int channel) const
+    {
+        channel = (channel - 1) & 0x0f;
+        if (members[MIDI_MPE_LOWER] && channel <= members[MIDI_MPE_LOWER]) {
+            return MIDI_MPE_LOWER;
+        }
+        if (members[MIDI_MPE_UPPER] && channel >= 15U - members[MIDI_MPE_UPPER]) {
+            return MIDI_MPE_UPPER;
+        }
+        return -1;
+    }
+
+    // Master channel, and the member channel notes go on first
+    static unsigned int master(unsigned int zone) { return zone ? 16 : 1; }
+    static unsigned int firstMember(unsigned int zone) { return zone ? 15 : 2; }
+};
+
+
+/*
+ * A MidiMpeSender sets up zones at the other end and picks member channels
+ *  for the notes it sends.  Free channels are handed out in the order they
+ *  were let go of (so a note's release tail isn't cut short by the next
+ *  note on the same channel), and when none are free the oldest note is
+ *  turned off & its channel used again.  Both are kept as linked lists
+ *  through the channel numbers, so picking a channel never has to look
+ *  through the others.
+ *
+ * noteOn() returns the channel (1-16) the note went on; send expression
+ *  for it with sendPitchBend() etc. & turn it off with noteOff(), giving
+ *  the channel back.  The expression functions leave out values that are
+ *  the same as the last ones sent on that channel.  out is a Midi or
+ *  StaticMidi instance.
+ */
+
+class MidiMpeSender {
+private:
+    static const unsigned char NONE = 0xff;
+
+    MidiMpeLayout layout_;
+
+    // Free & busy lists for each zone (list number zone * 2 + busy), and
+    //  the links for each channel
+    unsigned char head_[4];
+    unsigned char tail_[4];
+    unsigned char next_[16];
+    unsigned char prev_[16];
+
+    // The note sounding on each channel (NONE if none), and the last
+    //  expression sent on it (0xffff / 0xff if nothing yet)
+    unsigned char note_[16];
+    unsigned int bend_[16];
+    unsigned char pressure_[16];
+    unsigned char timbre_[16];
+
+    void append(unsigned int list, unsigned int channel);
+    void unlink(unsigned int list, unsigned int channel);
+    void rebuild();
+
+    // Move the next channel for a zone to the end of its busy list & return
+    //  it (0-15), or NONE if the zone has no members
+    unsigned int take(unsigned int zone);
+
+    // Move a busy channel (1-16) to the end of its zone's free list
+    void release(unsigned int channel);
+
+    template <class Output>
+    void sendParameter(Output &out, unsigned int channel, unsigned int parameter,
+                       unsigned int value)
+    {
+        out.sendControlChange(channel, RPN_MSB, parameter >> 7);
+        out.sendControlChange(channel, RPN_LSB, parameter & 0x7f);
+        out.sendControlChange(channel, DATA_ENTRY, value);
+        out.sendControlChange(channel, DATA_ENTRY + 32, 0);
+        out.sendControlChange(channel, RPN_MSB, 0x7f);
+        out.sendControlChange(channel, RPN_LSB, 0x7f);
+    }
+
+public:
+    static const unsigned int DATA_ENTRY  = 6;
+    static const unsigned int TIMBRE      = 74;
+    static const unsigned int RPN_LSB     = 100;
+    static const unsigned int RPN_MSB     = 101;
+
+    // Registered parameters for pitch bend range & zone setup
+    static const unsigned int RPN_BEND_RANGE = 0;
+    static const unsigned int RPN_MPE_CONFIG = 6;
+
+    MidiMpeSender();
+
+    const MidiMpeLayout &layout() const { return layout_; }
+
+    // Set up a zone with members member channels (0 turns it off) and a
+    //  member pitch bend range in semitones, turning off every note first.
+    //  The zones here follow along (including the other zone shrinking).
+    template <class Output>
+    void configure(Output &out, unsigned int zone, unsigned int members,
+                   unsigned int bendRange = 48)
+    {
+        zone &= 1;
+        for (unsigned int c = 0; c < 16; c++) {
+            if (note_[c] != NONE) {
+                out.sendNoteOff(c + 1, note_[c], 0);
+                note_[c] = NONE;
+            }
+        }
+
+        layout_.set(zone, members);
+        sendParameter(out, MidiMpeLayout::master(zone), RPN_MPE_CONFIG, layout_.members[zone]);
+        if (layout_.members[zone] && bendRange != 48) {
+            sendParameter(out, MidiMpeLayout::firstMember(zone), RPN_BEND_RANGE, bendRange & 0x7f);
+        }
+
+        rebuild();
+    }
+
+    // Pick a channel in zone, turning off the note on it if they're all
+    //  busy, and send a NOTE ON there (after the starting expression, if
+    //  it's different from what the channel had).  Returns the channel, or
+    //  0 if the zone has no members.
+    template <class Output>
+    unsigned int noteOn(Output &out, unsigned int zone, unsigned int note, unsigned int velocity,
+                        unsigned int bend = 8192, unsigned int pressure = 0, unsigned int timbre = 64)
+    {
+        unsigned int channel = take(zone & 1);
+
+
+        if (channel == NONE) {
+            return 0;
+        }
+
+        if (note_[channel] != NONE) {
+            out.sendNoteOff(channel + 1, note_[channel], 0);
+        }
+        note_[channel] = note & 0x7f;
+
+        sendPitchBend(out, channel + 1, bend);
+        sendPressure(out, channel + 1, pressure);
+        sendTimbre(out, channel + 1, timbre);
+        out.sendNoteOn(channel + 1, note, velocity);
+
+        return channel + 1;
+    }
+
+    // Turn off the note on channel, if it's still that note (it might have
+    //  been taken over by a newer one).  Returns whether it was.
+    template <class Output>
+    bool noteOff(Output &out, unsigned int channel, unsigned int note, unsigned int velocity = 0)
+    {
+        channel = (channel - 1) & 0x0f;
+        if (note_[channel] != (note & 0x7f)) {
+            return false;
+        }
+
+        out.sendNoteOff(channel + 1, note, velocity);
+        note_[channel] = NONE;
+        release(channel + 1);
+
+        return true;
+    }
+
+    // Per-note expression for the note on channel; each returns whether it
+    //  was sent
+    template <class Output>
+    bool sendPitchBend(Output &out, unsigned int channel, unsigned int bend)
+    {
+        unsigned int c = (channel - 1) & 0x0f;
+
+
+        bend &= 0x3fff;
+        if (bend_[c] == bend) {
+            return false;
+        }
+        bend_[c] = bend;
+        out.sendPitchBend(channel, bend);
+
+        return true;
+    }
+
+    template <class Output>
+    bool sendPressure(Output &out, unsigned int channel, unsigned int pressure)
+    {
+        unsigned int c = (channel - 1) & 0x0f;
+
+
+        pressure &= 0x7f;
+        if (pressure_[c] == pressure) {
+            return false;
+        }
+        pressure_[c] = pressure;
+        out.sendAfterTouch(channel, pressure);
+
+        return true;
+    }
+
+    template <class Output>
+    bool sendTimbre(Output &out, unsigned int channel, unsigned int timbre)
+    {
+        unsigned int c = (channel - 1) & 0x0f;
+
+
+        timbre &= 0x7f;
+        if (timbre_[c] == timbre) {
+            return false;
+        }
+        timbre_[c] = timbre;
+        out.sendControlChange(channel, TIMBRE, timbre);
+
+        return true;
+    }
+
+    // The note sounding on a channel (1-16), or -1 if none
+    int note(unsigned int channel) const
+    {
+        unsigned char n = note_[(channel - 1) & 0x0f];
+
+
+        return n == NONE ? -1 : n;
+    }
+
+    // Forget all notes & the expression sent, keeping the zones
+    void reset();
+};
+
+
+// One note being received, with its channel's expression (see
+//  MidiMpeReceiver)
+struct MidiMpeNote {
+    unsigned char channel;      // 1-16
+    unsigned char note;
+    unsigned char velocity;     // NOTE ON velocity (NOTE OFF's at the end)
+    unsigned char pressure;
+    unsigned char timbre;
+    unsigned int bend;          // 14-bit, 8192 in the middle
+
+    unsigned char next;         // used by MidiMpeReceiver
+};
+
+
+/*
+ * A MidiMpeReceiver follows incoming MPE: it picks up the zones & pitch
+ *  bend ranges from their RPNs, and keeps each note that's on along with
+ *  the pitch bend, pressure & timbre for it, calling the handle functions
+ *  below as they change.  Notes are kept in storage given by the user (up
+ *  to 254), linked from the channel they're on, so an expression message
+ *  only goes to the notes on its channel -- usually just the one -- and
+ *  never looks through the rest.  Changes on a master channel go to
+ *  handleMasterChange() rather than to every note in the zone; pitch()
+ *  puts the master channel's bend in when asked.
+ *
+ * Subclass it & add it to a Midi instance with addListener(), or give it
+ *  messages from a StaticMidi instance with process().  Notes that come in
+ *  when the storage is full are ignored.
+ */
+
+class MidiMpeReceiver : public MidiListener {
+private:
+    static const unsigned char NONE = 0xff;
+
+    struct Channel {
+        unsigned int bend;
+        unsigned char pressure;
+        unsigned char timbre;
+        unsigned char bendRange;
+        unsigned char first;            // first note on the channel
+        unsigned char rpnMsb;
+        unsigned char rpnLsb;
+    };
+
+    MidiMpeLayout layout_;
+    Channel channels_[16];
+
+    MidiMpeNote *notes_;
+    unsigned int count_;
+    unsigned char free_;
+    unsigned int active_;
+
+    void noteOn(unsigned int channel, unsigned int note, unsigned int velocity);
+    void noteOff(unsigned int channel, unsigned int note, unsigned int velocity);
+    void allNotesOff(unsigned int channel);
+    void expression(unsigned int channel, unsigned int changed);
+    void dataEntry(unsigned int channel, unsigned int value);
+    void setZone(unsigned int zone, unsigned int members);
+
+public:
+    // What changed, for handleNoteChange() & handleMasterChange()
+    static const unsigned int PITCH    = 0x01;
+    static const unsigned int PRESSURE = 0x02;
+    static const unsigned int TIMBRE   = 0x04;
+
+    // storage holds count notes
+    MidiMpeReceiver(MidiMpeNote *storage, unsigned int count);
+    virtual ~MidiMpeReceiver() {}
+
+    // Update from a message (NOTE ON/OFF, PITCH CHANGE, AFTER TOUCH,
+    //  timbre, the RPN controllers, "all notes off" & RESET)
+    void process(const MidiMessage &message);
+
+    void midiReceived(const MidiMessage &message) { process(message); }
+
+    const MidiMpeLayout &layout() const { return layout_; }
+
+    // The latest expression on a channel (1-16), and its pitch bend range
+    //  in semitones
+    unsigned int bend(unsigned int channel) const { return channels_[(channel - 1) & 0x0f].bend; }
+    unsigned int pressure(unsigned int channel) const { return channels_[(channel - 1) & 0x0f].pressure; }
+    unsigned int timbre(unsigned int channel) const { return channels_[(channel - 1) & 0x0f].timbre; }
+    unsigned int bendRange(unsigned int channel) const { return channels_[(channel - 1) & 0x0f].bendRange; }
+
+    // A note's pitch in 1/256ths of a semitone (note * 256 with no bend),
+    //  with its own channel's bend and its zone's master bend added in
+    long pitch(const MidiMpeNote &note) const;
+
+    // The note on channel (1-16) with that note number, or 0 if it isn't on
+    const MidiMpeNote *find(unsigned int channel, unsigned int note) const;
+
+    // Number of notes on
+    unsigned int active() const { return active_; }
+
+    // Forget all notes & expression, keeping the zones
+    void reset();
+
+    // Overload these in a subclass to hear about notes starting, changing
+    //  (changed says what did) & ending, and changes to a zone's master
+    //  channel or its number of members
+    virtual void handleNoteStart(const MidiMpeNote &note) {}
+    virtual void handleNoteChange(const MidiMpeNote &note, unsigned int changed) {}
+    virtual void handleNoteEnd(const MidiMpeNote &note) {}
+    virtual void handleMasterChange(unsigned int zone, unsigned int changed) {}
+    virtual void handleZoneChange(unsigned int zone, unsigned int members) {}
+};
+
+#endif /* #ifndef MIDIMPE_H ... */
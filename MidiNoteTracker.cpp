@@ -0,0 +1,236 @@
+/*  MidiNoteTracker.cpp: Keeps track of which notes are on, on each channel
+ *
+ *             (c) 2003-2011 Tymm Twillman <tymmothy@gmail.com>
+ *
+ *  This file is part of Tymm's Arduino Midi Library.
+ *
+ *  Tymm's Arduino Midi Library is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation, either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  Tymm's Arduino Midi Library is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Tymm's Arduino Midi Library.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+#include "MidiNoteTracker.h"
+
+
+// Controllers the tracker pays attention to
+static const unsigned char CONTROLLER_SUSTAIN        = 64;
+static const unsigned char CONTROLLER_SOUND_OFF      = 120;
+static const unsigned char CONTROLLER_RESET          = 121;
+
+// All notes off, and the mode changes (omni off/on, mono, poly), which
+//  also turn all notes off
+static const unsigned char CONTROLLER_NOTES_OFF      = 123;
+
+
+MidiNoteTracker::MidiNoteTracker(unsigned int sources)
+  : sources_(sources)
+{
+    reset();
+}
+
+
+void MidiNoteTracker::midiReceived(const MidiMessage &message)
+{
+    if (sources_ & RECEIVED) {
+        process(message);
+    }
+}
+
+
+void MidiNoteTracker::midiSent(const MidiMessage &message)
+{
+    if (sources_ & SENT) {
+        process(message);
+    }
+}
+
+
+void MidiNoteTracker::process(const MidiMessage &message)
+{
+    unsigned int channel = message.status & 0x0f;
+    /* Messages built by hand (rather than decoded) might not have a clean
+     *  note number, and it's used as a bit index
+     */
+    unsigned int note = message.data1 & 0x7f;
+
+
+    switch (message.type) {
+        case MidiMessage::NOTE_ON:
+            noteOn(channel, note);
+            break;
+
+        case MidiMessage::NOTE_OFF:
+            noteOff(channel, note);
+            break;
+
+        case MidiMessage::CONTROL_CHANGE:
+            if (message.data1 == CONTROLLER_SUSTAIN) {
+                setSustain(channel, message.data2 >= 64);
+            } else if (message.data1 == CONTROLLER_SOUND_OFF) {
+                clearChannel(channel);
+            } else if (message.data1 == CONTROLLER_RESET) {
+                setSustain(channel, false);
+            } else if (message.data1 >= CONTROLLER_NOTES_OFF) {
+                allNotesOff(channel);
+            }
+            break;
+
+        case MidiMessage::RESET:
+            reset();
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+void MidiNoteTracker::noteOn(unsigned int channel, unsigned int note)
+{
+    unsigned char *sounding = &sounding_[channel][note >> 3];
+    unsigned char bit = 1 << (note & 0x07);
+
+
+    held_[channel][note >> 3] |= bit;
+
+    if (!(*sounding & bit)) {
+        *sounding |= bit;
+        count_[channel]++;
+        active_ |= 1 << channel;
+    }
+}
+
+
+void MidiNoteTracker::noteOff(unsigned int channel, unsigned int note)
+{
+    unsigned char *sounding = &sounding_[channel][note >> 3];
+    unsigned char bit = 1 << (note & 0x07);
+
+
+    held_[channel][note >> 3] &= ~bit;
+
+    /* With the pedal down, the note keeps going until the pedal comes up */
+    if ((*sounding & bit) && !(sustain_ & (1 << channel))) {
+        *sounding &= ~bit;
+        if (!--count_[channel]) {
+            active_ &= ~(1 << channel);
+        }
+    }
+}
+
+
+// Like a NOTE OFF for every key that's down
+void MidiNoteTracker::allNotesOff(unsigned int channel)
+{
+    for (unsigned int i = 0; i < 16; i++) {
+        held_[channel][i] = 0;
+    }
+
+    if (!(sustain_ & (1 << channel))) {
+        clearChannel(channel);
+    }
+}
+
+
+void MidiNoteTracker::setSustain(unsigned int channel, bool down)
+{
+    if (down) {
+        sustain_ |= 1 << channel;
+    } else if (sustain_ & (1 << channel)) {
+        sustain_ &= ~(1 << channel);
+
+        /* Everything that was only going because of the pedal stops */
+        for (unsigned int i = 0; i < 16; i++) {
+            sounding_[channel][i] = held_[channel][i];
+        }
+        recount(channel);
+    }
+}
+
+
+void MidiNoteTracker::clearChannel(unsigned int channel)
+{
+    for (unsigned int i = 0; i < 16; i++) {
+        held_[channel][i] = 0;
+        sounding_[channel][i] = 0;
+    }
+
+    count_[channel] = 0;
+    active_ &= ~(1 << channel);
+}
+
+
+void MidiNoteTracker::recount(unsigned int channel)
+{
+    unsigned char count = 0;
+
+
+    for (unsigned int i = 0; i < 16; i++) {
+        for (unsigned char bits = sounding_[channel][i]; bits; bits &= bits - 1) {
+            count++;
+        }
+    }
+
+    count_[channel] = count;
+    if (count) {
+        active_ |= 1 << channel;
+    } else {
+        active_ &= ~(1 << channel);
+    }
+}
+
+
+int MidiNoteTracker::nextNote(unsigned int channel, int after) const
+{
+    const unsigned char *notes = sounding_[(channel - 1) & 0x0f];
+    int note = after + 1;
+    unsigned int i;
+    unsigned char bits;
+
+
+    if (note < 0 || note > 127) {
+        return -1;
+    }
+
+    /* Drop the notes at or below after from the first byte, then skip to
+     *  the first byte with anything in it
+     */
+    i = note >> 3;
+    bits = notes[i] >> (note & 0x07);
+
+    while (!bits) {
+        if (++i == 16) {
+            return -1;
+        }
+        bits = notes[i];
+        note = i * 8;
+    }
+
+    while (!(bits & 0x01)) {
+        bits >>= 1;
+        note++;
+    }
+
+    return note;
+}
+
+
+void MidiNoteTracker::reset(void)
+{
+    for (unsigned int c = 0; c < 16; c++) {
+        clearChannel(c);
+    }
+
+    active_ = 0;
+    sustain_ = 0;
+}
@@ -0,0 +1,165 @@
+/*
+ *  MidiNoteTracker.h: Keeps track of which notes are on, on each channel
+ *
+ *             (c) 2003-2011 Tymm Twillman <tymmothy@gmail.com>
+ *
+ *  This file is part of Tymm's Arduino Midi Library.
+ *
+ *  Tymm's Arduino Midi Library is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation, either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  Tymm's Arduino Midi Library is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Tymm's Arduino Midi Library.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef MIDINOTETRACKER_H
+#define MIDINOTETRACKER_H
+
+#include "MidiListener.h"
+
+
+/*
+ * A MidiNoteTracker remembers which notes are on, on each of the 16
+ *  channels, so that when something goes wrong (a NOTE OFF gets lost, the
+ *  other end is reset) the notes that are stuck on can be turned off
+ *  with panic() -- usually a handful of messages, rather than a NOTE OFF
+ *  for every note on every channel (2048 of them, which takes most of two
+ *  seconds at 31250 baud).
+ *
+ * The tracker can be added to a Midi instance with addListener(), and
+ *  follows the messages it receives, the messages it sends, or both; for
+ *  a StaticMidi instance (or messages from anywhere else) call process()
+ *  with each message.
+ *
+ * Notes are kept one bit each, so the tracker takes 2 x 256 bytes: one set
+ *  of bits for notes whose key is down, and one for notes that are
+ *  sounding (held down, or let go of while the sustain pedal is down).
+ */
+
+class MidiNoteTracker : public MidiListener {
+private:
+    // One bit per note, 8 notes to a byte, 16 bytes per channel
+    unsigned char held_[16][16];
+    unsigned char sounding_[16][16];
+
+    // Number of notes sounding on each channel
+    unsigned char count_[16];
+
+    // One bit per channel (bit 0 is channel 1): channels with anything
+    //  sounding, and channels with the sustain pedal down
+    unsigned int active_;
+    unsigned int sustain_;
+
+    unsigned int sources_;
+
+    void noteOn(unsigned int channel, unsigned int note);
+    void noteOff(unsigned int channel, unsigned int note);
+    void allNotesOff(unsigned int channel);
+    void setSustain(unsigned int channel, bool down);
+    void clearChannel(unsigned int channel);
+    void recount(unsigned int channel);
+
+public:
+    // Which messages to follow when added to a Midi instance
+    static const unsigned int RECEIVED = 0x01;
+    static const unsigned int SENT     = 0x02;
+
+    MidiNoteTracker(unsigned int sources = RECEIVED | SENT);
+
+    // Update the notes from a message (NOTE ON/OFF, sustain pedal & the
+    //  "all notes off" controllers, and RESET; everything else is ignored)
+    void process(const MidiMessage &message);
+
+    void midiReceived(const MidiMessage &message);
+    void midiSent(const MidiMessage &message);
+
+    // Whether a note is sounding on a channel (1-16), and whether its key
+    //  is down (sounding doesn't need the key down if the pedal is)
+    bool isOn(unsigned int channel, unsigned int note) const
+    {
+        return sounding_[(channel - 1) & 0x0f][(note >> 3) & 0x0f] & (1 << (note & 0x07));
+    }
+
+    bool isHeld(unsigned int channel, unsigned int note) const
+    {
+        return held_[(channel - 1) & 0x0f][(note >> 3) & 0x0f] & (1 << (note & 0x07));
+    }
+
+    bool sustained(unsigned int channel) const
+    {
+        return sustain_ & (1 << ((channel - 1) & 0x0f));
+    }
+
+    // Number of notes sounding on a channel (1-16)
+    unsigned int count(unsigned int channel) const { return count_[(channel - 1) & 0x0f]; }
+
+    // Channels with notes sounding (bit 0 is channel 1)
+    unsigned int activeChannels() const { return active_; }
+
+    // The lowest note sounding on channel that's above after, or -1 if
+    //  there isn't one; start with after = -1 to go through all of them:
+    //
+    //   for (int note = tracker.nextNote(1); note >= 0; note = tracker.nextNote(1, note))
+    //
+    //  Empty groups of 8 notes are skipped a byte at a time.
+    int nextNote(unsigned int channel, int after = -1) const;
+
+    // Send a NOTE OFF through out (a Midi or StaticMidi instance) for every
+    //  note that's sounding, and let go of the sustain pedal on channels
+    //  where it's down, then forget everything.  Returns the number of
+    //  messages sent.
+    template <class Output>
+    unsigned int panic(Output &out)
+    {
+        unsigned int sent = 0;
+        unsigned int active = active_;
+        unsigned int sustain = sustain_;
+
+
+        for (unsigned int c = 0; c < 16; c++) {
+            if (active & (1 << c)) {
+                unsigned char notes[16];
+
+
+                /* Work from a copy, since the NOTE OFFs might come back
+                 *  through midiSent() as they go out
+                 */
+                for (unsigned int i = 0; i < 16; i++) {
+                    notes[i] = sounding_[c][i];
+                }
+
+                for (unsigned int i = 0; i < 16; i++) {
+                    for (unsigned int bits = notes[i], note = i * 8; bits; bits >>= 1, note++) {
+                        if (bits & 0x01) {
+                            out.sendNoteOff(c + 1, note, 0);
+                            sent++;
+                        }
+                    }
+                }
+            }
+
+            if (sustain & (1 << c)) {
+                out.sendControlChange(c + 1, 64, 0);
+                sent++;
+            }
+        }
+
+        reset();
+
+        return sent;
+    }
+
+    // Forget all notes & pedals
+    void reset();
+};
+
+#endif /* #ifndef MIDINOTETRACKER_H ... */
@@ -0,0 +1,260 @@
+/*  MidiParser.cpp: Status byte table for the MIDI parser
+ *
+ *             (c) 2003-2011 Tymm Twillman <tymmothy@gmail.com>
+ *
+ *  This file is part of Tymm's Arduino Midi Library.
+ *
+ *  Tymm's Arduino Midi Library is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation, either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  Tymm's Arduino Midi Library is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Tymm's Arduino Midi Library.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+#include "MidiParser.h"
+
+
+// Everything the parser needs to know about each status byte.  The channel
+//  messages only need one entry each, since the channel doesn't matter here.
+//
+//  Status bytes that aren't defined by the MIDI spec still need to be handled
+//  properly -- the undefined system common ones (0xf4, 0xf5) cancel running
+//  status like any other system common message, and the undefined real time
+//  ones (0xf9, 0xfd) are just skipped without disturbing anything.
+const MidiParser::StatusInfo MidiParser::statusTable[23] = {
+    /* 0x80 */ { MidiMessage::NOTE_OFF,        CLASS_CHANNEL  | 2 },
+    /* 0x90 */ { MidiMessage::NOTE_ON,         CLASS_CHANNEL  | 2 },
+    /* 0xa0 */ { MidiMessage::VELOCITY_CHANGE, CLASS_CHANNEL  | 2 },
+    /* 0xb0 */ { MidiMessage::CONTROL_CHANGE,  CLASS_CHANNEL  | 2 },
+    /* 0xc0 */ { MidiMessage::PROGRAM_CHANGE,  CLASS_CHANNEL  | 1 },
+    /* 0xd0 */ { MidiMessage::AFTER_TOUCH,     CLASS_CHANNEL  | 1 },
+    /* 0xe0 */ { MidiMessage::PITCH_CHANGE,    CLASS_CHANNEL  | 2 },
+
+    /* 0xf0 */ { MidiMessage::NONE,            CLASS_SYSEX        },
+    /* 0xf1 */ { MidiMessage::TIME_CODE,       CLASS_COMMON   | 1 },
+    /* 0xf2 */ { MidiMessage::SONG_POSITION,   CLASS_COMMON   | 2 },
+    /* 0xf3 */ { MidiMessage::SONG_SELECT,     CLASS_COMMON   | 1 },
+    /* 0xf4 */ { MidiMessage::NONE,            CLASS_COMMON       },
+    /* 0xf5 */ { MidiMessage::NONE,            CLASS_COMMON       },
+    /* 0xf6 */ { MidiMessage::TUNE_REQUEST,    CLASS_COMMON       },
+    /* 0xf7 */ { MidiMessage::NONE,            CLASS_SYSEX        },
+    /* 0xf8 */ { MidiMessage::SYNC,            CLASS_REALTIME     },
+    /* 0xf9 */ { MidiMessage::NONE,            CLASS_REALTIME     },
+    /* 0xfa */ { MidiMessage::START,           CLASS_REALTIME     },
+    /* 0xfb */ { MidiMessage::CONTINUE,        CLASS_REALTIME     },
+    /* 0xfc */ { MidiMessage::STOP,            CLASS_REALTIME     },
+    /* 0xfd */ { MidiMessage::NONE,            CLASS_REALTIME     },
+    /* 0xfe */ { MidiMessage::ACTIVE_SENSE,    CLASS_REALTIME     },
+    /* 0xff */ { MidiMessage::RESET,           CLASS_REALTIME     },
+};
+
+
+int MidiParser::channel() const
+{
+    unsigned int channels = channelFilter_[0];
+    unsigned int i;
+
+
+    for (i = 1; i < 7; i++) {
+        if (channelFilter_[i] != channels) {
+            return -1;
+        }
+    }
+
+    if (channels == 0xffff) {
+        return 0;
+    }
+
+    for (i = 0; i < 16; i++) {
+        if (channels == (1U << i)) {
+            return i + 1;
+        }
+    }
+
+    return -1;
+}
+
+
+void MidiParser::setChannelFilter(unsigned int status, unsigned int channels)
+{
+    unsigned int i;
+
+
+    channels &= 0xffff;
+
+    if (status) {
+        /* Not a channel message status; there's no filter to set */
+        if (status < 0x80 || status >= 0xf0) {
+            return;
+        }
+
+        channelFilter_[(status >> 4) - 8] = channels;
+    } else {
+        for (i = 0; i < 7; i++) {
+            channelFilter_[i] = channels;
+        }
+    }
+
+    updateAccept();
+}
+
+
+unsigned int MidiParser::channelFilter(unsigned int status) const
+{
+    unsigned int channels = 0xffff;
+    unsigned int i;
+
+
+    if (status) {
+        if (status < 0x80 || status >= 0xf0) {
+            return 0;
+        }
+
+        return channelFilter_[(status >> 4) - 8];
+    }
+
+    for (i = 0; i < 7; i++) {
+        channels &= channelFilter_[i];
+    }
+
+    return channels;
+}
+
+
+// A data byte in a proprietary stream
+bool MidiParser::sysExByte(unsigned char value, MidiMessage *message)
+{
+    /* No buffer to put it in, or it's not from anyone we're listening to */
+    if (sysExSkip_) {
+        return false;
+    }
+
+    if (sysExMatched_ < sysExFilterLength_) {
+        if (value != sysExFilter_[sysExMatched_++]) {
+            sysExSkip_ = true;
+            return false;
+        }
+    }
+
+    /* The last buffer full has been handed back; start over */
+    if (sysExFlush_) {
+        sysExLength_ = 0;
+        sysExFlush_ = false;
+    }
+
+    sysExBuffer_[sysExLength_++] = value;
+
+    if (sysExLength_ != sysExSize_) {
+        return false;
+    }
+
+    MIDI_STAT(if (sysExFirst_) stats_.sysExOverflows++);
+
+    return sysExChunk(0, message);
+}
+
+
+// End of a proprietary stream (either properly, or by being cut off); hands
+//  back whatever's left in the buffer
+bool MidiParser::endSysEx(unsigned char flags, MidiMessage *message)
+{
+    if (!inProprietary_) {
+        return false;
+    }
+
+    inProprietary_ = false;
+
+    MIDI_STAT(if (flags & MidiMessage::SYSEX_ABORTED) stats_.truncatedMessages++);
+
+    /* A message that ended before all of the filter's prefix was seen
+     *  didn't match it either
+     */
+    if (sysExSkip_ || sysExMatched_ < sysExFilterLength_) {
+        return false;
+    }
+
+    /* Nothing added since the buffer was last handed back */
+    if (sysExFlush_) {
+        sysExLength_ = 0;
+    }
+
+    return sysExChunk(flags, message);
+}
+
+
+// Hand back the message held back by the last byte, then decode value.
+//  Only TUNE REQUESTs are held back, and they leave the parser between
+//  messages, so all value can finish is another message without data
+//  bytes, which is held back in turn.  (Calling parse() here instead would
+//  add a second copy of it.)
+bool MidiParser::parsePending(unsigned char value, MidiMessage *message)
+{
+    const StatusInfo *info;
+
+
+    *message = pending_;
+    pending_.type = MidiMessage::NONE;
+
+    MIDI_STAT(stats_.bytesReceived++);
+
+    if (!(value & 0x80)) {
+        MIDI_STAT(stats_.orphanBytes++);
+        return true;
+    }
+
+    info = &statusInfo(value);
+
+    switch (info->flags & CLASS_MASK) {
+        case CLASS_REALTIME:
+            break;
+
+        case CLASS_SYSEX:
+            if (value == STATUS_START_PROPRIETARY) {
+                startSysEx();
+            }
+            return true;
+
+        default:
+            startEvent(value, info);
+            if (bytesNeeded_) {
+                return true;
+            }
+            break;
+    }
+
+    if (info->type != MidiMessage::NONE && accepts(value)) {
+        statusMessage(value, info->type, &pending_);
+    }
+
+    return true;
+}
+
+
+// Hand back what's in the SysEx buffer
+bool MidiParser::sysExChunk(unsigned char flags, MidiMessage *message)
+{
+    if (sysExFirst_) {
+        flags |= MidiMessage::SYSEX_FIRST;
+        sysExFirst_ = false;
+    }
+
+    sysExFlush_ = true;
+
+    message->status = STATUS_START_PROPRIETARY;
+    message->type = MidiMessage::SYSEX;
+    message->data1 = flags;
+    message->data2 = 0;
+    MIDI_STAT(stats_.messages[MidiMessage::SYSEX]++);
+#if MIDI_TIMESTAMPS
+    message->time = now_;
+#endif
+    return true;
+}
@@ -0,0 +1,642 @@
+/*
+ *  MidiParser.h: Decoding of incoming MIDI byte streams, shared by the Midi
+ *                and StaticMidi classes
+ *
+ *             (c) 2003-2011 Tymm Twillman <tymmothy@gmail.com>
+ *
+ *  This file is part of Tymm's Arduino Midi Library.
+ *
+ *  Tymm's Arduino Midi Library is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation, either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  Tymm's Arduino Midi Library is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Tymm's Arduino Midi Library.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MIDIPARSER_H
+#define MIDIPARSER_H
+
+#include "MidiConfig.h"
+
+// These are midi status message types as sent on the wire
+static const int STATUS_EVENT_NOTE_OFF        = 0x80;
+static const int STATUS_EVENT_NOTE_ON         = 0x90;
+static const int STATUS_EVENT_VELOCITY_CHANGE = 0xA0;
+static const int STATUS_EVENT_CONTROL_CHANGE  = 0xB0;
+static const int STATUS_EVENT_PROGRAM_CHANGE  = 0xC0;
+static const int STATUS_AFTER_TOUCH           = 0xD0;
+static const int STATUS_PITCH_CHANGE          = 0xE0;
+static const int STATUS_START_PROPRIETARY     = 0xF0;
+static const int STATUS_TIME_CODE             = 0xF1;
+static const int STATUS_SONG_POSITION         = 0xF2;
+static const int STATUS_SONG_SELECT           = 0xF3;
+static const int STATUS_TUNE_REQUEST          = 0xF6;
+static const int STATUS_END_PROPRIETARY       = 0xF7;
+static const int STATUS_SYNC                  = 0xF8;
+static const int STATUS_START                 = 0xFA;
+static const int STATUS_CONTINUE              = 0xFB;
+static const int STATUS_STOP                  = 0xFC;
+static const int STATUS_ACTIVE_SENSE          = 0xFE;
+static const int STATUS_RESET                 = 0xFF;
+
+
+// A single decoded Midi message, as filled in by Midi::decode().  It's kept
+//  small & fixed size so that lots of them can be kept in an array.
+//
+//  status is the status byte as sent on the wire (so for channel messages,
+//  the low 4 bits are the channel - 1).  Messages with one byte of data
+//  have it in data1; for 14-bit values (pitch, song position) data1 is the
+//  low 7 bits and data2 the high 7.  Unused data bytes are 0.
+//
+//  type is one of the values below, saying which handler the message goes
+//  to; a NOTE ON with velocity 0 has a type of NOTE_OFF.  It doesn't need to
+//  be filled in for messages passed to Midi::send().
+//
+//  A SYSEX message stands for a piece of a system exclusive message that has
+//  been collected in the parser's SysEx buffer; data1 holds the SYSEX_ flags
+//  below, and the data itself has to be picked up (see
+//  MidiParser::sysExData()) before any more bytes are decoded.
+//
+//  With MIDI_TIMESTAMPS turned on (see MidiConfig.h), time holds the time
+//  the first byte of the message was read, from the clock given to the
+//  parser.
+struct MidiMessage {
+    enum {
+        NONE = 0,
+        NOTE_OFF,
+        NOTE_ON,
+        VELOCITY_CHANGE,
+        CONTROL_CHANGE,
+        PROGRAM_CHANGE,
+        AFTER_TOUCH,
+        PITCH_CHANGE,
+        TIME_CODE,
+        SONG_POSITION,
+        SONG_SELECT,
+        TUNE_REQUEST,
+        SYNC,
+        START,
+        CONTINUE,
+        STOP,
+        ACTIVE_SENSE,
+        RESET,
+        SYSEX,
+
+        NUM_TYPES
+    };
+
+    // Flags for SYSEX messages: whether this is the first piece of the
+    //  system exclusive message, the last piece (an END_PROPRIETARY came
+    //  in), or the last piece of one that was cut off by another status byte
+    enum {
+        SYSEX_FIRST   = 0x01,
+        SYSEX_LAST    = 0x02,
+        SYSEX_ABORTED = 0x04
+    };
+
+    unsigned char status;
+    unsigned char data1;
+    unsigned char data2;
+    unsigned char type;
+
+#if MIDI_TIMESTAMPS
+    unsigned long time;
+#endif
+};
+
+
+// Counts kept with MIDI_STATS turned on (see MidiConfig.h), from when the
+//  parser was created or the counts were last reset.  They're kept by the
+//  parser so that both Midi and StaticMidi have them.
+struct MidiStats {
+    // Bytes decoded, and bytes sent
+    unsigned long bytesReceived;
+    unsigned long bytesSent;
+
+    // Messages decoded, by MidiMessage type (messages for channels that
+    //  aren't being listened to aren't counted)
+    unsigned long messages[MidiMessage::NUM_TYPES];
+
+    // Data bytes that came in with no status byte for them to belong to
+    unsigned long orphanBytes;
+
+    // Messages cut off by a status byte before all of their data came in
+    //  (including system exclusive messages that didn't get an END)
+    unsigned long truncatedMessages;
+
+    // System exclusive messages too big for the SysEx buffer to hold in one
+    //  piece
+    unsigned long sysExOverflows;
+
+    // Longest time one call to poll() took (only kept by the Midi class,
+    //  and only if it has a clock)
+    unsigned long longestPoll;
+
+    void reset()
+    {
+        unsigned int i;
+
+
+        bytesReceived = 0;
+        bytesSent = 0;
+        for (i = 0; i < MidiMessage::NUM_TYPES; i++) {
+            messages[i] = 0;
+        }
+        orphanBytes = 0;
+        truncatedMessages = 0;
+        sysExOverflows = 0;
+        longestPoll = 0;
+    }
+};
+
+
+/*
+ * This keeps track of partial Midi messages as bytes come in, and hands back
+ *  complete messages.  Everything is inline so that classes using it (in
+ *  particular the StaticMidi template) can have it compiled right into their
+ *  receive loops.
+ *
+ * All of the knowledge about what each status byte means is in a small
+ *  table (see MidiParser.cpp), so decoding a status byte is one table
+ *  lookup, and decoding a data byte doesn't need to look at the status at
+ *  all.
+ *
+ * System exclusive data is collected into a buffer given with
+ *  setSysExBuffer(), and handed back in pieces (as SYSEX messages) each time
+ *  the buffer fills up and when the message ends.  Without a buffer, system
+ *  exclusive data is skipped.
+ */
+
+class MidiParser {
+public:
+    // What the status table holds for each status byte
+    struct StatusInfo {
+        // MidiMessage type the status byte decodes to (NONE for ones that
+        //  don't get handed to a handler)
+        unsigned char type;
+
+        // Number of data bytes that follow (in the low 2 bits) and which of
+        //  the CLASS_ values below the status belongs to
+        unsigned char flags;
+    };
+
+    static const unsigned char DATA_BYTES_MASK = 0x03;
+
+    // Channel messages; these set running status
+    static const unsigned char CLASS_CHANNEL   = 0x00;
+    // System common messages; these cancel running status
+    static const unsigned char CLASS_COMMON    = 0x04;
+    // Real time messages; these can show up anywhere and don't change state
+    static const unsigned char CLASS_REALTIME  = 0x08;
+    // Start & end of a proprietary (system exclusive) stream
+    static const unsigned char CLASS_SYSEX     = 0x0c;
+    static const unsigned char CLASS_MASK      = 0x0c;
+
+    // Indexed by statusIndex() -- 7 entries for the channel messages (0x80
+    //  to 0xe0), then 16 for the system messages (0xf0 to 0xff)
+    static const StatusInfo statusTable[23];
+
+private:
+    // Channels (bit 0 for channel 1) that each of the 7 kinds of channel
+    //  message is accepted for, and which system messages are accepted
+    //  (bit n for status 0xf0 + n)
+    unsigned int channelFilter_[7];
+    unsigned int systemFilter_;
+
+    // These are for keeping track of partial Midi messages as bytes come in
+    bool inProprietary_;
+    unsigned char event_;
+    unsigned char type_;
+    unsigned char arg0_;
+    unsigned char byteCount_;
+    unsigned char bytesNeeded_;
+
+    // Whether the messages for the current event are wanted (worked out once
+    //  when the status byte comes in, rather than for every message)
+    bool accept_;
+
+    // Where system exclusive data gets collected, and how much of it is
+    //  there
+    unsigned char *sysExBuffer_;
+    unsigned int sysExSize_;
+    unsigned int sysExLength_;
+
+    // Only system exclusive messages starting with these bytes (usually a
+    //  manufacturer ID) are collected
+    unsigned char sysExFilter_[3];
+    unsigned char sysExFilterLength_;
+
+    // State of the system exclusive message coming in: how many of its bytes
+    //  have been checked against the filter, whether it's being skipped,
+    //  whether any of it has been handed back yet, and whether the buffer
+    //  has been handed back (so the next byte goes at the start of it)
+    unsigned char sysExMatched_;
+    bool sysExSkip_;
+    bool sysExFirst_;
+    bool sysExFlush_;
+
+    // A message that finished on the same byte as a piece of system
+    //  exclusive data, waiting to be handed back with the next byte (type
+    //  NONE if there isn't one)
+    MidiMessage pending_;
+
+#if MIDI_STATS
+    MidiStats stats_;
+#endif
+
+#if MIDI_TIMESTAMPS
+    // Time the byte being decoded was read, and the time the message it's
+    //  part of started (and whether that's been set yet)
+    unsigned long now_;
+    unsigned long start_;
+    bool started_;
+#endif
+
+    void updateAccept()
+    {
+        if (event_ >= 0xf0) {
+            accept_ = (systemFilter_ >> (event_ & 0x0f)) & 0x01;
+        } else if (event_ & 0x80) {
+            accept_ = (channelFilter_[(event_ >> 4) - 8] >> (event_ & 0x0f)) & 0x01;
+        } else {
+            accept_ = true;
+        }
+    }
+
+    void startSysEx()
+    {
+        inProprietary_ = true;
+        sysExMatched_ = 0;
+        sysExSkip_ = !sysExSize_ || !(systemFilter_ & 0x01);
+        sysExFirst_ = true;
+        sysExFlush_ = true;
+    }
+
+    // Start decoding an event with the given status (a channel or system
+    //  common one)
+    void startEvent(unsigned char status, const StatusInfo *info)
+    {
+        event_ = status;
+        type_ = info->type;
+        byteCount_ = 0;
+        bytesNeeded_ = info->flags & DATA_BYTES_MASK;
+        updateAccept();
+#if MIDI_TIMESTAMPS
+        start_ = now_;
+        started_ = true;
+#endif
+    }
+
+    // Fill in a message that's only a status byte
+    void statusMessage(unsigned char status, unsigned char type, MidiMessage *message)
+    {
+        message->status = status;
+        message->type = type;
+        message->data1 = 0;
+        message->data2 = 0;
+#if MIDI_TIMESTAMPS
+        message->time = now_;
+#endif
+        MIDI_STAT(stats_.messages[type]++);
+    }
+
+    // These are kept out of line (in MidiParser.cpp), so that system
+    //  exclusive handling doesn't add to the size of every receive loop
+    bool sysExByte(unsigned char value, MidiMessage *message);
+    bool endSysEx(unsigned char flags, MidiMessage *message);
+    bool sysExChunk(unsigned char flags, MidiMessage *message);
+    bool parsePending(unsigned char value, MidiMessage *message);
+
+public:
+    MidiParser()
+      : systemFilter_(0xffff), sysExBuffer_(0), sysExSize_(0), sysExFilterLength_(0)
+#if MIDI_TIMESTAMPS
+      , now_(0)
+#endif
+    {
+        reset();
+        setChannel(0);
+        MIDI_STAT(stats_.reset());
+    }
+
+    // Forget about any partial message
+    void reset()
+    {
+        /* Not in proprietary stream */
+        inProprietary_ = false;
+        /* Nothing held back */
+        pending_.type = MidiMessage::NONE;
+        /* Not processing an event */
+        event_ = 0;
+        type_ = MidiMessage::NONE;
+        /* No arguments to the event we haven't received */
+        arg0_ = 0;
+        /* No bytes recevied */
+        byteCount_ = 0;
+        /* Not waiting for bytes to complete a message */
+        bytesNeeded_ = 0;
+        accept_ = true;
+        /* Nothing in the SysEx buffer */
+        sysExLength_ = 0;
+        sysExFlush_ = true;
+#if MIDI_TIMESTAMPS
+        started_ = false;
+#endif
+    }
+
+    // Only pass along channel messages for this channel (1-16, or 0 for
+    //  all), replacing any channel filters set below; anything else is
+    //  ignored
+    void setChannel(int channel)
+    {
+        if (channel >= 0 && channel <= 16) {
+            setChannelFilter(0, channel ? 1 << (channel - 1) : 0xffff);
+        }
+    }
+
+    // The channel messages are passed along for: 0 if it's all of them,
+    //  the channel if it's only one (for every kind of channel message),
+    //  or -1 if the filters don't come down to either
+    int channel() const;
+
+    // Only pass along channel messages with the given status (e.g.
+    //  STATUS_EVENT_NOTE_ON; 0 means all channel messages) for the channels
+    //  in channels (bit 0 for channel 1, so 0xffff is all of them and 0 is
+    //  none).  Messages are filtered by their status byte, so a NOTE ON
+    //  with velocity 0 goes with NOTE ONs.  Any other status (outside
+    //  0x80-0xef) is ignored; system messages have setSystemFilter().
+    void setChannelFilter(unsigned int status, unsigned int channels);
+
+    // The channels messages with the given status are passed along for (0
+    //  for a status that isn't a channel message's); for status 0, the
+    //  channels every kind of channel message is passed along for
+    unsigned int channelFilter(unsigned int status) const;
+
+    // Only pass along system messages with status 0xf0 + n if bit n of mask
+    //  is set (so 0xffff is all of them).  Bit 0 is for system exclusive
+    //  messages, which are then skipped like ones that don't match the
+    //  SysEx filter; END_PROPRIETARY always ends a system exclusive message.
+    void setSystemFilter(unsigned int mask)
+    {
+        systemFilter_ = mask & 0xffff;
+        updateAccept();
+    }
+
+    unsigned int systemFilter() const { return systemFilter_; }
+
+    // Whether messages with the given status get through the filters
+    //  (false if it isn't a status byte)
+    bool accepts(unsigned char status) const
+    {
+        if (status >= 0xf0) {
+            return (systemFilter_ >> (status & 0x0f)) & 0x01;
+        }
+
+        if (status < 0x80) {
+            return false;
+        }
+
+        return (channelFilter_[(status >> 4) - 8] >> (status & 0x0f)) & 0x01;
+    }
+
+    // Collect system exclusive data into buffer (pass 0 to skip it all).
+    //  Messages longer than size are handed back a buffer full at a time.
+    void setSysExBuffer(unsigned char *buffer, unsigned int size)
+    {
+        sysExBuffer_ = buffer;
+        sysExSize_ = buffer ? size : 0;
+        sysExLength_ = 0;
+        sysExFlush_ = true;
+        sysExSkip_ = true;
+    }
+
+    // Only collect system exclusive messages whose first length bytes (up
+    //  to 3) match prefix -- everything else is skipped without being
+    //  copied anywhere.  A length of 0 collects everything.  The SysEx
+    //  buffer needs to be bigger than the prefix.
+    void setSysExFilter(const unsigned char *prefix, unsigned int length)
+    {
+        if (length > sizeof(sysExFilter_)) {
+            length = sizeof(sysExFilter_);
+        }
+
+        for (sysExFilterLength_ = 0; sysExFilterLength_ < length; sysExFilterLength_++) {
+            sysExFilter_[sysExFilterLength_] = prefix[sysExFilterLength_];
+        }
+    }
+
+#if MIDI_STATS
+    // The counts so far; the class using the parser adds in what it knows
+    //  about (bytes sent etc.)
+    MidiStats &stats() { return stats_; }
+    const MidiStats &stats() const { return stats_; }
+#endif
+
+#if MIDI_TIMESTAMPS
+    // Set the time the next bytes passed to parse() were read
+    void setTime(unsigned long now) { now_ = now; }
+#endif
+
+    // The system exclusive data for the last SYSEX message handed back;
+    //  only good until the next byte is decoded
+    const unsigned char *sysExData() const { return sysExBuffer_; }
+    unsigned int sysExLength() const { return sysExLength_; }
+
+    // Where in statusTable to find the info for a status byte
+    static unsigned int statusIndex(unsigned char status)
+    {
+        unsigned int index = (status >> 4) - 8;
+
+
+        if (index == 7) {
+            index += status & 0x0f;
+        }
+
+        return index;
+    }
+
+    static const StatusInfo &statusInfo(unsigned char status)
+    {
+        return statusTable[statusIndex(status)];
+    }
+
+    // MidiMessage type of a message with the given status & second data
+    //  byte (which matters for NOTE ON with velocity 0)
+    static unsigned char messageType(unsigned char status, unsigned char data2)
+    {
+        unsigned char type = statusInfo(status).type;
+
+
+        if (type == MidiMessage::NOTE_ON && !data2) {
+            type = MidiMessage::NOTE_OFF;
+        }
+
+        return type;
+    }
+
+    // Total length (including the status byte) of a message with given status
+    static unsigned int messageLength(unsigned char status)
+    {
+        return 1 + (statusInfo(status).flags & DATA_BYTES_MASK);
+    }
+
+    // Handle decoding incoming MIDI traffic a byte at a time -- remembers
+    //  what it needs to from one call to the next.  Returns true (with
+    //  message filled in) when a byte completes a message that we're
+    //  interested in.  A message that finishes on the same byte as a piece
+    //  of system exclusive data (a TUNE REQUEST cutting a SysEx message
+    //  off) is handed back with the next byte instead.
+    bool parse(unsigned char value, MidiMessage *message);
+};
+
+
+inline bool MidiParser::parse(unsigned char value, MidiMessage *message)
+{
+    const StatusInfo *info;
+    bool ended = false;
+
+
+    if (pending_.type != MidiMessage::NONE) {
+        return parsePending(value, message);
+    }
+
+    MIDI_STAT(stats_.bytesReceived++);
+
+    if (!(value & 0x80)) {
+        /* Data byte.  Goes into the SysEx buffer if we're in a proprietary
+         *  stream; ignore it if there's no status for it to belong to.
+         */
+        if (inProprietary_) {
+            return sysExByte(value, message);
+        }
+
+        if (!bytesNeeded_) {
+            MIDI_STAT(stats_.orphanBytes++);
+            return false;
+        }
+
+        /* A message that's been filtered out; just count its bytes so the
+         *  next one is found
+         */
+        if (!accept_) {
+            if (++byteCount_ == bytesNeeded_) {
+                byteCount_ = 0;
+                if (event_ >= 0xf0) {
+                    bytesNeeded_ = 0;
+                }
+            }
+            return false;
+        }
+
+#if MIDI_TIMESTAMPS
+        /* With running status, a message starts with its first data byte */
+        if (!started_) {
+            start_ = now_;
+            started_ = true;
+        }
+#endif
+
+        if (++byteCount_ != bytesNeeded_) {
+            arg0_ = value;
+            return false;
+        }
+
+        /* Just reset the byte count; keep the same event -- might get more messages
+            trailing from current event.
+         */
+        byteCount_ = 0;
+#if MIDI_TIMESTAMPS
+        started_ = false;
+        message->time = start_;
+#endif
+
+        message->status = event_;
+        message->type = type_;
+
+        if (bytesNeeded_ == 1) {
+            message->data1 = value;
+            message->data2 = 0;
+        } else {
+            message->data1 = arg0_;
+            message->data2 = value;
+
+            /* NOTE ON with velocity 0 is really a NOTE OFF */
+            if (!value && type_ == MidiMessage::NOTE_ON) {
+                message->type = MidiMessage::NOTE_OFF;
+            }
+        }
+
+        MIDI_STAT(stats_.messages[message->type]++);
+
+        /* System common messages don't get running status */
+        if (event_ >= 0xf0) {
+            bytesNeeded_ = 0;
+        }
+
+        arg0_ = value;
+        return true;
+    }
+
+    info = &statusInfo(value);
+
+    switch (info->flags & CLASS_MASK) {
+        case CLASS_REALTIME:
+            /* These go through even in the middle of another message */
+            if (info->type == MidiMessage::NONE
+              || !((systemFilter_ >> (value & 0x0f)) & 0x01))
+            {
+                return false;
+            }
+
+            statusMessage(value, info->type, message);
+            return true;
+
+        case CLASS_SYSEX:
+            MIDI_STAT(if (byteCount_) stats_.truncatedMessages++);
+            byteCount_ = 0;
+            bytesNeeded_ = 0;
+
+            if (value != STATUS_START_PROPRIETARY) {
+                return endSysEx(MidiMessage::SYSEX_LAST, message);
+            }
+
+            /* A START_PROPRIETARY in the middle of another one cuts the old
+             *  one off
+             */
+            ended = endSysEx(MidiMessage::SYSEX_ABORTED, message);
+            startSysEx();
+            return ended;
+    }
+
+    /* Any other status byte also cuts off a proprietary stream.  If that
+     *  leaves a piece of SysEx data to hand back, and this message has no
+     *  data bytes (only TUNE REQUESTs, and only in broken streams), this
+     *  one is held back until the next byte.
+     */
+    if (inProprietary_) {
+        ended = endSysEx(MidiMessage::SYSEX_ABORTED, message);
+    }
+
+    /* A message that never got all its data */
+    MIDI_STAT(if (byteCount_) stats_.truncatedMessages++);
+
+    startEvent(value, info);
+
+    /* Messages with no data are complete as soon as they arrive */
+    if (!bytesNeeded_ && type_ != MidiMessage::NONE && accept_) {
+        statusMessage(value, type_, ended ? &pending_ : message);
+        return true;
+    }
+
+    return ended;
+}
+
+#endif /* #ifndef MIDIPARSER_H ... */
@@ -0,0 +1,189 @@
+/*  MidiQueue.cpp: Fixed size queue of decoded MIDI messages
+ *
+ *             (c) 2003-2011 Tymm Twillman <tymmothy@gmail.com>
+ *
+ *  This file is part of Tymm's Arduino Midi Library.
+ *
+ *  Tymm's Arduino Midi Library is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation, either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  Tymm's Arduino Midi Library is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Tymm's Arduino Midi Library.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+#include "MidiQueue.h"
+
+
+// Length stored in place of a piece's length, where the rest of the SysEx
+//  buffer is skipped so the piece can start back at the beginning
+static const unsigned int SYSEX_SKIP = 0xffff;
+
+
+MidiQueue::MidiQueue(MidiMessage *storage, MidiQueueIndex size)
+  : messages_(storage), mask_(size - 1), head_(0), tail_(0),
+    sysEx_(0), sysExMask_(0), sysExHead_(0), sysExTail_(0),
+    sysExSkipping_(false), sysExAbort_(false),
+    sysExData_(0), sysExLength_(0), sysExUsed_(0)
+{
+    resetStats();
+}
+
+
+void MidiQueue::setSysExBuffer(unsigned char *buffer, MidiQueueIndex length)
+{
+    sysEx_ = buffer;
+    sysExMask_ = length - 1;
+    sysExHead_ = sysExTail_ = 0;
+    sysExUsed_ = 0;
+}
+
+
+bool MidiQueue::putSysEx(const MidiMessage &message, const unsigned char *data,
+                         unsigned int length)
+{
+    MidiQueueIndex head = head_;
+    MidiQueueIndex sysExHead = sysExHead_;
+    unsigned int size = (unsigned int)sysExMask_ + 1;
+    unsigned int pos = sysExHead & sysExMask_;
+    unsigned int room = size - pos;
+    unsigned int skip = 0;
+    unsigned char *p;
+
+
+    if (!sysEx_ || length >= SYSEX_SKIP || (MidiQueueIndex)(head - tail_) > mask_) {
+        return false;
+    }
+
+    /* The length & data go in one piece, so if they won't fit before the
+     *  end of the buffer, the rest of it is skipped
+     */
+    if (length + 2 > room) {
+        skip = room;
+    }
+    if (skip + length + 2 > size - (MidiQueueIndex)(sysExHead - sysExTail_)) {
+        return false;
+    }
+
+    if (skip) {
+        if (skip >= 2) {
+            sysEx_[pos] = SYSEX_SKIP & 0xff;
+            sysEx_[pos + 1] = SYSEX_SKIP >> 8;
+        }
+        pos = 0;
+    }
+
+    p = sysEx_ + pos;
+    p[0] = length & 0xff;
+    p[1] = length >> 8;
+    for (unsigned int i = 0; i < length; i++) {
+        p[i + 2] = data[i];
+    }
+
+    messages_[head & mask_] = message;
+
+    MIDI_QUEUE_RELEASE();
+    sysExHead_ = sysExHead + skip + length + 2;
+    head_ = head + 1;
+
+    if ((MidiQueueIndex)(head + 1 - tail_) > highWater_) {
+        highWater_ = head + 1 - tail_;
+    }
+
+    return true;
+}
+
+
+bool MidiQueue::pushAbort(const MidiMessage &next)
+{
+    MidiMessage message = next;
+
+
+    message.status = STATUS_START_PROPRIETARY;
+    message.data1 = MidiMessage::SYSEX_ABORTED;
+    message.data2 = 0;
+    message.type = MidiMessage::SYSEX;
+
+    if (!putSysEx(message, 0, 0)) {
+        return false;
+    }
+
+    sysExAbort_ = false;
+
+    return true;
+}
+
+
+bool MidiQueue::pushSysEx(const MidiMessage &message, const unsigned char *data,
+                          unsigned int length)
+{
+    unsigned int flags = message.data1;
+    bool ends = flags & (MidiMessage::SYSEX_LAST | MidiMessage::SYSEX_ABORTED);
+
+
+    /* After a piece is dropped, the rest of its message is too */
+    if (flags & MidiMessage::SYSEX_FIRST) {
+        sysExSkipping_ = false;
+    } else if (sysExSkipping_) {
+        sysExSkipping_ = !ends;
+        return false;
+    }
+
+    if ((!sysExAbort_ || pushAbort(message)) && putSysEx(message, data, length)) {
+        return true;
+    }
+
+    overflows_++;
+
+    /* The other side has the start of the message, so it needs an end */
+    if (!(flags & MidiMessage::SYSEX_FIRST)) {
+        sysExAbort_ = true;
+    }
+    sysExSkipping_ = !ends;
+
+    return false;
+}
+
+
+void MidiQueue::getSysEx()
+{
+    unsigned int size = (unsigned int)sysExMask_ + 1;
+    unsigned int pos = sysExTail_ & sysExMask_;
+    unsigned int skip = 0;
+    unsigned int length;
+
+
+    if (!sysEx_) {
+        sysExData_ = 0;
+        sysExLength_ = 0;
+        return;
+    }
+
+    /* Skip to the start where the pushing side did */
+    if (size - pos < 2) {
+        skip = size - pos;
+        pos = 0;
+    } else if ((sysEx_[pos] | (sysEx_[pos + 1] << 8)) == SYSEX_SKIP) {
+        skip = size - pos;
+        pos = 0;
+    }
+
+    length = sysEx_[pos] | (sysEx_[pos + 1] << 8);
+    sysExData_ = sysEx_ + pos + 2;
+    sysExLength_ = length;
+    sysExUsed_ = skip + length + 2;
+}
+
+
+void MidiQueue::resetStats(void)
+{
+    highWater_ = head_ - tail_;
+    overflows_ = 0;
+}
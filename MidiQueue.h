@@ -0,0 +1,239 @@
+/*
+ *  MidiQueue.h: Fixed size queue of decoded MIDI messages, safe to fill from
+ *               an interrupt (or another thread) while it's being emptied
+ *
+ *             (c) 2003-2011 Tymm Twillman <tymmothy@gmail.com>
+ *
+ *  This file is part of Tymm's Arduino Midi Library.
+ *
+ *  Tymm's Arduino Midi Library is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation, either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  Tymm's Arduino Midi Library is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Tymm's Arduino Midi Library.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MIDIQUEUE_H
+#define MIDIQUEUE_H
+
+#include "MidiParser.h"
+
+
+/*
+ * A MidiQueue lets decoding of incoming data and running the handlers happen
+ *  at different times: one side (e.g. Midi::poll() called from a timer
+ *  interrupt or a reader thread) pushes decoded messages in, and the other
+ *  (e.g. Midi::dispatchQueued() called from loop()) pulls them out.  That way
+ *  a slow handler doesn't hold up reading the serial port.
+ *
+ * There must only ever be one side pushing and one side pulling.  No locking
+ *  is needed as long as that's true: the pushing side only ever changes
+ *  head_ and the pulling side only ever changes tail_.
+ *
+ * The storage is passed in by the user, and its size must be a power of 2
+ *  (and no more than 128 on AVR, where the indexes are single bytes so that
+ *  they can be read & written atomically).
+ *
+ * SYSEX messages only stand for data sitting in the parser's buffer, which
+ *  gets reused as more bytes come in, so they need somewhere to keep a copy
+ *  of their data too: a second buffer, given with setSysExBuffer() (with
+ *  the same limits on its size), that pushSysEx() copies each piece into.
+ *  Each piece takes its length plus 2 bytes, all in one place, so the
+ *  buffer needs to be at least 2 bytes bigger than the biggest piece (the
+ *  SysEx buffer size of the Midi instance), and a few times that to keep
+ *  several pieces waiting.  A piece that doesn't fit is dropped and the
+ *  rest of its message skipped; if the start of the message already went
+ *  in, the message is ended with a SYSEX_ABORTED piece (with no data)
+ *  before anything else goes into the queue.
+ */
+
+#ifdef __AVR__
+typedef unsigned char MidiQueueIndex;
+#else
+typedef unsigned int MidiQueueIndex;
+#endif
+
+// What's needed to make sure a message is all the way in the queue before
+//  the other side sees the index change (RELEASE), and that the other side
+//  doesn't read the message before it sees the index change (ACQUIRE).  AVR
+//  has no caches or reordering, so there it's enough to stop the compiler
+//  from moving memory accesses around.
+#if defined(__AVR__)
+#define MIDI_QUEUE_ACQUIRE() __asm__ __volatile__("" ::: "memory")
+#define MIDI_QUEUE_RELEASE() __asm__ __volatile__("" ::: "memory")
+#elif defined(__ATOMIC_ACQUIRE)
+#define MIDI_QUEUE_ACQUIRE() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define MIDI_QUEUE_RELEASE() __atomic_thread_fence(__ATOMIC_RELEASE)
+#else
+#define MIDI_QUEUE_ACQUIRE() __sync_synchronize()
+#define MIDI_QUEUE_RELEASE() __sync_synchronize()
+#endif
+
+
+class MidiQueue {
+private:
+    MidiMessage *messages_;
+    MidiQueueIndex mask_;
+
+    // Free-running counts of messages pushed & pulled; the difference is
+    //  how many are in the queue
+    volatile MidiQueueIndex head_;
+    volatile MidiQueueIndex tail_;
+
+    // Most messages that have been waiting at once, and number of messages
+    //  thrown away because the queue was full (both kept by the pushing side)
+    volatile MidiQueueIndex highWater_;
+    volatile unsigned long overflows_;
+
+    // System exclusive data, with free-running counts of bytes used by the
+    //  pushing side & given back by the pulling side
+    unsigned char *sysEx_;
+    MidiQueueIndex sysExMask_;
+    volatile MidiQueueIndex sysExHead_;
+    volatile MidiQueueIndex sysExTail_;
+
+    // Pushing side: the rest of a system exclusive message is being
+    //  skipped, and a SYSEX_ABORTED piece has to go in before anything else
+    bool sysExSkipping_;
+    bool sysExAbort_;
+
+    // Pulling side: the data for the SYSEX message pulled last, and the
+    //  bytes to give back once it's finished with
+    const unsigned char *sysExData_;
+    unsigned int sysExLength_;
+    MidiQueueIndex sysExUsed_;
+
+    // Put a SYSEX message & its data in; returns false if there isn't room
+    bool putSysEx(const MidiMessage &message, const unsigned char *data, unsigned int length);
+
+    // End the system exclusive message that had a piece dropped, before
+    //  next goes in
+    bool pushAbort(const MidiMessage &next);
+
+    // Find the data for the SYSEX message being pulled
+    void getSysEx();
+
+public:
+    // size is the number of MidiMessages in storage (a power of 2)
+    MidiQueue(MidiMessage *storage, MidiQueueIndex size);
+
+    // Add a message; returns false (and counts an overflow) if there was no
+    //  room.  Only call from the pushing side.
+    bool push(const MidiMessage &message);
+
+    // Take the oldest message out; returns false if there wasn't one.  Only
+    //  call from the pulling side.  For a SYSEX message, the data is in
+    //  sysExData() until the next pull() or releaseSysEx().
+    bool pull(MidiMessage *message);
+
+    // Give the queue length bytes of storage for system exclusive data (a
+    //  power of 2, no more than 128 on AVR).  Set this up before anything
+    //  is pushed.
+    void setSysExBuffer(unsigned char *buffer, MidiQueueIndex length);
+
+    // Add a SYSEX message, with a copy of its data; returns false (and
+    //  counts an overflow) if there was no room for either.  Only call from
+    //  the pushing side.
+    bool pushSysEx(const MidiMessage &message, const unsigned char *data, unsigned int length);
+
+    // Data for the SYSEX message pulled last
+    const unsigned char *sysExData() const { return sysExData_; }
+    unsigned int sysExLength() const { return sysExLength_; }
+
+    // Finish with the data for the SYSEX message pulled last, so the space
+    //  can be used again (pull() does this too)
+    void releaseSysEx()
+    {
+        if (sysExUsed_) {
+            MIDI_QUEUE_RELEASE();
+            sysExTail_ = sysExTail_ + sysExUsed_;
+            sysExUsed_ = 0;
+        }
+    }
+
+    // Number of messages waiting
+    MidiQueueIndex count() const { return head_ - tail_; }
+
+    // Total number of messages that fit
+    MidiQueueIndex capacity() const { return mask_ + 1; }
+
+    MidiQueueIndex highWater() const { return highWater_; }
+    unsigned long overflows() const { return overflows_; }
+
+    // Clear the high water mark & overflow count.  This writes values
+    //  owned by the pushing side, so don't call it while it might be
+    //  pushing.
+    void resetStats();
+};
+
+
+inline bool MidiQueue::push(const MidiMessage &message)
+{
+    MidiQueueIndex head;
+    MidiQueueIndex used;
+
+
+    /* An unfinished system exclusive message has to be ended first */
+    if (sysExAbort_ && !pushAbort(message)) {
+        overflows_++;
+        return false;
+    }
+
+    head = head_;
+    used = head - tail_;
+    if (used > mask_) {
+        overflows_++;
+        return false;
+    }
+
+    messages_[head & mask_] = message;
+
+    /* The message has to be all the way in before the other side can see
+     *  that it's there
+     */
+    MIDI_QUEUE_RELEASE();
+    head_ = head + 1;
+
+    if (++used > highWater_) {
+        highWater_ = used;
+    }
+
+    return true;
+}
+
+
+inline bool MidiQueue::pull(MidiMessage *message)
+{
+    MidiQueueIndex tail = tail_;
+
+
+    if (tail == head_) {
+        return false;
+    }
+
+    /* Don't read the message until we know it's there, and don't give the
+     *  slot back until we're done reading it
+     */
+    releaseSysEx();
+
+    MIDI_QUEUE_ACQUIRE();
+    *message = messages_[tail & mask_];
+    if (message->type == MidiMessage::SYSEX) {
+        getSysEx();
+    }
+    MIDI_QUEUE_RELEASE();
+
+    tail_ = tail + 1;
+
+    return true;
+}
+
+#endif /* #ifndef MIDIQUEUE_H ... */
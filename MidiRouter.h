@@ -0,0 +1,373 @@
+/*
+ *  MidiRouter.h: Merges & routes messages between Midi instances
+ *
+ *             (c) 2003-2011 Tymm Twillman <tymmothy@gmail.com>
+ *
+ *  This file is part of Tymm's Arduino Midi Library.
+ *
+ *  Tymm's Arduino Midi Library is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation, either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  Tymm's Arduino Midi Library is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Tymm's Arduino Midi Library.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef MIDIROUTER_H
+#define MIDIROUTER_H
+
+#include "Midi.h"
+
+
+/*
+ * A MidiRouter passes the messages received by some Midi instances (its
+ *  inputs) on to others (its outputs), e.g. to make a merge box out of a
+ *  board with several serial ports.  Which messages go from each input to
+ *  each output is set with connect().  Inputs and outputs can be the same
+ *  Midi instances, and the inputs can still have handle functions of their
+ *  own.
+ *
+ * Messages are passed on whole, as each one is decoded, so messages from
+ *  different inputs are merged without ever getting mixed up with each
+ *  other; each output works out its own running status.  System exclusive
+ *  messages are passed on a piece at a time as they arrive (a piece being
+ *  as much as the input's SysEx buffer holds).  While one is going out
+ *  through an output, other messages for that output (apart from real time
+ *  messages, which are allowed in the middle of system exclusive data) are
+ *  held back until it's finished, in a queue of Held messages for each
+ *  output.  If that fills up, further messages are dropped and counted
+ *  (dropped()) -- except for NOTE OFFs and the channel mode messages
+ *  (controllers 120-127: all sound off, all notes off etc.), which would
+ *  leave notes stuck if they were lost.  One of those takes the place of
+ *  the oldest held message that isn't one of them, or if they all are,
+ *  the system exclusive message is cut off (ended with an
+ *  END_PROPRIETARY, the rest of it skipped, and counted in cutOff()) so
+ *  that everything held can go out.
+ *
+ * To get through without dropping anything, Held needs to be at least the
+ *  number of messages the other inputs can send while the longest system
+ *  exclusive message is going out; with everything at the same baud rate
+ *  that's about a third of its length in bytes (half, if the other inputs
+ *  use running status).
+ *
+ * Only one system exclusive message goes through an output at a time: one
+ *  that starts on another input while one is going out is dropped whole
+ *  (and counted in sysExDropped()).  System exclusive messages are only
+ *  seen at all from inputs that have been given a buffer for them with
+ *  setSysExBuffer(); the router has no way to pass on the ones an input
+ *  skips.
+ *
+ * Real time messages are never held back, so clock ticks go straight
+ *  through.
+ *
+ * Inputs and Outputs are the number of each (at most 16 outputs).  Each
+ *  input costs about 4 bytes per output plus a few more; each output about
+ *  4 bytes per held message plus a few more.
+ */
+
+template <unsigned int Inputs, unsigned int Outputs, unsigned int Held = 16>
+class MidiRouter {
+private:
+    // Adds itself as a listener to an input, so it sees everything the
+    //  input receives
+    class Input : public MidiListener {
+    public:
+        MidiRouter *router;
+        Midi *midi;
+        unsigned char index;
+
+        // Channels (bit 0 for channel 1) & system messages (bit n for
+        //  status 0xf0 + n) passed on to each output
+        unsigned int channels[Outputs];
+        unsigned int system[Outputs];
+
+        void midiReceived(const MidiMessage &message)
+        {
+            router->route(index, message);
+        }
+
+        void midiSysEx(const unsigned char *data, unsigned int length, unsigned int flags)
+        {
+            router->routeSysEx(index, data, length, flags);
+        }
+    };
+
+    struct Output {
+        Midi *midi;
+
+        // Input whose system exclusive message is going out (-1 if none)
+        int sysExInput;
+
+        MidiMessage held[Held];
+        unsigned int heldHead;
+        unsigned int heldCount;
+    };
+
+    Input inputs_[Inputs];
+    Output outputs_[Outputs];
+
+    unsigned long dropped_;
+    unsigned long sysExDropped_;
+    unsigned long cutOff_;
+
+#if MIDI_TIMESTAMPS
+    MidiClock clock_;
+    MidiTimingStats latency_;
+#endif
+
+    // Pass a message on through an output
+    void send(Output &out, const MidiMessage &message)
+    {
+        out.midi->send(message);
+
+#if MIDI_TIMESTAMPS
+        if (clock_) {
+            latency_.add(clock_() - message.time);
+        }
+#endif
+    }
+
+    // Send the messages held back while a system exclusive message went out
+    void release(Output &out)
+    {
+        while (out.heldCount && out.sysExInput < 0) {
+            send(out, out.held[out.heldHead]);
+            out.heldHead = (out.heldHead + 1) % Held;
+            out.heldCount--;
+        }
+    }
+
+    // Messages that can't be dropped without leaving notes stuck on
+    static bool essential(const MidiMessage &message)
+    {
+        return message.type == MidiMessage::NOTE_OFF
+               || (message.type == MidiMessage::CONTROL_CHANGE && message.data1 >= 120);
+    }
+
+    // Make room for an essential message in a full held queue, by dropping
+    //  the oldest held message that isn't essential, or failing that,
+    //  cutting off the system exclusive message and sending everything held
+    void makeRoom(Output &out)
+    {
+        unsigned int i;
+
+
+        for (i = 0; i < out.heldCount; i++) {
+            if (!essential(out.held[(out.heldHead + i) % Held])) {
+                break;
+            }
+        }
+
+        if (i < out.heldCount) {
+            /* Close up the gap, keeping the rest in order */
+            for (; i + 1 < out.heldCount; i++) {
+                out.held[(out.heldHead + i) % Held] = out.held[(out.heldHead + i + 1) % Held];
+            }
+            out.heldCount--;
+            dropped_++;
+            return;
+        }
+
+        /* The rest of the message is skipped, since its input no longer
+         *  matches sysExInput
+         */
+        out.midi->sendSysExChunk(0, 0, MidiMessage::SYSEX_ABORTED);
+        out.sysExInput = -1;
+        cutOff_++;
+        release(out);
+    }
+
+    void route(unsigned int input, const MidiMessage &message)
+    {
+        Input &in = inputs_[input];
+        unsigned int status = message.status;
+        unsigned int o;
+
+
+        for (o = 0; o < Outputs; o++) {
+            Output &out = outputs_[o];
+            unsigned int mask = status >= 0xf0 ? in.system[o] : in.channels[o];
+
+
+            if (!out.midi || !((mask >> (status & 0x0f)) & 0x01)) {
+                continue;
+            }
+
+            /* Only real time messages can go in the middle of system
+             *  exclusive data; everything else waits its turn
+             */
+            if (out.sysExInput >= 0 && status < STATUS_SYNC) {
+                if (out.heldCount == Held) {
+                    if (!essential(message)) {
+                        dropped_++;
+                        continue;
+                    }
+                    makeRoom(out);
+                }
+
+                if (out.sysExInput >= 0) {
+                    out.held[(out.heldHead + out.heldCount++) % Held] = message;
+                    continue;
+                }
+            }
+
+            send(out, message);
+        }
+    }
+
+    void routeSysEx(unsigned int input, const unsigned char *data, unsigned int length,
+                    unsigned int flags)
+    {
+        Input &in = inputs_[input];
+        unsigned int o;
+
+
+        for (o = 0; o < Outputs; o++) {
+            Output &out = outputs_[o];
+
+
+            if (!out.midi || !(in.system[o] & 0x01)) {
+                continue;
+            }
+
+            if (flags & MidiMessage::SYSEX_FIRST) {
+                /* Another input's message is still going out */
+                if (out.sysExInput >= 0) {
+                    sysExDropped_++;
+                    continue;
+                }
+                out.sysExInput = input;
+            } else if (out.sysExInput != (int)input) {
+                /* The rest of a message whose start was dropped */
+                continue;
+            }
+
+            out.midi->sendSysExChunk(data, length, flags);
+
+            if (flags & (MidiMessage::SYSEX_LAST | MidiMessage::SYSEX_ABORTED)) {
+                out.sysExInput = -1;
+                release(out);
+            }
+        }
+    }
+
+public:
+    MidiRouter() : dropped_(0), sysExDropped_(0), cutOff_(0)
+#if MIDI_TIMESTAMPS
+      , clock_(0)
+#endif
+    {
+        unsigned int i;
+        unsigned int o;
+
+
+        for (i = 0; i < Inputs; i++) {
+            inputs_[i].router = this;
+            inputs_[i].midi = 0;
+            inputs_[i].index = i;
+            for (o = 0; o < Outputs; o++) {
+                inputs_[i].channels[o] = 0;
+                inputs_[i].system[o] = 0;
+            }
+        }
+
+        for (o = 0; o < Outputs; o++) {
+            outputs_[o].midi = 0;
+            outputs_[o].sysExInput = -1;
+            outputs_[o].heldHead = 0;
+            outputs_[o].heldCount = 0;
+        }
+
+#if MIDI_TIMESTAMPS
+        latency_.reset();
+#endif
+    }
+
+    // Use midi as input number input (0 to Inputs - 1); the router adds
+    //  itself to midi's listeners
+    void setInput(unsigned int input, Midi &midi)
+    {
+        Input &in = inputs_[input];
+
+
+        if (in.midi) {
+            in.midi->removeListener(&in);
+        }
+        in.midi = &midi;
+        midi.addListener(&in);
+    }
+
+    // Use midi as output number output (0 to Outputs - 1)
+    void setOutput(unsigned int output, Midi &midi)
+    {
+        outputs_[output].midi = &midi;
+    }
+
+    // Pass channel messages from input to output for the channels set in
+    //  channels (bit 0 for channel 1), and system messages with status
+    //  0xf0 + n if bit n of system is set.  Nothing is connected to start
+    //  with.
+    void connect(unsigned int input, unsigned int output,
+                 unsigned int channels = 0xffff, unsigned int system = 0xffff)
+    {
+        inputs_[input].channels[output] = channels;
+        inputs_[input].system[output] = system;
+    }
+
+    void disconnect(unsigned int input, unsigned int output)
+    {
+        connect(input, output, 0, 0);
+    }
+
+    // Read from all of the inputs, passing what comes in on to the
+    //  outputs.  (Calling poll() on the inputs directly does the same.)
+    void poll()
+    {
+        for (unsigned int i = 0; i < Inputs; i++) {
+            if (inputs_[i].midi) {
+                inputs_[i].midi->poll();
+            }
+        }
+    }
+
+    // Send everything that's waiting in the outputs' send buffers
+    void flush()
+    {
+        for (unsigned int o = 0; o < Outputs; o++) {
+            if (outputs_[o].midi) {
+                outputs_[o].midi->flush();
+            }
+        }
+    }
+
+    // Messages dropped because an output's held queue was full, system
+    //  exclusive messages dropped because an output was busy with another
+    //  input's, and system exclusive messages cut off to let an essential
+    //  message through
+    unsigned long dropped() const { return dropped_; }
+    unsigned long sysExDropped() const { return sysExDropped_; }
+    unsigned long cutOff() const { return cutOff_; }
+
+    // Number of messages held back for an output
+    unsigned int held(unsigned int output) const { return outputs_[output].heldCount; }
+
+#if MIDI_TIMESTAMPS
+    // With a clock (the same one the inputs use), the router keeps track of
+    //  how long messages take from the start of arriving at an input to
+    //  being sent by an output (including any time spent held back), so
+    //  the worst case added by each hop is latencyStats().max
+    void setClock(MidiClock clock) { clock_ = clock; }
+    const MidiTimingStats &latencyStats() const { return latency_; }
+    void resetLatencyStats() { latency_.reset(); }
+#endif
+};
+
+#endif /* #ifndef MIDIROUTER_H ... */
@@ -0,0 +1,185 @@
+/*  MidiScheduler.cpp: Holds outgoing messages until the time they're due
+ *
+ *             (c) 2003-2011 Tymm Twillman <tymmothy@gmail.com>
+ *
+ *  This file is part of Tymm's Arduino Midi Library.
+ *
+ *  Tymm's Arduino Midi Library is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation, either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  Tymm's Arduino Midi Library is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Tymm's Arduino Midi Library.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+#include "MidiScheduler.h"
+
+
+// Whether event a goes out before event b
+static inline bool before(const MidiScheduledEvent &a, const MidiScheduledEvent &b)
+{
+    long difference = (long)(a.time - b.time);
+
+
+    if (difference) {
+        return difference < 0;
+    }
+
+    return (int)(a.sequence - b.sequence) < 0;
+}
+
+
+// Whether an event is due by now
+static inline bool due(const MidiScheduledEvent &event, unsigned long now)
+{
+    return (long)(now - event.time) >= 0;
+}
+
+
+// Add an event, moving it up the heap past any that go out after it
+bool MidiScheduler::Heap::push(const MidiScheduledEvent &event)
+{
+    unsigned int i;
+    unsigned int parent;
+
+
+    if (count == size) {
+        return false;
+    }
+
+    for (i = count++; i; i = parent) {
+        parent = (i - 1) / 2;
+        if (!before(event, events[parent])) {
+            break;
+        }
+        events[i] = events[parent];
+    }
+
+    events[i] = event;
+
+    return true;
+}
+
+
+// Remove the first event, moving the last one down from the top to fill
+//  the gap
+void MidiScheduler::Heap::pop()
+{
+    const MidiScheduledEvent &last = events[--count];
+    unsigned int i = 0;
+    unsigned int child;
+
+
+    while ((child = i * 2 + 1) < count) {
+        if (child + 1 < count && before(events[child + 1], events[child])) {
+            child++;
+        }
+        if (!before(events[child], last)) {
+            break;
+        }
+        events[i] = events[child];
+        i = child;
+    }
+
+    events[i] = last;
+}
+
+
+MidiScheduler::MidiScheduler(MidiScheduledEvent *storage, unsigned int size,
+                             unsigned int realTimeSize)
+{
+    if (realTimeSize > size) {
+        realTimeSize = size;
+    }
+
+    realTimeHeap_.events = storage;
+    realTimeHeap_.size = realTimeSize;
+    heap_.events = storage + realTimeSize;
+    heap_.size = size - realTimeSize;
+
+    clear();
+}
+
+
+void MidiScheduler::clear(void)
+{
+    heap_.count = 0;
+    realTimeHeap_.count = 0;
+    sequence_ = 0;
+    overflows_ = 0;
+}
+
+
+bool MidiScheduler::schedule(const MidiMessage &message, unsigned long time)
+{
+    MidiScheduledEvent event;
+    Heap *heap = &heap_;
+
+
+    /* System exclusive data doesn't fit in a MidiMessage */
+    if (message.status == STATUS_START_PROPRIETARY
+      || message.status == STATUS_END_PROPRIETARY)
+    {
+        return false;
+    }
+
+    event.time = time;
+    event.sequence = sequence_++;
+    event.message = message;
+
+    if (message.status >= STATUS_SYNC && realTimeHeap_.size) {
+        heap = &realTimeHeap_;
+    }
+
+    if (!heap->push(event)) {
+        overflows_++;
+        return false;
+    }
+
+    return true;
+}
+
+
+bool MidiScheduler::next(unsigned long now, MidiMessage *message)
+{
+    Heap *heap;
+
+
+    if (realTimeHeap_.count && due(realTimeHeap_.events[0], now)) {
+        heap = &realTimeHeap_;
+    } else if (heap_.count && due(heap_.events[0], now)) {
+        heap = &heap_;
+    } else {
+        return false;
+    }
+
+    *message = heap->events[0].message;
+    heap->pop();
+
+    return true;
+}
+
+
+bool MidiScheduler::nextTime(unsigned long *time) const
+{
+    if (!heap_.count && !realTimeHeap_.count) {
+        return false;
+    }
+
+    if (!heap_.count
+      || (realTimeHeap_.count && before(realTimeHeap_.events[0], heap_.events[0])))
+    {
+        *time = realTimeHeap_.events[0].time;
+    } else {
+        *time = heap_.events[0].time;
+    }
+
+    return true;
+}
@@ -0,0 +1,122 @@
+/*
+ *  MidiScheduler.h: Holds outgoing messages until the time they're due
+ *
+ *             (c) 2003-2011 Tymm Twillman <tymmothy@gmail.com>
+ *
+ *  This file is part of Tymm's Arduino Midi Library.
+ *
+ *  Tymm's Arduino Midi Library is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation, either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  Tymm's Arduino Midi Library is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Tymm's Arduino Midi Library.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MIDISCHEDULER_H
+#define MIDISCHEDULER_H
+
+#include "MidiParser.h"
+
+
+// A message waiting to be sent, and when
+struct MidiScheduledEvent {
+    unsigned long time;
+
+    // Order the event was scheduled in, so that events due at the same
+    //  time go out in the order they were scheduled
+    unsigned int sequence;
+
+    MidiMessage message;
+};
+
+
+/*
+ * A MidiScheduler lets messages be queued up to go out at given times
+ *  (e.g. a note off a beat after its note on), and then sends them from
+ *  service(), which should be called every time through loop().  Nothing
+ *  ever waits.
+ *
+ * Messages are kept in binary heaps (in storage given by the user), so
+ *  adding one or sending one takes time proportional to log2 of the number
+ *  waiting.  Real time messages (clock etc.) are kept in a separate, smaller
+ *  heap and always go out ahead of other messages that are due, since
+ *  they're the ones that suffer most from being late.
+ *
+ * Times are in whatever units the clock used to give them is in (e.g.
+ *  micros()); they can wrap around, as long as nothing is scheduled more
+ *  than half the range of an unsigned long ahead.
+ */
+
+class MidiScheduler {
+private:
+    struct Heap {
+        MidiScheduledEvent *events;
+        unsigned int size;
+        unsigned int count;
+
+        bool push(const MidiScheduledEvent &event);
+        void pop();
+    };
+
+    // Channel & system common messages, and real time messages
+    Heap heap_;
+    Heap realTimeHeap_;
+
+    unsigned int sequence_;
+    unsigned long overflows_;
+
+public:
+    // storage holds room for size events; realTimeSize of those are set
+    //  aside for real time messages (if it's 0, real time messages go in
+    //  with everything else, and don't get to jump ahead).
+    MidiScheduler(MidiScheduledEvent *storage, unsigned int size,
+                  unsigned int realTimeSize = 0);
+
+    // Arrange for message to be sent at time (or as soon after as
+    //  service() is called).  Returns false (and counts an overflow) if
+    //  there's no room.  SYSEX messages can't be scheduled.
+    bool schedule(const MidiMessage &message, unsigned long time);
+
+    // Take the next message that's due by now out of the scheduler; returns
+    //  false if none are due.  Real time messages come out first.
+    bool next(unsigned long now, MidiMessage *message);
+
+    // The time the next message is due (returns false if there aren't any)
+    bool nextTime(unsigned long *time) const;
+
+    // Send everything that's due by now through out (a Midi or StaticMidi
+    //  instance, or anything else with a send(const MidiMessage &)), or at
+    //  most maxMessages of it if that's not 0, so that a pile of messages
+    //  due at once can't hold things up for too long.  Returns the number
+    //  of messages sent.
+    template <class Output>
+    unsigned int service(Output &out, unsigned long now, unsigned int maxMessages = 0)
+    {
+        MidiMessage message;
+        unsigned int sent = 0;
+
+
+        while ((!maxMessages || sent < maxMessages) && next(now, &message)) {
+            out.send(message);
+            sent++;
+        }
+
+        return sent;
+    }
+
+    // Throw away everything waiting
+    void clear();
+
+    unsigned int count() const { return heap_.count + realTimeHeap_.count; }
+    unsigned long overflows() const { return overflows_; }
+};
+
+#endif /* #ifndef MIDISCHEDULER_H ... */
@@ -0,0 +1,152 @@
+/*  MidiSysEx.cpp: Packing 8-bit data into 7-bit MIDI data bytes & back
+ *
+ *             (c) 2003-2011 Tymm Twillman <tymmothy@gmail.com>
+ *
+ *  This file is part of Tymm's Arduino Midi Library.
+ *
+ *  Tymm's Arduino Midi Library is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation, either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  Tymm's Arduino Midi Library is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Tymm's Arduino Midi Library.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "MidiSysEx.h"
+
+
+// Whether whole groups can be done in a 64-bit word
+#if !defined(__AVR__) && defined(__SIZEOF_LONG_LONG__) \
+  && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define MIDI_SYSEX_WORDS 1
+#else
+#define MIDI_SYSEX_WORDS 0
+#endif
+
+
+// Pack a group of up to 7 bytes; returns the number of bytes stored
+static unsigned int packGroup(const unsigned char *data, unsigned int length,
+                              unsigned char *out)
+{
+    unsigned char high = 0;
+    unsigned int i;
+
+
+    for (i = 0; i < length; i++) {
+        high |= (data[i] >> 7) << (6 - i);
+        out[i + 1] = data[i] & 0x7f;
+    }
+
+    out[0] = high;
+
+    return length + 1;
+}
+
+
+// Unpack a group of up to 8 bytes (including the top bits); returns the
+//  number of bytes stored
+static unsigned int unpackGroup(const unsigned char *data, unsigned int length,
+                                unsigned char *out)
+{
+    unsigned char high = data[0];
+    unsigned int i;
+
+
+    for (i = 0; i + 1 < length; i++) {
+        out[i] = (data[i + 1] & 0x7f) | (((high >> (6 - i)) & 1) << 7);
+    }
+
+    return length - 1;
+}
+
+
+unsigned int midiSysExPack(const unsigned char *data, unsigned int length,
+                           unsigned char *out)
+{
+    unsigned char *start = out;
+
+
+    for ( ; length >= 7; length -= 7, data += 7, out += 8) {
+#if MIDI_SYSEX_WORDS
+        unsigned long long word = 0;
+        unsigned long long high;
+
+
+        /* Whole words are quicker to load, when there's a byte to spare */
+        if (length > 7) {
+            memcpy(&word, data, 8);
+        } else {
+            memcpy(&word, data, 7);
+        }
+
+        /* Gather the top bit of each byte (bit 8n + 7 for byte n) into bit
+         *  62 - n of the product, then shift them down to bits 6-0
+         */
+        high = (word >> 7) & 0x0001010101010101ULL;
+        high = ((high * 0x4020100804020100ULL) >> 56) & 0x7f;
+
+        word = ((word & 0x007f7f7f7f7f7f7fULL) << 8) | high;
+        memcpy(out, &word, 8);
+#else
+        packGroup(data, 7, out);
+#endif
+    }
+
+    if (length) {
+        out += packGroup(data, length, out);
+    }
+
+    return out - start;
+}
+
+
+unsigned int midiSysExUnpack(const unsigned char *data, unsigned int length,
+                             unsigned char *out)
+{
+    unsigned char *start = out;
+
+
+    for ( ; length >= 8; length -= 8, data += 8, out += 7) {
+#if MIDI_SYSEX_WORDS
+        unsigned long long word;
+        unsigned long long high;
+
+
+        memcpy(&word, data, 8);
+
+        /* Copy the top bits byte into every byte, keep bit 6 - n in byte n,
+         *  and turn each one that's set into 0x80
+         */
+        high = (word & 0x7f) * 0x0101010101010101ULL;
+        high &= 0x0001020408102040ULL;
+        high = (high + 0x007f7f7f7f7f7f7fULL) & 0x0080808080808080ULL;
+
+        /* The 8th byte stored gets overwritten by the next group, if
+         *  there is one
+         */
+        word = ((word >> 8) & 0x007f7f7f7f7f7f7fULL) | high;
+        if (length >= 16) {
+            memcpy(out, &word, 8);
+        } else {
+            memcpy(out, &word, 7);
+        }
+#else
+        unpackGroup(data, 8, out);
+#endif
+    }
+
+    if (length > 1) {
+        out += unpackGroup(data, length, out);
+    }
+
+    return out - start;
+}
@@ -0,0 +1,72 @@
+/*
+ *  MidiSysEx.h: Helpers for sending & receiving system exclusive data --
+ *               packing 8-bit data into 7-bit MIDI data bytes & back
+ *
+ *             (c) 2003-2011 Tymm Twillman <tymmothy@gmail.com>
+ *
+ *  This file is part of Tymm's Arduino Midi Library.
+ *
+ *  Tymm's Arduino Midi Library is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation, either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  Tymm's Arduino Midi Library is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Tymm's Arduino Midi Library.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MIDISYSEX_H
+#define MIDISYSEX_H
+
+
+// Called by Midi::sendSysEx() to get the next piece of a system exclusive
+//  message to send: fill in up to size bytes at buffer (all with the top bit
+//  clear) and return how many there were, or 0 when there's no more.
+//  context is whatever was passed to sendSysEx().
+typedef unsigned int (*MidiSysExSource)(unsigned char *buffer, unsigned int size,
+                                        void *context);
+
+
+/*
+ * System exclusive data bytes can only hold 7 bits, so 8-bit data (firmware,
+ *  samples etc.) is usually sent packed: each group of 7 bytes goes out as 8,
+ *  with the first holding the top bits of the other 7 (the top bit of the
+ *  first byte of the group in bit 6, the next in bit 5 and so on), and the
+ *  rest holding the low 7 bits of each byte.  A short group at the end
+ *  takes one more byte than it has data.
+ *
+ * Whole groups are done a group at a time; on 64-bit little-endian hosts all
+ *  7 bytes of a group are handled at once in a single word.
+ */
+
+// Number of bytes length bytes of data take up once packed
+inline unsigned int midiSysExPackedLength(unsigned int length)
+{
+    return (length / 7) * 8 + (length % 7 ? length % 7 + 1 : 0);
+}
+
+// Number of bytes length packed bytes unpack to
+inline unsigned int midiSysExUnpackedLength(unsigned int length)
+{
+    return (length / 8) * 7 + (length % 8 ? length % 8 - 1 : 0);
+}
+
+// Pack length bytes of data into out (which must have room for
+//  midiSysExPackedLength(length) bytes).  Returns the number of bytes
+//  stored in out.
+unsigned int midiSysExPack(const unsigned char *data, unsigned int length,
+                           unsigned char *out);
+
+// Unpack length bytes of packed data into out (which must have room for
+//  midiSysExUnpackedLength(length) bytes).  Returns the number of bytes
+//  stored in out.
+unsigned int midiSysExUnpack(const unsigned char *data, unsigned int length,
+                             unsigned char *out);
+
+#endif /* #ifndef MIDISYSEX_H ... */
@@ -0,0 +1,74 @@
+/*
+ *  MidiTiming.h: Clock source & timing statistics used by the Midi library
+ *
+ *             (c) 2003-2011 Tymm Twillman <tymmothy@gmail.com>
+ *
+ *  This file is part of Tymm's Arduino Midi Library.
+ *
+ *  Tymm's Arduino Midi Library is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation, either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  Tymm's Arduino Midi Library is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Tymm's Arduino Midi Library.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MIDITIMING_H
+#define MIDITIMING_H
+
+
+// A function returning the current time, in whatever units suit (on an
+//  Arduino, micros() works well).  Times are only ever subtracted from each
+//  other, so it's fine for the count to wrap around.
+typedef unsigned long (*MidiClock)(void);
+
+
+// Running statistics for a series of time intervals: how many there have
+//  been, the shortest & longest, and a running average that follows
+//  recent values (each new value counts for 1/16 of it).
+struct MidiTimingStats {
+    unsigned long count;
+    unsigned long min;
+    unsigned long max;
+
+    // The running average, times 16 (so small values don't get rounded
+    //  away)
+    unsigned long average16;
+
+    void reset()
+    {
+        count = 0;
+        min = 0;
+        max = 0;
+        average16 = 0;
+    }
+
+    void add(unsigned long value)
+    {
+        if (!count++) {
+            min = max = value;
+            average16 = value << 4;
+            return;
+        }
+
+        if (value < min) {
+            min = value;
+        }
+        if (value > max) {
+            max = value;
+        }
+
+        average16 += value - (average16 >> 4);
+    }
+
+    unsigned long average() const { return average16 >> 4; }
+};
+
+#endif /* #ifndef MIDITIMING_H ... */
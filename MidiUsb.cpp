@@ -0,0 +1,200 @@
+/*  MidiUsb.cpp: Converts between MIDI bytes and USB-MIDI event packets
+ *
+ *             (c) 2003-2011 Tymm Twillman <tymmothy@gmail.com>
+ *
+ *  This file is part of Tymm's Arduino Midi Library.
+ *
+ *  Tymm's Arduino Midi Library is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation, either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  Tymm's Arduino Midi Library is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Tymm's Arduino Midi Library.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+#include "MidiParser.h"
+#include "MidiUsb.h"
+
+
+// Number of MIDI bytes in a packet with each code index number (0 for the
+//  reserved ones)
+static const unsigned char CIN_LENGTH[16] = {
+    0, 0, 2, 3, 3, 1, 2, 3,
+    3, 3, 3, 3, 2, 2, 3, 1
+};
+
+// Code index number for the end of a system exclusive message, by the
+//  number of bytes in the last packet
+static const unsigned char SYSEX_END_CIN[4] = {
+    0, MIDI_USB_CIN_SINGLE, MIDI_USB_CIN_SYSEX_END_2, MIDI_USB_CIN_SYSEX_END_3
+};
+
+
+unsigned int midiUsbDecode(const unsigned char *packets, unsigned int length,
+                           unsigned int cable, unsigned char *out)
+{
+    const unsigned char *end = packets + (length & ~(MIDI_USB_PACKET_SIZE - 1));
+    unsigned char *p = out;
+
+
+    cable <<= 4;
+
+    /* All 3 bytes are copied every time, and the output only moves on by
+     *  the number that are really there
+     */
+    for (; packets != end; packets += MIDI_USB_PACKET_SIZE) {
+        if ((packets[0] & 0xf0) == cable) {
+            p[0] = packets[1];
+            p[1] = packets[2];
+            p[2] = packets[3];
+            p += CIN_LENGTH[packets[0] & 0x0f];
+        }
+    }
+
+    return p - out;
+}
+
+
+MidiUsbEncoder::MidiUsbEncoder(unsigned char *frame, unsigned int size, MidiUsbSink sink,
+                               void *context, unsigned int cable)
+  : frame_(frame), frameSize_(size & ~(MIDI_USB_PACKET_SIZE - 1)),
+    sink_(sink), context_(context)
+{
+    setCable(cable);
+    reset();
+}
+
+
+void MidiUsbEncoder::reset()
+{
+    used_ = 0;
+    status_ = 0;
+    runningStatus_ = 0;
+    count_ = 0;
+    length_ = 0;
+}
+
+
+void MidiUsbEncoder::flush()
+{
+    if (used_) {
+        sink_(frame_, used_, context_);
+        used_ = 0;
+    }
+}
+
+
+inline void MidiUsbEncoder::packet(unsigned char cin, unsigned char b1,
+                                   unsigned char b2, unsigned char b3)
+{
+    unsigned char *p = frame_ + used_;
+
+
+    p[0] = cable_ | cin;
+    p[1] = b1;
+    p[2] = b2;
+    p[3] = b3;
+
+    used_ += MIDI_USB_PACKET_SIZE;
+    if (used_ >= frameSize_) {
+        flush();
+    }
+}
+
+
+// Send whatever system exclusive data has been collected as the last piece
+//  of the message (a status byte other than 0xF7 cut it off, so there's no
+//  0xF7 to go with it)
+void MidiUsbEncoder::endSysEx()
+{
+    if (count_) {
+        packet(SYSEX_END_CIN[count_], bytes_[0],
+               count_ > 1 ? bytes_[1] : 0, count_ > 2 ? bytes_[2] : 0);
+    }
+
+    status_ = 0;
+    count_ = 0;
+}
+
+
+void MidiUsbEncoder::encode(const unsigned char *data, unsigned int length)
+{
+    unsigned char value;
+
+
+    while (length--) {
+        value = *data++;
+
+        /* Real time messages go straight out, whatever else is going on */
+        if (value >= STATUS_SYNC) {
+            packet(MIDI_USB_CIN_BYTE, value, 0, 0);
+            continue;
+        }
+
+        if (value & 0x80) {
+            if (status_ == STATUS_START_PROPRIETARY) {
+                if (value == STATUS_END_PROPRIETARY) {
+                    bytes_[count_++] = value;
+                }
+                endSysEx();
+            }
+
+            if (value == STATUS_END_PROPRIETARY) {
+                continue;
+            }
+
+            /* System messages cancel running status */
+            status_ = value;
+            runningStatus_ = value < 0xf0 ? value : 0;
+            bytes_[0] = value;
+            count_ = 1;
+            length_ = MidiParser::messageLength(value);
+
+            /* Tune request (and the undefined ones) has no data */
+            if (value != STATUS_START_PROPRIETARY && length_ == 1) {
+                packet(MIDI_USB_CIN_SINGLE, value, 0, 0);
+                status_ = 0;
+            }
+            continue;
+        }
+
+        if (status_ == STATUS_START_PROPRIETARY) {
+            bytes_[count_++] = value;
+            if (count_ == 3) {
+                packet(MIDI_USB_CIN_SYSEX, bytes_[0], bytes_[1], bytes_[2]);
+                count_ = 0;
+            }
+            continue;
+        }
+
+        if (!status_) {
+            /* A data byte with nothing to go with it is dropped */
+            if (!runningStatus_) {
+                continue;
+            }
+            status_ = bytes_[0] = runningStatus_;
+            count_ = 1;
+            length_ = MidiParser::messageLength(status_);
+        }
+
+        bytes_[count_++] = value;
+
+        if (count_ == length_) {
+            if (status_ < 0xf0) {
+                packet(status_ >> 4, status_, bytes_[1], length_ == 3 ? bytes_[2] : 0);
+                count_ = 1;
+            } else {
+                packet(length_ == 2 ? MIDI_USB_CIN_COMMON_2 : MIDI_USB_CIN_COMMON_3,
+                       status_, bytes_[1], length_ == 3 ? bytes_[2] : 0);
+                status_ = 0;
+            }
+        }
+    }
+}
@@ -0,0 +1,171 @@
+/*
+ *  MidiUsb.h: Converts between MIDI bytes and USB-MIDI event packets
+ *
+ *             (c) 2003-2011 Tymm Twillman <tymmothy@gmail.com>
+ *
+ *  This file is part of Tymm's Arduino Midi Library.
+ *
+ *  Tymm's Arduino Midi Library is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation, either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  Tymm's Arduino Midi Library is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Tymm's Arduino Midi Library.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef MIDIUSB_H
+#define MIDIUSB_H
+
+
+/*
+ * USB-MIDI devices move MIDI around in 4 byte event packets: the first byte
+ *  has the cable number (which of up to 16 virtual MIDI ports on the one
+ *  USB connection the packet is for) in its top 4 bits and a code index
+ *  number (CIN, saying what kind of packet it is) in the bottom 4, and the
+ *  other 3 hold a whole message (or 3 bytes of a system exclusive message),
+ *  padded with zeros.  Packets are sent & received a frame at a time, as
+ *  many as fit in the endpoint's packet size (64 bytes, or 16 event
+ *  packets, for a full speed bulk endpoint).
+ *
+ * Every packet carries its own status byte, so turning packets back into
+ *  bytes doesn't need to remember anything from one packet to the next;
+ *  midiUsbDecode() does a frame at a time.  Going the other way needs to
+ *  keep track of partial messages, running status & system exclusive data,
+ *  which a MidiUsbEncoder does.
+ */
+
+// Code index numbers
+enum {
+    MIDI_USB_CIN_MISC          = 0x0,
+    MIDI_USB_CIN_CABLE_EVENT   = 0x1,
+    MIDI_USB_CIN_COMMON_2      = 0x2,    // 2 byte system common message
+    MIDI_USB_CIN_COMMON_3      = 0x3,    // 3 byte system common message
+    MIDI_USB_CIN_SYSEX         = 0x4,    // system exclusive starts or carries on
+    MIDI_USB_CIN_SINGLE        = 0x5,    // 1 byte system common, or SysEx ends with 1 byte
+    MIDI_USB_CIN_SYSEX_END_2   = 0x6,
+    MIDI_USB_CIN_SYSEX_END_3   = 0x7,
+    MIDI_USB_CIN_NOTE_OFF      = 0x8,    // 0x8 - 0xE are the channel message status
+    MIDI_USB_CIN_PITCH_CHANGE  = 0xE,    //  (top 4 bits)
+    MIDI_USB_CIN_BYTE          = 0xF     // a single byte (real time messages)
+};
+
+// Size of an event packet, and of a full speed bulk endpoint's frame
+static const unsigned int MIDI_USB_PACKET_SIZE = 4;
+static const unsigned int MIDI_USB_FRAME_SIZE = 64;
+
+
+// Called by a MidiUsbEncoder with a frame full of packets to send (length
+//  bytes, a multiple of 4).  context is whatever was given to the encoder.
+typedef void (*MidiUsbSink)(const unsigned char *packets, unsigned int length, void *context);
+
+
+// Take the MIDI bytes out of length bytes of packets, for the packets on
+//  cable (0-15); packets for other cables, and reserved ones, are skipped.
+//  out needs room for 3 bytes per packet.  Returns the number of bytes
+//  stored in out.
+unsigned int midiUsbDecode(const unsigned char *packets, unsigned int length,
+                           unsigned int cable, unsigned char *out);
+
+// Decode packets a frame at a time & feed the bytes on cable into midi (a
+//  Midi or StaticMidi instance, or anything else with a
+//  receive(const unsigned char *, unsigned int)).  Returns the number of
+//  bytes fed in.
+template <class Target>
+unsigned long midiUsbReceive(const unsigned char *packets, unsigned long length,
+                             Target &midi, unsigned int cable = 0)
+{
+    unsigned char bytes[MIDI_USB_FRAME_SIZE / MIDI_USB_PACKET_SIZE * 3];
+    unsigned int frame;
+    unsigned int count;
+    unsigned long total = 0;
+
+
+    while (length) {
+        frame = length > MIDI_USB_FRAME_SIZE ? MIDI_USB_FRAME_SIZE : length;
+        count = midiUsbDecode(packets, frame, cable, bytes);
+        if (count) {
+            midi.receive(bytes, count);
+            total += count;
+        }
+        packets += frame;
+        length -= frame;
+    }
+
+    return total;
+}
+
+
+/*
+ * A MidiUsbEncoder takes the bytes a Midi instance sends and packs them
+ *  into event packets for one cable, collecting them in a frame buffer
+ *  that's handed to a MidiUsbSink whenever it fills up (and by flush()).
+ *  Running status is filled back in, system exclusive messages are split
+ *  into 3 byte pieces, and real time messages get a packet of their own
+ *  straight away, even in the middle of another message.
+ *
+ * To use it as a Midi instance's output, override sendByte() & sendBytes()
+ *  to call encode(), e.g.
+ *
+ *   class UsbMidi : public Midi {
+ *   public:
+ *       MidiUsbEncoder usb;
+ *       ...
+ *       void sendByte(unsigned char b) { usb.encode(&b, 1); }
+ *       void sendBytes(const unsigned char *d, unsigned int n) { usb.encode(d, n); }
+ *   };
+ */
+
+class MidiUsbEncoder {
+private:
+    unsigned char *frame_;
+    unsigned int frameSize_;
+    unsigned int used_;
+
+    MidiUsbSink sink_;
+    void *context_;
+
+    unsigned char cable_;
+
+    // The message being put together: its status (0 if none), the running
+    //  status for channel messages, the bytes so far (SysEx data is
+    //  collected 3 at a time), and how many bytes make it complete
+    unsigned char status_;
+    unsigned char runningStatus_;
+    unsigned char bytes_[3];
+    unsigned char count_;
+    unsigned char length_;
+
+    void packet(unsigned char cin, unsigned char b1, unsigned char b2, unsigned char b3);
+    void endSysEx();
+
+public:
+    // frame holds size bytes (a multiple of 4; MIDI_USB_FRAME_SIZE for a
+    //  full speed device); sink is called with each full frame
+    MidiUsbEncoder(unsigned char *frame, unsigned int size, MidiUsbSink sink,
+                   void *context = 0, unsigned int cable = 0);
+
+    // Cable number (0-15) for the packets
+    void setCable(unsigned int cable) { cable_ = (cable & 0x0f) << 4; }
+
+    // Pack MIDI bytes into packets
+    void encode(const unsigned char *data, unsigned int length);
+
+    // Hand over the packets in the frame so far, if there are any
+    void flush();
+
+    // Forget any partly sent message, and any packets not handed over yet
+    void reset();
+
+    // Bytes of packets waiting in the frame
+    unsigned int pending() const { return used_; }
+};
+
+#endif /* #ifndef MIDIUSB_H ... */
@@ -0,0 +1,586 @@
+/*
+ *  StaticMidi.h: Template version of the Midi class, with handlers picked at
+ *                compile time instead of through virtual functions
+ *
+ *             (c) 2003-2011 Tymm Twillman <tymmothy@gmail.com>
+ *
+ *  This file is part of Tymm's Arduino Midi Library.
+ *
+ *  Tymm's Arduino Midi Library is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation, either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  Tymm's Arduino Midi Library is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Tymm's Arduino Midi Library.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STATICMIDI_H
+#define STATICMIDI_H
+
+#include "HardwareSerial.h"
+#include "MidiParser.h"
+#include "MidiSysEx.h"
+#include "MidiTiming.h"
+
+
+/*
+ * StaticMidi works just like the Midi class, and decodes exactly the same way
+ *  (they share MidiParser), but instead of overriding virtual functions you
+ *  pass your own class in as a template parameter:
+ *
+ *   class MyMidi : public StaticMidi<MyMidi> {
+ *     public:
+ *
+ *     MyMidi(HardwareSerial &s) : StaticMidi<MyMidi>(s) {}
+ *
+ *     void handleNoteOn(unsigned int channel, unsigned int note, unsigned int velocity)
+ *     {
+ *         if (note == 40) {digitalWrite(13, HIGH); }
+ *     }
+ *   };
+ *
+ *   MyMidi midi(Serial);
+ *
+ * Since the compiler knows exactly which handler gets called for each message
+ *  type, handlers you don't define (the empty defaults below) compile away to
+ *  nothing, and the ones you do define can be inlined into the receive loop.
+ *  That makes for smaller & faster code, at the cost of not being able to
+ *  swap handlers at run time.
+ *
+ * The second template parameter is the type of the port to talk to; anything
+ *  with begin(baud), read() (returning -1 when there's nothing to read),
+ *  write(byte) and write(data, length) (for system exclusive data, as in
+ *  Arduino's Print class) will do.  Unlike Midi, the port isn't copied,
+ *  just referred to, so it has to stay around as long as the StaticMidi
+ *  does.
+ */
+
+template <class Derived, class Transport = HardwareSerial>
+class StaticMidi {
+protected:
+    // The port used by this instance
+    Transport &transport_;
+
+    // Keeps track of partial Midi messages as bytes come in, and which
+    //  channel this instance receives data for
+    MidiParser parser_;
+
+    // Where the time comes from (0 if nowhere)
+    MidiClock clock_;
+
+    // Most messages, and longest time (in clock units), one poll()
+    //  handles before leaving the rest for next time (0 for no limit)
+    unsigned int pollMessages_;
+    unsigned long pollTime_;
+
+#if MIDI_TIMESTAMPS
+    // Time the message being handled arrived
+    unsigned long messageTime_;
+#endif
+
+    // Whether every message gets a status byte, and the last status byte
+    //  sent (for running status) -- same as in the Midi class
+    bool sendFullCommands_;
+    int lastStatusSent_;
+
+    Derived &derived() { return *static_cast<Derived *>(this); }
+
+    // Everything sent goes through these
+    void writeByte(unsigned char value)
+    {
+        MIDI_STAT(parser_.stats().bytesSent++);
+        transport_.write(value);
+    }
+    void writeBytes(const unsigned char *data, unsigned int length)
+    {
+        MIDI_STAT(parser_.stats().bytesSent += length);
+        transport_.write(data, length);
+    }
+
+    void sendChannelMessage(unsigned char status, unsigned char data1,
+                            unsigned char data2, unsigned int length);
+    void sendSystemMessage(unsigned char status, unsigned char data1,
+                           unsigned char data2, unsigned int length);
+
+    // Whether a poll() that started at start has handled as much as it's
+    //  allowed to, with received messages so far
+    bool pollDone(unsigned int received, unsigned long start);
+
+public:
+    // These match the parameters in the Midi class
+    static const unsigned int PARAM_SEND_FULL_COMMANDS = 0x1000;
+    static const unsigned int PARAM_CHANNEL_IN         = 0x1001;
+
+    StaticMidi(Transport &transport)
+      : transport_(transport), clock_(0), pollMessages_(0), pollTime_(0),
+#if MIDI_TIMESTAMPS
+        messageTime_(0),
+#endif
+        sendFullCommands_(false), lastStatusSent_(0) {}
+
+    void begin(unsigned int channel = 0, unsigned long baud = 31250)
+    {
+        parser_.setChannel(channel);
+        transport_.begin(baud);
+    }
+
+    void setParam(unsigned int param, unsigned int val);
+    unsigned int getParam(unsigned int param);
+
+    // Receive filters; these match the ones in the Midi class
+    void setChannelFilter(unsigned int status, unsigned int channels)
+    {
+        parser_.setChannelFilter(status, channels);
+    }
+
+    unsigned int channelFilter(unsigned int status) const { return parser_.channelFilter(status); }
+    void setSystemFilter(unsigned int mask) { parser_.setSystemFilter(mask); }
+    unsigned int systemFilter() const { return parser_.systemFilter(); }
+
+    // Read everything available from the port (up to the poll limits) &
+    //  handle it, between handleBatchStart() & handleBatchEnd() (if there
+    //  was anything)
+    void poll()
+    {
+        unsigned int received = 0;
+        unsigned long start = 0;
+        int c;
+
+
+        if ((c = transport_.read()) == -1) {
+            return;
+        }
+
+        if (pollTime_ && clock_) {
+            start = clock_();
+        }
+
+        /* The limits are only looked at as each message finishes, and in
+         *  pollDone(), so the receive loop stays small enough for the
+         *  parser to be inlined into it
+         */
+        derived().handleBatchStart();
+        do {
+            if (recvByte(c) && (pollMessages_ || pollTime_) && pollDone(++received, start)) {
+                break;
+            }
+        } while ((c = transport_.read()) != -1);
+        derived().handleBatchEnd();
+    }
+
+    // Same as Midi::setPollLimits(); maxTime needs a clock (see setClock())
+    void setPollLimits(unsigned int maxMessages, unsigned long maxTime = 0)
+    {
+        pollMessages_ = maxMessages;
+        pollTime_ = maxTime;
+    }
+
+    // Same as Midi::receive()
+    void receive(const unsigned char *data, unsigned int length)
+    {
+        if (!length) {
+            return;
+        }
+
+        derived().handleBatchStart();
+        while (length--) {
+            recvByte(*data++);
+        }
+        derived().handleBatchEnd();
+    }
+
+    // Handle a single received byte; returns true if it finished a message
+    bool recvByte(unsigned char value)
+    {
+        MidiMessage message;
+
+
+#if MIDI_TIMESTAMPS
+        if (clock_) {
+            parser_.setTime(clock_());
+        }
+#endif
+
+        if (!parser_.parse(value, &message)) {
+            return false;
+        }
+
+        dispatch(message);
+        return true;
+    }
+
+    // Same as Midi::setClock(); with MIDI_TIMESTAMPS turned on, the clock
+    //  is called for every byte received
+    void setClock(MidiClock clock) { clock_ = clock; }
+
+#if MIDI_TIMESTAMPS
+    // Same as Midi::messageTime() (there are no latency or jitter stats)
+    unsigned long messageTime() const { return messageTime_; }
+#endif
+
+    // Same as the Midi system exclusive functions
+    void setSysExBuffer(unsigned char *buffer, unsigned int size)
+    {
+        parser_.setSysExBuffer(buffer, size);
+    }
+    void setSysExFilter(const unsigned char *prefix, unsigned int length)
+    {
+        parser_.setSysExFilter(prefix, length);
+    }
+    const unsigned char *sysExData() const { return parser_.sysExData(); }
+    unsigned int sysExLength() const { return parser_.sysExLength(); }
+
+#if MIDI_STATS
+    // Same as the Midi statistics functions (except there's no longestPoll)
+    MidiStats stats() const { return parser_.stats(); }
+    void resetStats() { parser_.stats().reset(); }
+#endif
+
+    // Same as Midi::decode()
+    unsigned int decode(const unsigned char *data, unsigned int length,
+                        MidiMessage *messages, unsigned int maxMessages,
+                        unsigned int *bytesUsed = 0);
+
+    // Call the matching handler for a decoded message (or array of them)
+    void dispatch(const MidiMessage &message);
+    void dispatch(const MidiMessage *messages, unsigned int count)
+    {
+        while (count--) {
+            dispatch(*messages++);
+        }
+    }
+
+    // Same as the Midi send functions
+    void send(const MidiMessage &message);
+
+    void sendNoteOff(unsigned int channel, unsigned int note, unsigned int velocity)
+    {
+        sendChannelMessage(STATUS_EVENT_NOTE_OFF | ((channel - 1) & 0x0f),
+                           note & 0x7f, velocity & 0x7f, 3);
+    }
+
+    void sendNoteOn(unsigned int channel, unsigned int note, unsigned int velocity)
+    {
+        sendChannelMessage(STATUS_EVENT_NOTE_ON | ((channel - 1) & 0x0f),
+                           note & 0x7f, velocity & 0x7f, 3);
+    }
+
+    void sendVelocityChange(unsigned int channel, unsigned int note, unsigned int velocity)
+    {
+        sendChannelMessage(STATUS_EVENT_VELOCITY_CHANGE | ((channel - 1) & 0x0f),
+                           note & 0x7f, velocity & 0x7f, 3);
+    }
+
+    void sendControlChange(unsigned int channel, unsigned int controller, unsigned int value)
+    {
+        sendChannelMessage(STATUS_EVENT_CONTROL_CHANGE | ((channel - 1) & 0x0f),
+                           controller & 0x7f, value & 0x7f, 3);
+    }
+
+    void sendProgramChange(unsigned int channel, unsigned int program)
+    {
+        sendChannelMessage(STATUS_EVENT_PROGRAM_CHANGE | ((channel - 1) & 0x0f),
+                           program & 0x7f, 0, 2);
+    }
+
+    void sendAfterTouch(unsigned int channel, unsigned int velocity)
+    {
+        sendChannelMessage(STATUS_AFTER_TOUCH | ((channel - 1) & 0x0f),
+                           velocity & 0x7f, 0, 2);
+    }
+
+    void sendPitchBend(unsigned int channel, unsigned int bend)
+    {
+        sendChannelMessage(STATUS_PITCH_CHANGE | ((channel - 1) & 0x0f),
+                           bend & 0x7f, (bend >> 7) & 0x7f, 3);
+    }
+
+    void sendPitchChange(unsigned int pitch) { sendPitchBend(1, pitch); }
+
+    void sendTimeCode(unsigned int value)
+    {
+        sendSystemMessage(STATUS_TIME_CODE, value & 0x7f, 0, 2);
+    }
+
+    void sendSongPosition(unsigned int position)
+    {
+        sendSystemMessage(STATUS_SONG_POSITION, position & 0x7f, (position >> 7) & 0x7f, 3);
+    }
+
+    void sendSongSelect(unsigned int song)
+    {
+        sendSystemMessage(STATUS_SONG_SELECT, song & 0x7f, 0, 2);
+    }
+
+    void sendTuneRequest(void) { sendSystemMessage(STATUS_TUNE_REQUEST, 0, 0, 1); }
+    void sendSync(void) { writeByte(STATUS_SYNC); }
+    void sendStart(void) { writeByte(STATUS_START); }
+    void sendContinue(void) { writeByte(STATUS_CONTINUE); }
+    void sendStop(void) { writeByte(STATUS_STOP); }
+    void sendActiveSense(void) { writeByte(STATUS_ACTIVE_SENSE); }
+    void sendReset(void) { sendSystemMessage(STATUS_RESET, 0, 0, 1); }
+
+    void sendSysEx(const unsigned char *data, unsigned int length)
+    {
+        sendSystemMessage(STATUS_START_PROPRIETARY, 0, 0, 1);
+        writeBytes(data, length);
+        writeByte(STATUS_END_PROPRIETARY);
+    }
+    void sendSysEx(MidiSysExSource source, void *context);
+
+    void sendSysExChunk(const unsigned char *data, unsigned int length, unsigned int flags)
+    {
+        if (flags & MidiMessage::SYSEX_FIRST) {
+            sendSystemMessage(STATUS_START_PROPRIETARY, 0, 0, 1);
+        }
+        writeBytes(data, length);
+        if (flags & (MidiMessage::SYSEX_LAST | MidiMessage::SYSEX_ABORTED)) {
+            writeByte(STATUS_END_PROPRIETARY);
+        }
+    }
+
+    // Define any of these in your class to have them called when the matching
+    //  message type comes in; the ones you leave out do nothing.
+    void handleNoteOff(unsigned int channel, unsigned int note, unsigned int velocity) {}
+    void handleNoteOn(unsigned int channel, unsigned int note, unsigned int velocity) {}
+    void handleVelocityChange(unsigned int channel, unsigned int note, unsigned int velocity) {}
+    void handleControlChange(unsigned int channel, unsigned int controller, unsigned int value) {}
+    void handleProgramChange(unsigned int channel, unsigned int program) {}
+    void handleAfterTouch(unsigned int channel, unsigned int velocity) {}
+    void handlePitchBend(unsigned int channel, unsigned int bend) { derived().handlePitchChange(bend); }
+    void handlePitchChange(unsigned int pitch) {}
+    void handleTimeCode(unsigned int value) {}
+    void handleSongPosition(unsigned int position) {}
+    void handleSongSelect(unsigned int song) {}
+    void handleTuneRequest(void) {}
+    void handleSync(void) {}
+    void handleStart(void) {}
+    void handleContinue(void) {}
+    void handleStop(void) {}
+    void handleActiveSense(void) {}
+    void handleReset(void) {}
+    void handleSysEx(const unsigned char *data, unsigned int length, unsigned int flags) {}
+    void handleBatchStart(void) {}
+    void handleBatchEnd(void) {}
+};
+
+
+template <class Derived, class Transport>
+void StaticMidi<Derived, Transport>::setParam(unsigned int param, unsigned int val)
+{
+    if (param == PARAM_SEND_FULL_COMMANDS) {
+        sendFullCommands_ = val ? true : false;
+    } else if (param == PARAM_CHANNEL_IN) {
+        parser_.setChannel(val);
+    }
+}
+
+
+template <class Derived, class Transport>
+unsigned int StaticMidi<Derived, Transport>::getParam(unsigned int param)
+{
+    if (param == PARAM_SEND_FULL_COMMANDS) {
+        return sendFullCommands_;
+    } else if (param == PARAM_CHANNEL_IN) {
+        return parser_.channel();
+    }
+
+    return 0;
+}
+
+
+template <class Derived, class Transport>
+bool StaticMidi<Derived, Transport>::pollDone(unsigned int received, unsigned long start)
+{
+    return (pollMessages_ && received >= pollMessages_)
+        || (pollTime_ && clock_ && clock_() - start >= pollTime_);
+}
+
+
+template <class Derived, class Transport>
+unsigned int StaticMidi<Derived, Transport>::decode(const unsigned char *data, unsigned int length,
+                                                    MidiMessage *messages, unsigned int maxMessages,
+                                                    unsigned int *bytesUsed)
+{
+    const unsigned char *p = data;
+    const unsigned char *end = data + length;
+    unsigned int count = 0;
+
+
+#if MIDI_TIMESTAMPS
+    /* The whole block arrived at once */
+    if (clock_) {
+        parser_.setTime(clock_());
+    }
+#endif
+
+    while (p != end && count != maxMessages) {
+        if (parser_.parse(*p++, &messages[count])) {
+            if (messages[count++].type == MidiMessage::SYSEX) {
+                break;
+            }
+        }
+    }
+
+    if (bytesUsed) {
+        *bytesUsed = p - data;
+    }
+
+    return count;
+}
+
+
+// Same as Midi::dispatch(), except the handlers are found at compile time
+template <class Derived, class Transport>
+void StaticMidi<Derived, Transport>::dispatch(const MidiMessage &message)
+{
+    unsigned int channel = (message.status & 0x0f) + 1;
+
+
+#if MIDI_TIMESTAMPS
+    messageTime_ = message.time;
+#endif
+
+    /* The parser has already worked out which handler this goes to (and
+     *  turned NOTE ONs with velocity 0 into NOTE OFFs)
+     */
+    switch (message.type) {
+        case MidiMessage::NOTE_OFF:
+            derived().handleNoteOff(channel, message.data1, message.data2);
+            break;
+        case MidiMessage::NOTE_ON:
+            derived().handleNoteOn(channel, message.data1, message.data2);
+            break;
+        case MidiMessage::VELOCITY_CHANGE:
+            derived().handleVelocityChange(channel, message.data1, message.data2);
+            break;
+        case MidiMessage::CONTROL_CHANGE:
+            derived().handleControlChange(channel, message.data1, message.data2);
+            break;
+        case MidiMessage::PROGRAM_CHANGE:
+            derived().handleProgramChange(channel, message.data1);
+            break;
+        case MidiMessage::AFTER_TOUCH:
+            derived().handleAfterTouch(channel, message.data1);
+            break;
+        case MidiMessage::PITCH_CHANGE:
+            derived().handlePitchBend(channel, (message.data2 << 7) | message.data1);
+            break;
+        case MidiMessage::TIME_CODE:
+            derived().handleTimeCode(message.data1);
+            break;
+        case MidiMessage::SONG_POSITION:
+            derived().handleSongPosition((message.data2 << 7) | message.data1);
+            break;
+        case MidiMessage::SONG_SELECT:
+            derived().handleSongSelect(message.data1);
+            break;
+        case MidiMessage::TUNE_REQUEST:
+            derived().handleTuneRequest();
+            break;
+        case MidiMessage::SYNC:
+            derived().handleSync();
+            break;
+        case MidiMessage::START:
+            derived().handleStart();
+            break;
+        case MidiMessage::CONTINUE:
+            derived().handleContinue();
+            break;
+        case MidiMessage::STOP:
+            derived().handleStop();
+            break;
+        case MidiMessage::ACTIVE_SENSE:
+            derived().handleActiveSense();
+            break;
+        case MidiMessage::RESET:
+            derived().handleReset();
+            break;
+        case MidiMessage::SYSEX:
+            derived().handleSysEx(parser_.sysExData(), parser_.sysExLength(), message.data1);
+            break;
+    }
+}
+
+
+// Send a channel message, leaving off the status byte if running status
+//  allows it
+template <class Derived, class Transport>
+void StaticMidi<Derived, Transport>::sendChannelMessage(unsigned char status, unsigned char data1,
+                                                        unsigned char data2, unsigned int length)
+{
+    if (sendFullCommands_ || (lastStatusSent_ != status)) {
+        writeByte(status);
+        lastStatusSent_ = status;
+    }
+
+    writeByte(data1);
+    if (length == 3) {
+        writeByte(data2);
+    }
+}
+
+
+// Send a system common message (or reset); these cancel running status
+template <class Derived, class Transport>
+void StaticMidi<Derived, Transport>::sendSystemMessage(unsigned char status, unsigned char data1,
+                                                       unsigned char data2, unsigned int length)
+{
+    lastStatusSent_ = 0;
+
+    writeByte(status);
+    if (length > 1) {
+        writeByte(data1);
+    }
+    if (length > 2) {
+        writeByte(data2);
+    }
+}
+
+
+template <class Derived, class Transport>
+void StaticMidi<Derived, Transport>::sendSysEx(MidiSysExSource source, void *context)
+{
+    unsigned char chunk[16];
+    unsigned int length;
+
+
+    sendSystemMessage(STATUS_START_PROPRIETARY, 0, 0, 1);
+
+    while ((length = source(chunk, sizeof(chunk), context))) {
+        writeBytes(chunk, length);
+    }
+
+    writeByte(STATUS_END_PROPRIETARY);
+}
+
+
+template <class Derived, class Transport>
+void StaticMidi<Derived, Transport>::send(const MidiMessage &message)
+{
+    unsigned int length;
+
+
+    if (!(message.status & 0x80)) {
+        return;
+    }
+
+    length = MidiParser::messageLength(message.status);
+
+    if (message.status < 0xf0) {
+        sendChannelMessage(message.status, message.data1, message.data2, length);
+    } else if (message.status >= STATUS_SYNC && message.status != STATUS_RESET) {
+        writeByte(message.status);
+    } else {
+        sendSystemMessage(message.status, message.data1, message.data2, length);
+    }
+}
+
+#endif /* #ifndef STATICMIDI_H ... */
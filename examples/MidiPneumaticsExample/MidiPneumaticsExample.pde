@@ -27,7 +27,7 @@
 class MyMidi : public Midi {
   public:
   
-  MyMidi(HardwareSerial &s) : Midi(s) {}
+  MyMidi(HardwareSerial &s) : Midi(s), dirty(false) {}
   
   void handleNoteOn(unsigned int channel, unsigned int note, unsigned int velocity)
   {
@@ -37,9 +37,9 @@ class MyMidi : public Midi {
     // set the pin corresponding to the note high (open the valve); the 
     //  note & 31 bit is to limit the pin # from 0-31 since otherwise
     //  with a high note we could end up writing memory that's outside
-    //  the array
+    //  the array.  The shift registers get loaded at the end of the batch.
     tpic6b595_set((note & 31), HIGH);
-    tpic6b595_load();
+    dirty = true;
   }
 
   void handleNoteOff(unsigned int channel, unsigned int note, unsigned int velocity)
@@ -49,8 +49,23 @@ class MyMidi : public Midi {
     
     digitalWrite(13, LOW);
     tpic6b595_set((note & 31), LOW);
-    tpic6b595_load();
+    dirty = true;
   }
+
+  void handleBatchEnd(void)
+  {
+    // Called once all the messages read by this poll() have been handled, so
+    //  a chord only shifts all 32 bits out once instead of once per note
+    if (dirty) {
+      tpic6b595_load();
+      dirty = false;
+    }
+  }
+
+  private:
+
+  // Whether any of the outputs have changed since they were last loaded
+  bool dirty;
 };
 
 
@@ -122,6 +137,11 @@ void setup()
   pinMode(13, OUTPUT);
   tpic6b595_init();
   midi.begin(0, 115200);
+
+  // Don't spend more than 2ms at a time handling notes, so a flood of them
+  //  can't hold the valves up for long (the rest waits for the next poll())
+  midi.setClock(micros);
+  midi.setPollLimits(0, 2000);
   
   tpic6b595_load();
 }
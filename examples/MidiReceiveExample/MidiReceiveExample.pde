@@ -49,6 +49,7 @@ class MyMidi : public Midi {
     void handleProgramChange(unsigned int channel, unsigned int program);
     void handleAfterTouch(unsigned int channel, unsigned int velocity);
     void handlePitchChange(unsigned int pitch);
+    void handleTimeCode(unsigned int value);
     void handleSongPosition(unsigned int position);
     void handleSongSelect(unsigned int song);
     void handleTuneRequest(void);
@@ -58,6 +59,7 @@ class MyMidi : public Midi {
     void handleStop(void);
     void handleActiveSense(void);
     void handleReset(void);
+    void handleSysEx(const unsigned char *data, unsigned int length, unsigned int flags);
 */
 };
 
@@ -0,0 +1,144 @@
+/*  HardwareSerial.cpp: Stand-in for the Arduino serial port, for building the
+ *                      Midi library on a regular (Linux) host
+ *
+ *             (c) 2003-2011 Tymm Twillman <tymmothy@gmail.com>
+ *
+ *  This file is part of Tymm's Arduino Midi Library.
+ *
+ *  Tymm's Arduino Midi Library is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation, either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  Tymm's Arduino Midi Library is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Tymm's Arduino Midi Library.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+#include "HardwareSerial.h"
+
+
+// Backing store for the default port; nothing to read & nowhere to write
+//  until someone calls setInput() / setOutput() on it
+static host_serial_buffer serialBuffer;
+
+HardwareSerial Serial(&serialBuffer);
+
+
+HardwareSerial::HardwareSerial(host_serial_buffer *buffer) : buffer_(buffer)
+{
+}
+
+
+void HardwareSerial::begin(long baud)
+{
+    buffer_->baud = baud;
+}
+
+
+void HardwareSerial::end()
+{
+}
+
+
+int HardwareSerial::available(void)
+{
+    return buffer_->rxLength - buffer_->rxPos;
+}
+
+
+int HardwareSerial::peek(void)
+{
+    if (buffer_->rxPos == buffer_->rxLength) {
+        return -1;
+    }
+
+    return buffer_->rx[buffer_->rxPos];
+}
+
+
+int HardwareSerial::read(void)
+{
+    if (buffer_->rxPos == buffer_->rxLength) {
+        return -1;
+    }
+
+    return buffer_->rx[buffer_->rxPos++];
+}
+
+
+// Arduino's flush() throws away anything waiting to be read
+void HardwareSerial::flush(void)
+{
+    buffer_->rxPos = buffer_->rxLength;
+}
+
+
+void HardwareSerial::write(uint8_t c)
+{
+    buffer_->txTotal++;
+
+    if (!buffer_->txSize) {
+        return;
+    }
+
+    if (buffer_->txPos == buffer_->txSize) {
+        buffer_->txPos = 0;
+    }
+
+    buffer_->tx[buffer_->txPos++] = c;
+}
+
+
+void HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+    while (size--) {
+        write(*buffer++);
+    }
+}
+
+
+void HardwareSerial::setInput(const unsigned char *data, unsigned long length)
+{
+    buffer_->rx = data;
+    buffer_->rxLength = length;
+    buffer_->rxPos = 0;
+}
+
+
+void HardwareSerial::setOutput(unsigned char *data, unsigned long size)
+{
+    buffer_->tx = data;
+    buffer_->txSize = size;
+    clearOutput();
+}
+
+
+const unsigned char *HardwareSerial::output(void)
+{
+    return buffer_->tx;
+}
+
+
+unsigned long HardwareSerial::outputLength(void)
+{
+    return buffer_->txPos;
+}
+
+
+unsigned long HardwareSerial::outputTotal(void)
+{
+    return buffer_->txTotal;
+}
+
+
+void HardwareSerial::clearOutput(void)
+{
+    buffer_->txPos = 0;
+    buffer_->txTotal = 0;
+}
@@ -0,0 +1,98 @@
+/*
+ *  HardwareSerial.h: Stand-in for the Arduino serial port, for building the
+ *                    Midi library on a regular (Linux) host
+ *
+ *             (c) 2003-2011 Tymm Twillman <tymmothy@gmail.com>
+ *
+ *  This file is part of Tymm's Arduino Midi Library.
+ *
+ *  Tymm's Arduino Midi Library is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation, either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  Tymm's Arduino Midi Library is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Tymm's Arduino Midi Library.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HARDWARESERIAL_H
+#define HARDWARESERIAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/*
+ * This is only used when building on a host machine (see host/Makefile); on
+ *  an Arduino the real HardwareSerial.h from the core is used instead.
+ *
+ * Instead of talking to a UART, the port reads from a block of memory handed
+ *  to it with setInput(), and anything written to it goes into an output
+ *  buffer handed to it with setOutput().  When the output buffer fills up it
+ *  just starts over at the beginning (the total count of bytes written keeps
+ *  going up though), so it can be used for long-running benchmarks without
+ *  needing huge amounts of memory.
+ *
+ * Like the Arduino version, the actual buffers live outside the object and
+ *  the object just points at them, so copies of a port (e.g. the one the
+ *  Midi class keeps) all see the same data.
+ */
+
+// Where the data for a host serial port lives
+struct host_serial_buffer {
+    const unsigned char *rx;
+    unsigned long rxLength;
+    unsigned long rxPos;
+
+    unsigned char *tx;
+    unsigned long txSize;
+    unsigned long txPos;
+    unsigned long txTotal;
+
+    unsigned long baud;
+};
+
+
+class HardwareSerial {
+private:
+    host_serial_buffer *buffer_;
+
+public:
+    HardwareSerial(host_serial_buffer *buffer);
+
+    // Same as the Arduino versions
+    void begin(long baud);
+    void end();
+    int available(void);
+    int peek(void);
+    int read(void);
+    void flush(void);
+    void write(uint8_t c);
+    void write(const uint8_t *buffer, size_t size);
+
+    // Host-only: set the data that will be returned by read() (the data isn't
+    //  copied, so needs to stay around until it's all been read)
+    void setInput(const unsigned char *data, unsigned long length);
+
+    // Host-only: set where data given to write() ends up
+    void setOutput(unsigned char *data, unsigned long size);
+
+    // Host-only: get at what's been written since the last setOutput() or
+    //  clearOutput() call
+    const unsigned char *output(void);
+    unsigned long outputLength(void);
+    unsigned long outputTotal(void);
+    void clearOutput(void);
+};
+
+
+// Like the Arduino, there is always a default port available
+extern HardwareSerial Serial;
+
+#endif /* #ifndef HARDWARESERIAL_H ... */
@@ -0,0 +1,2246 @@
+/*  MidiBench.cpp: Throughput benchmarks for the Midi library, host version
+ *
+ *             (c) 2003-2011 Tymm Twillman <tymmothy@gmail.com>
+ *
+ *  This file is part of Tymm's Arduino Midi Library.
+ *
+ *  Tymm's Arduino Midi Library is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation, either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  Tymm's Arduino Midi Library is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Tymm's Arduino Midi Library.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Pushes MIDI byte streams through poll() & decode() and calls the send
+ *  functions over and over, for both the Midi & StaticMidi classes, reporting
+ *  how fast it all goes.
+ *
+ *  Usage: midibench [capture file | MIDI file ...]
+ *
+ *  Each capture file given is a raw dump of MIDI bytes as they came off the
+ *  wire; they are benchmarked along with the built-in streams.  Files whose
+ *  names end in .mid are Standard MIDI Files instead, which are mapped into
+ *  memory and played.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "HardwareSerial.h"
+#include "Midi.h"
+#include "MidiCapture.h"
+#include "MidiClockTracker.h"
+#include "MidiCoalescer.h"
+#include "MidiControllers.h"
+#include "MidiFilePlayer.h"
+#include "MidiFileRecorder.h"
+#include "MidiMpe.h"
+#include "MidiNoteTracker.h"
+#include "MidiRouter.h"
+#include "MidiScheduler.h"
+#include "MidiUsb.h"
+#include "StaticMidi.h"
+
+
+// Each benchmark is repeated until it has run for at least this long
+static const double MIN_BENCH_SECONDS = 0.25;
+
+// Size of the built-in streams
+static const unsigned long STREAM_BYTES = 256 * 1024;
+
+// Number of messages decoded at a time by the decode() benchmarks
+static const unsigned int DECODE_BATCH = 256;
+
+// Size of the buffer system exclusive data is collected in
+static const unsigned int SYSEX_BUFFER = 256;
+
+// Number of messages sent per round of a send benchmark
+static const unsigned long SEND_MESSAGES = 64 * 1024;
+
+
+/******************************************************************************
+ *
+ * Timing & reporting
+ *
+ *****************************************************************************/
+
+
+static double now(void)
+{
+    struct timespec ts;
+
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+#if MIDI_TIMESTAMPS
+// Clock for timestamping messages, in nanoseconds
+static unsigned long benchClock(void)
+{
+    struct timespec ts;
+
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+#endif
+
+
+static void printHeader(const char *what)
+{
+    printf("\n%-24s %12s %12s %10s %10s %9s\n",
+      what, "bytes", "messages", "MB/s", "Mmsg/s", "ns/msg");
+}
+
+
+static void printResult(const char *name, double bytes, double messages, double seconds)
+{
+    printf("%-24s %12.0f %12.0f %10.2f %10.2f %9.2f\n",
+      name, bytes, messages,
+      bytes / seconds / 1e6,
+      messages / seconds / 1e6,
+      messages ? (seconds * 1e9 / messages) : 0.0);
+}
+
+
+/******************************************************************************
+ *
+ * Receive side
+ *
+ *****************************************************************************/
+
+
+// Handlers that count every call, so there's something to report (and so
+//  none of the work can be optimized away).  The same set is used for both
+//  the Midi & StaticMidi versions.
+#define BENCH_HANDLERS \
+    unsigned long messages; \
+    unsigned long checksum; \
+    \
+    void handleNoteOff(unsigned int channel, unsigned int note, unsigned int velocity) \
+    { messages++; checksum += channel + note + velocity; } \
+    void handleNoteOn(unsigned int channel, unsigned int note, unsigned int velocity) \
+    { messages++; checksum += channel + note + velocity; } \
+    void handleVelocityChange(unsigned int channel, unsigned int note, unsigned int velocity) \
+    { messages++; checksum += channel + note + velocity; } \
+    void handleControlChange(unsigned int channel, unsigned int controller, unsigned int value) \
+    { messages++; checksum += channel + controller + value; } \
+    void handleProgramChange(unsigned int channel, unsigned int program) \
+    { messages++; checksum += channel + program; } \
+    void handleAfterTouch(unsigned int channel, unsigned int velocity) \
+    { messages++; checksum += channel + velocity; } \
+    void handlePitchChange(unsigned int pitch) { messages++; checksum += pitch; } \
+    void handleSongPosition(unsigned int position) { messages++; checksum += position; } \
+    void handleSongSelect(unsigned int song) { messages++; checksum += song; } \
+    void handleTuneRequest(void) { messages++; } \
+    void handleSync(void) { messages++; } \
+    void handleStart(void) { messages++; } \
+    void handleContinue(void) { messages++; } \
+    void handleStop(void) { messages++; } \
+    void handleActiveSense(void) { messages++; } \
+    void handleReset(void) { messages++; } \
+    void handleSysEx(const unsigned char *data, unsigned int length, unsigned int flags) \
+    { messages++; checksum += length; } \
+    \
+    unsigned char sysEx[SYSEX_BUFFER];
+
+
+class BenchMidi : public Midi {
+public:
+    BenchMidi(HardwareSerial &s) : Midi(s), messages(0), checksum(0)
+    {
+        setSysExBuffer(sysEx, sizeof(sysEx));
+    }
+
+    BENCH_HANDLERS
+};
+
+
+class BenchStaticMidi : public StaticMidi<BenchStaticMidi> {
+public:
+    BenchStaticMidi(HardwareSerial &s)
+      : StaticMidi<BenchStaticMidi>(s), messages(0), checksum(0)
+    {
+        setSysExBuffer(sysEx, sizeof(sysEx));
+    }
+
+    BENCH_HANDLERS
+};
+
+
+// A stream of MIDI bytes to feed through the parser
+struct BenchStream {
+    const char *name;
+    unsigned char *data;
+    unsigned long length;
+};
+
+
+// Something like a patch dump: 1K system exclusive messages, with clock ticks
+//  mixed in (built a byte at a time)
+static unsigned int buildSysEx(unsigned long n, unsigned char *out)
+{
+    switch (n % 1024) {
+        case 0:
+            out[0] = 0xf0;
+            out[1] = 0x41;
+            return 2;
+        case 1023:
+            out[0] = 0xf7;
+            return 1;
+    }
+
+    if (n % 64 == 32) {
+        out[0] = 0xf8;
+        out[1] = n & 0x7f;
+        return 2;
+    }
+
+    out[0] = n & 0x7f;
+
+    return 1;
+}
+
+
+// Streams are built by calling this over & over with a message number; it
+//  fills in the bytes for that message & returns how many there were
+typedef unsigned int (*StreamBuilder)(unsigned long n, unsigned char *out);
+
+
+static unsigned int buildNotes(unsigned long n, unsigned char *out)
+{
+    out[0] = (n & 1) ? 0x80 : 0x90;
+    out[1] = (n >> 1) & 0x7f;
+    out[2] = (n & 1) ? 0 : 100;
+
+    return 3;
+}
+
+
+// Note ons, with note offs sent as velocity 0 note ons, all after a single
+//  status byte
+static unsigned int buildNotesRunning(unsigned long n, unsigned char *out)
+{
+    if (n == 0) {
+        out[0] = 0x90;
+        out[1] = 60;
+        out[2] = 100;
+        return 3;
+    }
+
+    out[0] = (n >> 1) & 0x7f;
+    out[1] = (n & 1) ? 0 : 100;
+
+    return 2;
+}
+
+
+// A fader sweep -- one status byte then a long stream of values
+static unsigned int buildControlSweep(unsigned long n, unsigned char *out)
+{
+    unsigned int i = 0;
+
+
+    if (n == 0) {
+        out[i++] = 0xb0;
+    }
+
+    out[i++] = 7;
+    out[i++] = n & 0x7f;
+
+    return i;
+}
+
+
+static unsigned int buildClock(unsigned long n, unsigned char *out)
+{
+    out[0] = 0xf8;
+
+    return 1;
+}
+
+
+static unsigned int buildPitch(unsigned long n, unsigned char *out)
+{
+    out[0] = 0xe0;
+    out[1] = n & 0x7f;
+    out[2] = (n >> 7) & 0x7f;
+
+    return 3;
+}
+
+
+static unsigned int buildProgram(unsigned long n, unsigned char *out)
+{
+    out[0] = 0xc0 | (n & 0x0f);
+    out[1] = n & 0x7f;
+
+    return 2;
+}
+
+
+// Something like what a busy link looks like: clock ticks mixed in with
+//  notes across channels and runs of CC's & aftertouch
+static unsigned int buildMixed(unsigned long n, unsigned char *out)
+{
+    switch (n % 8) {
+        case 0:
+        case 4:
+            return buildClock(n, out);
+        case 1:
+            out[0] = 0x90 | ((n >> 3) & 0x0f);
+            out[1] = (n >> 3) & 0x7f;
+            out[2] = 90;
+            return 3;
+        case 2:
+            out[0] = 0xb0 | ((n >> 3) & 0x0f);
+            out[1] = 1;
+            out[2] = n & 0x7f;
+            return 3;
+        case 3:
+            out[0] = 1;
+            out[1] = (n + 1) & 0x7f;
+            return 2;
+        case 5:
+            out[0] = 0xd0 | ((n >> 3) & 0x0f);
+            out[1] = n & 0x7f;
+            return 2;
+        case 6:
+            return buildPitch(n, out);
+        default:
+            out[0] = 0x80 | ((n >> 3) & 0x0f);
+            out[1] = (n >> 3) & 0x7f;
+            out[2] = 0;
+            return 3;
+    }
+}
+
+
+static BenchStream makeStream(const char *name, StreamBuilder build)
+{
+    BenchStream s;
+    unsigned char msg[8];
+    unsigned long n;
+    unsigned int len;
+
+
+    s.name = name;
+    s.data = (unsigned char *)malloc(STREAM_BYTES);
+    s.length = 0;
+
+    for (n = 0; ; n++) {
+        len = build(n, msg);
+        if (s.length + len > STREAM_BYTES) {
+            break;
+        }
+        memcpy(s.data + s.length, msg, len);
+        s.length += len;
+    }
+
+    return s;
+}
+
+
+static bool loadStream(const char *path, BenchStream *s)
+{
+    FILE *f;
+    long size;
+
+
+    if ((f = fopen(path, "rb")) == NULL) {
+        perror(path);
+        return false;
+    }
+
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    s->name = path;
+    s->data = (unsigned char *)malloc(size ? size : 1);
+    s->length = fread(s->data, 1, size, f);
+
+    fclose(f);
+
+    return true;
+}
+
+
+// Run a stream through poll() until enough time has gone by to get a
+//  decent measurement; if filtered, only NOTE ON / OFF on channel 1 are
+//  let through
+template <class BenchType>
+static void benchReceive(const char *name, const BenchStream &s, bool filtered = false)
+{
+    host_serial_buffer buf;
+    HardwareSerial port(&buf);
+    BenchType midi(port);
+    double start, elapsed;
+    double bytes = 0;
+
+
+    memset(&buf, 0, sizeof(buf));
+    midi.begin(0);
+#if MIDI_TIMESTAMPS
+    midi.setClock(benchClock);
+#endif
+
+    if (filtered) {
+        midi.setChannelFilter(0, 0);
+        midi.setChannelFilter(STATUS_EVENT_NOTE_ON, 0x0001);
+        midi.setChannelFilter(STATUS_EVENT_NOTE_OFF, 0x0001);
+        midi.setSystemFilter(0);
+    }
+
+    start = now();
+    do {
+        port.setInput(s.data, s.length);
+        midi.poll();
+        bytes += s.length;
+        elapsed = now() - start;
+    } while (elapsed < MIN_BENCH_SECONDS);
+
+    printResult(name, bytes, midi.messages, elapsed);
+
+#if MIDI_STATS
+    MidiStats stats = midi.stats();
+
+    printf("    orphan bytes %lu, truncated %lu, sysex overflows %lu\n",
+      stats.orphanBytes, stats.truncatedMessages, stats.sysExOverflows);
+#endif
+}
+
+
+// Run a stream through decode() in blocks, optionally handing each batch of
+//  decoded messages on to dispatch()
+template <class BenchType>
+static void benchDecode(const char *name, const BenchStream &s, bool dispatch)
+{
+    host_serial_buffer buf;
+    HardwareSerial port(&buf);
+    BenchType midi(port);
+    MidiMessage messages[DECODE_BATCH];
+    double start, elapsed;
+    double bytes = 0;
+    double decoded = 0;
+    unsigned int used;
+    unsigned int count;
+    unsigned long pos;
+
+
+    memset(&buf, 0, sizeof(buf));
+    midi.begin(0);
+
+    start = now();
+    do {
+        for (pos = 0; pos < s.length; pos += used) {
+            count = midi.decode(s.data + pos, s.length - pos,
+                                messages, DECODE_BATCH, &used);
+            if (dispatch) {
+                midi.dispatch(messages, count);
+            }
+            decoded += count;
+        }
+        bytes += s.length;
+        elapsed = now() - start;
+    } while (elapsed < MIN_BENCH_SECONDS);
+
+    printResult(name, bytes, decoded, elapsed);
+}
+
+
+// Size of the queue used by the queued benchmarks, and how much of the
+//  stream is handed to poll() at a time (no more than the queue can hold,
+//  since every byte could be a message)
+static const unsigned int QUEUE_SIZE = 256;
+static const unsigned int QUEUE_CHUNK = 64;
+
+// Size of the queue's copy of system exclusive data: enough for a full
+//  queue of pieces, if most of them are short
+static const unsigned int QUEUE_SYSEX = 16384;
+
+
+// State shared between the two threads of the threaded queue benchmark
+struct QueueBench {
+    const BenchStream *stream;
+    BenchMidi *midi;
+    HardwareSerial *port;
+    MidiQueue *queue;
+    volatile bool done;
+};
+
+
+// Reader thread: feeds the stream to poll() in chunks, waiting for room in
+//  the queue rather than overflowing it
+static void *queueReader(void *arg)
+{
+    QueueBench *qb = (QueueBench *)arg;
+    unsigned long pos;
+    unsigned int len;
+
+
+    for (pos = 0; pos < qb->stream->length; pos += len) {
+        len = qb->stream->length - pos;
+        if (len > QUEUE_CHUNK) {
+            len = QUEUE_CHUNK;
+        }
+
+        /* Wait for the handler side to catch up (yielding, in case both
+         *  threads are sharing a CPU)
+         */
+        while (qb->queue->count() > QUEUE_SIZE - QUEUE_CHUNK) {
+            sched_yield();
+        }
+
+        qb->port->setInput(qb->stream->data + pos, len);
+        qb->midi->poll();
+    }
+
+    qb->done = true;
+
+    return NULL;
+}
+
+
+// Run a stream through poll() with a queue between decoding & handling;
+//  either taking turns in one thread, or with poll() in its own thread
+template <bool threaded>
+static void benchQueue(const char *name, const BenchStream &s)
+{
+    host_serial_buffer buf;
+    HardwareSerial port(&buf);
+    BenchMidi midi(port);
+    MidiMessage storage[QUEUE_SIZE];
+    MidiQueue queue(storage, QUEUE_SIZE);
+    static unsigned char sysEx[QUEUE_SYSEX];
+    QueueBench qb;
+    pthread_t reader;
+    double start, elapsed;
+    double bytes = 0;
+    unsigned long pos;
+    unsigned int len;
+
+
+    memset(&buf, 0, sizeof(buf));
+    midi.begin(0);
+    midi.setQueue(&queue);
+    queue.setSysExBuffer(sysEx, sizeof(sysEx));
+#if MIDI_TIMESTAMPS
+    midi.setClock(benchClock);
+#endif
+
+    qb.stream = &s;
+    qb.midi = &midi;
+    qb.port = &port;
+    qb.queue = &queue;
+
+    start = now();
+    do {
+        if (threaded) {
+            qb.done = false;
+            pthread_create(&reader, NULL, queueReader, &qb);
+            while (!qb.done) {
+                if (!midi.dispatchQueued()) {
+                    sched_yield();
+                }
+            }
+            pthread_join(reader, NULL);
+            midi.dispatchQueued();
+        } else {
+            for (pos = 0; pos < s.length; pos += len) {
+                len = s.length - pos;
+                if (len > QUEUE_CHUNK) {
+                    len = QUEUE_CHUNK;
+                }
+                port.setInput(s.data + pos, len);
+                midi.poll();
+                midi.dispatchQueued();
+            }
+        }
+        bytes += s.length;
+        elapsed = now() - start;
+    } while (elapsed < MIN_BENCH_SECONDS);
+
+    printResult(name, bytes, midi.messages, elapsed);
+
+    if (queue.overflows()) {
+        printf("  ** %lu messages lost to queue overflow\n", queue.overflows());
+    }
+
+#if MIDI_TIMESTAMPS
+    printf("    latency ns: avg %lu max %lu; jitter ns: avg %lu max %lu\n",
+      midi.latencyStats().average(), midi.latencyStats().max,
+      midi.jitterStats().average(), midi.jitterStats().max);
+#endif
+}
+
+
+// Counts the batches poll() hands over
+class BatchBenchMidi : public BenchMidi {
+public:
+    unsigned long batches;
+
+    BatchBenchMidi(HardwareSerial &s) : BenchMidi(s), batches(0) {}
+
+    void handleBatchEnd(void) { batches++; }
+};
+
+
+// Run a stream through poll() with at most maxMessages handled per call,
+//  calling it until the stream has all been read
+static void benchLimited(const char *name, const BenchStream &s, unsigned int maxMessages)
+{
+    host_serial_buffer buf;
+    HardwareSerial port(&buf);
+    BatchBenchMidi midi(port);
+    double start, elapsed;
+    double bytes = 0;
+
+
+    memset(&buf, 0, sizeof(buf));
+    midi.begin(0);
+    midi.setPollLimits(maxMessages);
+
+    start = now();
+    do {
+        port.setInput(s.data, s.length);
+        while (port.available()) {
+            midi.poll();
+        }
+        bytes += s.length;
+        elapsed = now() - start;
+    } while (elapsed < MIN_BENCH_SECONDS);
+
+    printResult(name, bytes, midi.messages, elapsed);
+    printf("    %.1f messages per batch\n", (double)midi.messages / midi.batches);
+}
+
+
+// Every receive benchmark, for one stream
+static void benchStream(const BenchStream &s)
+{
+    printf("%s:\n", s.name);
+    benchReceive<BenchMidi>("  poll", s);
+    benchReceive<BenchStaticMidi>("  poll (static)", s);
+    benchLimited("  poll, 16 per call", s, 16);
+    benchDecode<BenchMidi>("  decode", s, false);
+    benchDecode<BenchMidi>("  decode + dispatch", s, true);
+    benchDecode<BenchStaticMidi>("  decode + dispatch (st)", s, true);
+    benchQueue<false>("  poll + queue", s);
+    benchQueue<true>("  poll thread + queue", s);
+}
+
+
+static void benchStream(const char *name, StreamBuilder build)
+{
+    BenchStream s = makeStream(name, build);
+
+
+    benchStream(s);
+    free(s.data);
+}
+
+
+// Receiving a stream with most of it filtered out
+static void benchFiltered(const char *name, StreamBuilder build)
+{
+    BenchStream s = makeStream(name, build);
+
+
+    printf("%s, notes on channel 1 only:\n", s.name);
+    benchReceive<BenchMidi>("  poll", s, true);
+    benchReceive<BenchStaticMidi>("  poll (static)", s, true);
+    free(s.data);
+}
+
+
+// Where the send side and THRU output goes; it wraps around
+static unsigned char sendBuffer[64 * 1024];
+
+
+// Run a stream through poll() with THRU on to a second port; if filtered,
+//  only NOTE ON / OFF on channel 1 are received and passed on
+static void benchThru(const char *name, const BenchStream &s, bool filtered)
+{
+    host_serial_buffer buffers[2];
+    HardwareSerial inPort(&buffers[0]), outPort(&buffers[1]);
+    BenchMidi midi(inPort);
+    Midi out(outPort);
+    double start, elapsed;
+    double bytes = 0;
+
+
+    memset(buffers, 0, sizeof(buffers));
+    buffers[1].tx = sendBuffer;
+    buffers[1].txSize = sizeof(sendBuffer);
+    midi.begin(0);
+
+    if (filtered) {
+        midi.setChannelFilter(0, 0);
+        midi.setChannelFilter(STATUS_EVENT_NOTE_ON, 0x0001);
+        midi.setChannelFilter(STATUS_EVENT_NOTE_OFF, 0x0001);
+        midi.setSystemFilter(0);
+    }
+    midi.setThru(&out, filtered);
+
+    start = now();
+    do {
+        inPort.setInput(s.data, s.length);
+        midi.poll();
+        bytes += s.length;
+        elapsed = now() - start;
+    } while (elapsed < MIN_BENCH_SECONDS);
+
+    printResult(name, bytes, midi.messages, elapsed);
+    printf("    %.0f%% of the bytes passed on\n",
+      100.0 * buffers[1].txTotal / bytes);
+}
+
+
+// Receiving a stream while passing it on to another port
+static void benchThru(const char *name, StreamBuilder build)
+{
+    BenchStream s = makeStream(name, build);
+
+
+    printf("%s, with THRU:\n", s.name);
+    benchThru("  poll", s, false);
+    benchThru("  poll, filtered", s, true);
+    free(s.data);
+}
+
+
+/******************************************************************************
+ *
+ * Send side
+ *
+ *****************************************************************************/
+
+
+// Largest send buffer the benchmarks give to the Midi class
+static const unsigned int MAX_SEND_BUFFER = 256;
+
+// StaticMidi with no handlers at all, for the send benchmarks
+class PlainStaticMidi : public StaticMidi<PlainStaticMidi> {
+public:
+    PlainStaticMidi(HardwareSerial &s) : StaticMidi<PlainStaticMidi>(s) {}
+};
+
+
+// Calls one of the send functions for message number n.  These are
+//  templates so the same ones work for both Midi & StaticMidi.
+
+template <class MidiType>
+static void sendNoteOn(MidiType &midi, unsigned long n)
+{
+    midi.sendNoteOn(1, n & 0x7f, 100);
+}
+
+template <class MidiType>
+static void sendNoteOff(MidiType &midi, unsigned long n)
+{
+    midi.sendNoteOff(1, n & 0x7f, 0);
+}
+
+template <class MidiType>
+static void sendNoteOnChannels(MidiType &midi, unsigned long n)
+{
+    midi.sendNoteOn((n & 0x0f) + 1, n & 0x7f, 100);
+}
+
+// A 64 byte system exclusive message
+static unsigned char sysExPayload[64];
+
+template <class MidiType>
+static void sendSysEx(MidiType &midi, unsigned long n)
+{
+    midi.sendSysEx(sysExPayload, sizeof(sysExPayload));
+}
+
+template <class MidiType>
+static void sendControlChange(MidiType &midi, unsigned long n)
+{
+    midi.sendControlChange(1, 7, n & 0x7f);
+}
+
+template <class MidiType>
+static void sendProgramChange(MidiType &midi, unsigned long n)
+{
+    midi.sendProgramChange(1, n & 0x7f);
+}
+
+template <class MidiType>
+static void sendAfterTouch(MidiType &midi, unsigned long n)
+{
+    midi.sendAfterTouch(1, n & 0x7f);
+}
+
+template <class MidiType>
+static void sendPitchChange(MidiType &midi, unsigned long n)
+{
+    midi.sendPitchChange(n & 0x3fff);
+}
+
+template <class MidiType>
+static void sendPitchBendChannels(MidiType &midi, unsigned long n)
+{
+    midi.sendPitchBend((n & 0x0f) + 1, (n >> 4) & 0x3fff);
+}
+
+template <class MidiType>
+static void sendSync(MidiType &midi, unsigned long n)
+{
+    midi.sendSync();
+}
+
+
+// Call a send function over and over; if bufferSize isn't 0, the Midi
+//  instance is given a send buffer of that size.  fullCommands turns off
+//  running status.
+template <class SendFunction>
+static void benchSend(const char *name, SendFunction send,
+                      unsigned int bufferSize, bool fullCommands)
+{
+    host_serial_buffer buf;
+    HardwareSerial port(&buf);
+    Midi midi(port);
+    unsigned char midiBuffer[MAX_SEND_BUFFER];
+    double start, elapsed;
+    double messages = 0;
+    unsigned long n;
+
+
+    memset(&buf, 0, sizeof(buf));
+    port.setOutput(sendBuffer, sizeof(sendBuffer));
+    midi.begin(0);
+    midi.setSendBuffer(midiBuffer, bufferSize);
+    midi.setParam(Midi::PARAM_SEND_FULL_COMMANDS, fullCommands);
+
+    start = now();
+    do {
+        for (n = 0; n < SEND_MESSAGES; n++) {
+            send(midi, n);
+        }
+        midi.flush();
+        messages += SEND_MESSAGES;
+        elapsed = now() - start;
+    } while (elapsed < MIN_BENCH_SECONDS);
+
+    printResult(name, port.outputTotal(), messages, elapsed);
+}
+
+
+// Same thing, for StaticMidi (which has no send buffer)
+template <class SendFunction>
+static void benchStaticSend(const char *name, SendFunction send)
+{
+    host_serial_buffer buf;
+    HardwareSerial port(&buf);
+    PlainStaticMidi midi(port);
+    double start, elapsed;
+    double messages = 0;
+    unsigned long n;
+
+
+    memset(&buf, 0, sizeof(buf));
+    port.setOutput(sendBuffer, sizeof(sendBuffer));
+    midi.begin(0);
+
+    start = now();
+    do {
+        for (n = 0; n < SEND_MESSAGES; n++) {
+            send(midi, n);
+        }
+        messages += SEND_MESSAGES;
+        elapsed = now() - start;
+    } while (elapsed < MIN_BENCH_SECONDS);
+
+    printResult(name, port.outputTotal(), messages, elapsed);
+}
+
+
+// Every send benchmark, for one send function
+#define BENCH_SEND(name, send) \
+    do { \
+        printf("%s:\n", name); \
+        benchSend("  full commands", send<Midi>, 0, true); \
+        benchSend("  unbuffered", send<Midi>, 0, false); \
+        benchSend("  buffered (16 bytes)", send<Midi>, 16, false); \
+        benchSend("  buffered (256 bytes)", send<Midi>, 256, false); \
+        benchStaticSend("  static", send<PlainStaticMidi>); \
+    } while (0)
+
+
+/*****************************************************************************
+ *
+ * System exclusive packing
+ *
+ *****************************************************************************/
+
+
+// Size of the block packed & unpacked each time through
+static const unsigned int PACK_BYTES = 64 * 1024;
+
+
+// The obvious way of packing, a bit at a time, for comparison
+static unsigned int packBytewise(const unsigned char *data, unsigned int length,
+                                 unsigned char *out)
+{
+    unsigned char *start = out;
+    unsigned char *high = out;
+    unsigned int i;
+
+
+    for (i = 0; i < length; i++) {
+        if (i % 7 == 0) {
+            high = out++;
+            *high = 0;
+        }
+        *high |= (data[i] >> 7) << (6 - i % 7);
+        *out++ = data[i] & 0x7f;
+    }
+
+    return out - start;
+}
+
+
+static unsigned int unpackBytewise(const unsigned char *data, unsigned int length,
+                                   unsigned char *out)
+{
+    unsigned char *start = out;
+    unsigned char high = 0;
+    unsigned int i;
+
+
+    for (i = 0; i < length; i++) {
+        if (i % 8 == 0) {
+            high = data[i];
+        } else {
+            *out++ = data[i] | (((high >> (7 - i % 8)) & 1) << 7);
+        }
+    }
+
+    return out - start;
+}
+
+
+typedef unsigned int (*PackFunction)(const unsigned char *data, unsigned int length,
+                                     unsigned char *out);
+
+
+// Run a pack or unpack function over the same block until enough time has
+//  gone by; bytes are counted on the unpacked side, and each group of 7 is
+//  counted as a message
+static void benchPack(const char *name, PackFunction fn,
+                      const unsigned char *data, unsigned int length, unsigned char *out)
+{
+    double start, elapsed;
+    double bytes = 0;
+    unsigned int unpacked = 0;
+
+
+    start = now();
+    do {
+        unpacked = fn(data, length, out);
+        if (unpacked < length) {
+            unpacked = length;
+        }
+        bytes += unpacked;
+        elapsed = now() - start;
+    } while (elapsed < MIN_BENCH_SECONDS);
+
+    printResult(name, bytes, bytes / 7, elapsed);
+}
+
+
+static void benchPacking(void)
+{
+    unsigned char *data = (unsigned char *)malloc(PACK_BYTES);
+    unsigned char *packed = (unsigned char *)malloc(midiSysExPackedLength(PACK_BYTES));
+    unsigned char *unpacked = (unsigned char *)malloc(PACK_BYTES);
+    unsigned int packedLength;
+    unsigned int i;
+
+
+    for (i = 0; i < PACK_BYTES; i++) {
+        data[i] = i * 37 + (i >> 8);
+    }
+
+    packedLength = midiSysExPack(data, PACK_BYTES, packed);
+    if (midiSysExUnpack(packed, packedLength, unpacked) != PACK_BYTES
+      || memcmp(data, unpacked, PACK_BYTES))
+    {
+        printf("  ** packing doesn't round trip\n");
+    }
+
+    benchPack("  pack", midiSysExPack, data, PACK_BYTES, packed);
+    benchPack("  pack (byte at a time)", packBytewise, data, PACK_BYTES, packed);
+    benchPack("  unpack", midiSysExUnpack, packed, packedLength, unpacked);
+    benchPack("  unpack (byte at a time)", unpackBytewise, packed, packedLength, unpacked);
+
+    free(data);
+    free(packed);
+    free(unpacked);
+}
+
+
+/*****************************************************************************
+ *
+ * Clock tracking
+ *
+ *****************************************************************************/
+
+
+// Number of clock ticks fed to the tracker each time through
+static const unsigned long TRACKER_TICKS = 64 * 1024;
+
+
+// Counts the ticks a MidiClockTracker sends
+struct SyncCounter {
+    unsigned long syncs;
+
+    void sendSync(void) { syncs++; }
+};
+
+
+// Feed the tracker a 120 BPM clock (in microseconds) with up to 2ms of
+//  jitter on each tick, checking for our own ticks to send in between
+static void benchTracker(void)
+{
+    MidiClockTracker tracker;
+    SyncCounter out = { 0 };
+    unsigned long *arrivals = (unsigned long *)malloc(TRACKER_TICKS * sizeof(unsigned long));
+    double start, elapsed;
+    double ticks = 0;
+    unsigned long base = 0;
+    unsigned long i;
+
+
+    for (i = 0; i < TRACKER_TICKS; i++) {
+        arrivals[i] = i * 20833 + 2000 + rand() % 4001 - 2000;
+    }
+
+    start = now();
+    do {
+        for (i = 0; i < TRACKER_TICKS; i++) {
+            tracker.tick(base + arrivals[i]);
+            tracker.sendClock(out, base + arrivals[i] + 10000);
+        }
+        base += TRACKER_TICKS * 20833;
+        ticks += TRACKER_TICKS;
+        elapsed = now() - start;
+    } while (elapsed < MIN_BENCH_SECONDS);
+
+    printResult("  tick + sendClock", ticks, ticks, elapsed);
+    printf("    tracked %.3f BPM (sent 120.000), %lu ticks sent for %.0f received\n",
+      tracker.bpm(), out.syncs, ticks);
+
+    free(arrivals);
+}
+
+
+/*****************************************************************************
+ *
+ * Scheduling
+ *
+ *****************************************************************************/
+
+
+// Number of events kept waiting in the scheduler, and how many are added
+//  & sent each time through
+static const unsigned int SCHEDULER_SIZE = 1024;
+static const unsigned int SCHEDULER_BATCH = 64;
+
+
+// Counts the messages a MidiScheduler sends
+struct SendCounter {
+    unsigned long messages;
+    unsigned long checksum;
+
+    void send(const MidiMessage &message)
+    {
+        messages++;
+        checksum += message.data1;
+    }
+};
+
+
+// Keep the scheduler about half full of notes due at scattered times (with
+//  a clock tick every so often), moving time along & sending what's due
+static void benchScheduler(void)
+{
+    static MidiScheduledEvent storage[SCHEDULER_SIZE];
+    MidiScheduler scheduler(storage, SCHEDULER_SIZE, SCHEDULER_SIZE / 8);
+    SendCounter out = { 0, 0 };
+    MidiMessage message;
+    double start, elapsed;
+    unsigned long time = 0;
+    unsigned long n = 0;
+    unsigned int i;
+
+
+    message.type = MidiMessage::NONE;
+
+    start = now();
+    do {
+        for (i = 0; i < SCHEDULER_BATCH; i++, n++) {
+            message.status = (n % 16) ? 0x90 : STATUS_SYNC;
+            message.data1 = n & 0x7f;
+            message.data2 = 100;
+            scheduler.schedule(message, time + (n * 7919) % 1000);
+        }
+        time += 1000 / (SCHEDULER_SIZE / 2 / SCHEDULER_BATCH);
+        scheduler.service(out, time);
+        elapsed = now() - start;
+    } while (elapsed < MIN_BENCH_SECONDS);
+
+    printResult("  schedule + service", out.messages, out.messages, elapsed);
+
+    if (scheduler.overflows()) {
+        printf("  ** %lu messages didn't fit in the scheduler\n", scheduler.overflows());
+    }
+}
+
+
+/*****************************************************************************
+ *
+ * Note tracking
+ *
+ *****************************************************************************/
+
+
+// Number of note messages fed to the tracker each time through
+static const unsigned int NOTE_TRACKER_MESSAGES = 4096;
+
+
+// Counts the bytes a panic sends (each message in full)
+struct PanicCounter {
+    unsigned long bytes;
+
+    void sendNoteOff(unsigned int channel, unsigned int note, unsigned int velocity) { bytes += 3; }
+    void sendControlChange(unsigned int channel, unsigned int controller, unsigned int value) { bytes += 3; }
+};
+
+
+// Feed the tracker notes going on & off on all channels with the pedal
+//  going up & down now and then, then see what a panic has to send
+//  compared to a NOTE OFF for every note on every channel
+static void benchNoteTracker(void)
+{
+    MidiNoteTracker tracker;
+    MidiMessage *messages = (MidiMessage *)malloc(NOTE_TRACKER_MESSAGES * sizeof(MidiMessage));
+    PanicCounter out = { 0 };
+    double start, elapsed;
+    double processed = 0;
+    unsigned int sounding = 0;
+    unsigned int i;
+
+
+    for (i = 0; i < NOTE_TRACKER_MESSAGES; i++) {
+        MidiMessage &m = messages[i];
+
+
+        m.status = (rand() % 3 ? STATUS_EVENT_NOTE_ON : STATUS_EVENT_NOTE_OFF) | (i % 16);
+        m.data1 = 36 + rand() % 48;
+        m.data2 = 100;
+        if (i % 97 == 0) {
+            m.status = STATUS_EVENT_CONTROL_CHANGE | (i % 16);
+            m.data1 = 64;
+            m.data2 = (i / 97) & 1 ? 0 : 127;
+        }
+        m.type = MidiParser::messageType(m.status, m.data2);
+    }
+
+    start = now();
+    do {
+        for (i = 0; i < NOTE_TRACKER_MESSAGES; i++) {
+            tracker.process(messages[i]);
+        }
+        processed += NOTE_TRACKER_MESSAGES;
+        elapsed = now() - start;
+    } while (elapsed < MIN_BENCH_SECONDS);
+
+    printResult("  process", processed * 3, processed, elapsed);
+
+    for (i = 1; i <= 16; i++) {
+        sounding += tracker.count(i);
+    }
+
+    start = now();
+    tracker.panic(out);
+    elapsed = now() - start;
+
+    printf("    panic with %u notes sounding: %lu bytes (%.1f ms at 31250 baud) in %.2f us,\n"
+           "    against %u bytes (%.1f ms) for every note on every channel\n",
+      sounding, out.bytes, out.bytes * 10000.0 / 31250, elapsed * 1e6,
+      16 * 128 * 3, 16 * 128 * 3 * 10000.0 / 31250);
+
+    free(messages);
+}
+
+
+/*****************************************************************************
+ *
+ * Controllers
+ *
+ *****************************************************************************/
+
+
+// Number of 14-bit fader moves fed to the controller cache each time through
+static const unsigned int CONTROLLER_MOVES = 4096;
+
+
+// Counts the controller messages sent
+struct ControlCounter {
+    unsigned long messages;
+
+    void sendControlChange(unsigned int channel, unsigned int controller, unsigned int value) { messages++; }
+};
+
+
+// Gets the 14-bit values out of a MidiControllers
+class FaderControllers : public MidiControllers {
+public:
+    unsigned long checksum;
+
+    FaderControllers(MidiControllerChannel *storage) : MidiControllers(storage), checksum(0) {}
+
+    void handleControlChange14(unsigned int channel, unsigned int controller, unsigned int value)
+    {
+        checksum += value;
+    }
+};
+
+
+// Feed the cache 14-bit fader moves (MSB + LSB) on all channels, then see
+//  how many messages sending a slow fader sweep takes, against sending
+//  both halves every time
+static void benchControllers(void)
+{
+    static MidiControllerChannel storage[16];
+    static MidiControllerChannel sendStorage[1];
+    FaderControllers controllers(storage);
+    MidiControllers sender(sendStorage, 1);
+    MidiMessage *messages = (MidiMessage *)malloc(CONTROLLER_MOVES * 2 * sizeof(MidiMessage));
+    ControlCounter out = { 0 };
+    double start, elapsed;
+    double processed = 0;
+    unsigned int i;
+
+
+    for (i = 0; i < CONTROLLER_MOVES; i++) {
+        unsigned int value = (i * 37) & 0x3fff;
+
+
+        messages[i * 2].status = STATUS_EVENT_CONTROL_CHANGE | (i % 16);
+        messages[i * 2].data1 = i % 8;
+        messages[i * 2].data2 = value >> 7;
+        messages[i * 2].type = MidiMessage::CONTROL_CHANGE;
+        messages[i * 2 + 1] = messages[i * 2];
+        messages[i * 2 + 1].data1 += 32;
+        messages[i * 2 + 1].data2 = value & 0x7f;
+    }
+
+    start = now();
+    do {
+        for (i = 0; i < CONTROLLER_MOVES * 2; i++) {
+            controllers.process(messages[i]);
+        }
+        processed += CONTROLLER_MOVES * 2;
+        elapsed = now() - start;
+    } while (elapsed < MIN_BENCH_SECONDS);
+
+    printResult("  process", processed * 3, processed, elapsed);
+
+    /* A fader moving slowly (a few LSB steps per move) from end to end */
+    for (i = 0; i < 0x4000; i += 3) {
+        sender.sendControlChange14(out, 1, 7, i);
+    }
+
+    printf("    slow 14-bit sweep: %lu messages sent, against %u sending both halves\n",
+      out.messages, (0x4000 / 3 + 1) * 2);
+
+    free(messages);
+}
+
+
+/*****************************************************************************
+ *
+ * Coalescing
+ *
+ *****************************************************************************/
+
+
+// Number of knobs being turned, how many values each one makes for every
+//  message the link has room for, and the sizes of the coalescer's storage
+static const unsigned int COALESCE_KNOBS = 8;
+static const unsigned int COALESCE_RATE = 4;
+static const unsigned int COALESCE_QUEUE = 64;
+static const unsigned int COALESCE_VALUES = 16;
+
+
+// Turn knobs (with a note now and then) faster than the link can keep up
+//  with, letting one message's worth of bytes out each time through
+static void benchCoalescer(void)
+{
+    static MidiMessage queue[COALESCE_QUEUE];
+    static MidiCoalescedValue values[COALESCE_VALUES];
+    MidiCoalescer coalescer(queue, COALESCE_QUEUE, values, COALESCE_VALUES);
+    SendCounter out = { 0, 0 };
+    double start, elapsed;
+    double made = 0;
+    unsigned long n = 0;
+    unsigned int i;
+
+
+    start = now();
+    do {
+        for (i = 0; i < COALESCE_KNOBS * COALESCE_RATE; i++, n++) {
+            coalescer.sendControlChange(1 + (n % 2), 16 + n % COALESCE_KNOBS, (n / 16) & 0x7f);
+        }
+        coalescer.sendNoteOn(1, n & 0x7f, 100);
+        made += i + 1;
+
+        for (i = 0; i < COALESCE_KNOBS; i++) {
+            coalescer.service(out, 3);
+        }
+        elapsed = now() - start;
+    } while (elapsed < MIN_BENCH_SECONDS);
+
+    printResult("  send + service", made * 3, made, elapsed);
+    printf("    %.0f messages made, %lu sent, %lu replaced while waiting; %u still waiting\n",
+      made, out.messages, coalescer.coalesced(), coalescer.queued() + coalescer.pending());
+
+    if (coalescer.overflows()) {
+        printf("  ** %lu messages didn't fit in the queue\n", coalescer.overflows());
+    }
+}
+
+
+/*****************************************************************************
+ *
+ * Routing
+ *
+ *****************************************************************************/
+
+
+// Merge two inputs (the "mixed" stream and another one) into one output,
+//  and also pass the first input's channel 1 through to a second output
+// Counts the NOTE OFFs going in to (or out of) a Midi instance
+class NoteOffCounter : public MidiListener {
+public:
+    unsigned long received;
+    unsigned long sent;
+
+    NoteOffCounter() : received(0), sent(0) {}
+
+    void midiReceived(const MidiMessage &message)
+    {
+        if (message.type == MidiMessage::NOTE_OFF) {
+            received++;
+        }
+    }
+
+    void midiSent(const MidiMessage &message)
+    {
+        if (message.type == MidiMessage::NOTE_OFF) {
+            sent++;
+        }
+    }
+};
+
+
+static void benchRouter(const char *name, StreamBuilder build)
+{
+    BenchStream mixed = makeStream("mixed", buildMixed);
+    BenchStream other = makeStream(name, build);
+    host_serial_buffer buffers[4];
+    HardwareSerial ports[4] = {
+        HardwareSerial(&buffers[0]), HardwareSerial(&buffers[1]),
+        HardwareSerial(&buffers[2]), HardwareSerial(&buffers[3])
+    };
+    BenchMidi in1(ports[0]), in2(ports[1]);
+    Midi out1(ports[2]), out2(ports[3]);
+    MidiRouter<2, 2> router;
+    NoteOffCounter in1Offs, in2Offs, out1Offs;
+    double start, elapsed;
+    double bytes = 0;
+
+
+    memset(buffers, 0, sizeof(buffers));
+    buffers[2].tx = sendBuffer;
+    buffers[2].txSize = sizeof(sendBuffer);
+    buffers[3].tx = sendBuffer;
+    buffers[3].txSize = sizeof(sendBuffer);
+
+#if MIDI_TIMESTAMPS
+    in1.setClock(benchClock);
+    in2.setClock(benchClock);
+    router.setClock(benchClock);
+#endif
+
+    router.setInput(0, in1);
+    router.setInput(1, in2);
+    router.setOutput(0, out1);
+    router.setOutput(1, out2);
+    router.connect(0, 0);
+    router.connect(1, 0);
+    router.connect(0, 1, 0x0001, 0);
+
+    /* Everything goes to output 1, so every NOTE OFF should come out of it */
+    in1.addListener(&in1Offs);
+    in2.addListener(&in2Offs);
+    out1.addListener(&out1Offs);
+
+    /* Feed the inputs a little at a time, like serial ports would */
+    start = now();
+    do {
+        unsigned long pos;
+
+
+        for (pos = 0; pos < mixed.length && pos < other.length; pos += QUEUE_CHUNK) {
+            ports[0].setInput(mixed.data + pos, QUEUE_CHUNK);
+            ports[1].setInput(other.data + pos, QUEUE_CHUNK);
+            router.poll();
+        }
+        bytes += pos * 2;
+        elapsed = now() - start;
+    } while (elapsed < MIN_BENCH_SECONDS);
+
+    printf("mixed + %s:\n", name);
+    printResult("  2 inputs to 2 outputs", bytes, in1.messages + in2.messages, elapsed);
+    printf("    %lu + %lu bytes out, %lu messages dropped, %lu sysex dropped, %lu cut off\n",
+      buffers[2].txTotal, buffers[3].txTotal, router.dropped(), router.sysExDropped(),
+      router.cutOff());
+    if (out1Offs.sent != in1Offs.received + in2Offs.received) {
+        printf("    LOST NOTE OFFS: %lu in, %lu out\n",
+               in1Offs.received + in2Offs.received, out1Offs.sent);
+    }
+#if MIDI_TIMESTAMPS
+    printf("    latency ns: avg %lu max %lu\n",
+      router.latencyStats().average(), router.latencyStats().max);
+#endif
+
+    free(mixed.data);
+    free(other.data);
+}
+
+
+/*****************************************************************************
+ *
+ * File player
+ *
+ *****************************************************************************/
+
+
+// The built-in MIDI file: a tempo track that changes tempo every bar, and
+//  tracks of notes, each on its own channel
+static const unsigned int FILE_TRACKS = 8;
+static const unsigned int FILE_NOTES = 8192;
+
+// Most tracks a file can have to be played, and the buffer each track gets
+//  when reading through a MidiFileReader
+static const unsigned int MAX_FILE_TRACKS = 64;
+static const unsigned int FILE_BUFFER = 32;
+
+
+// Counts what a file player sends
+struct FileCounter {
+    unsigned long messages;
+    unsigned long sysExBytes;
+
+    void send(const MidiMessage &message) { messages++; }
+    void sendSysExChunk(const unsigned char *data, unsigned int length, unsigned int flags)
+    {
+        messages++;
+        sysExBytes += length;
+    }
+};
+
+
+static unsigned char *putLength(unsigned char *p, unsigned long value)
+{
+    /* The higher 7 bits go first, with the top bit set to say more follow */
+    if (value >= 0x80) {
+        p = putLength(p, value >> 7);
+        p[-1] |= 0x80;
+    }
+    *p++ = value & 0x7f;
+
+    return p;
+}
+
+
+static unsigned char *put32(unsigned char *p, unsigned long value)
+{
+    *p++ = value >> 24;
+    *p++ = value >> 16;
+    *p++ = value >> 8;
+    *p++ = value;
+
+    return p;
+}
+
+
+// Start a track chunk at p; endTrack() fills in its length once it's done
+static unsigned char *startTrack(unsigned char *p)
+{
+    memcpy(p, "MTrk", 4);
+
+    return p + 8;
+}
+
+
+static unsigned char *endTrack(unsigned char *start, unsigned char *p)
+{
+    *p++ = 0;
+    *p++ = 0xff;
+    *p++ = 0x2f;
+    *p++ = 0;
+    put32(start + 4, p - start - 8);
+
+    return p;
+}
+
+
+static BenchStream buildFile(void)
+{
+    BenchStream s;
+    unsigned char *p, *track;
+    unsigned int t, n;
+
+
+    s.name = "built-in file";
+    s.data = (unsigned char *)malloc(FILE_TRACKS * (FILE_NOTES * 6 + 64));
+    p = s.data;
+
+    memcpy(p, "MThd", 4);
+    p = put32(p + 4, 6);
+    *p++ = 0;
+    *p++ = 1;
+    *p++ = 0;
+    *p++ = FILE_TRACKS;
+    *p++ = 0;
+    *p++ = 96;
+
+    track = p;
+    p = startTrack(p);
+    for (n = 0; n < FILE_NOTES / 16; n++) {
+        p = putLength(p, n ? 4 * 96 : 0);
+        *p++ = 0xff;
+        *p++ = 0x51;
+        *p++ = 3;
+        *p++ = (n & 1) ? 0x06 : 0x07;
+        *p++ = 0xa1;
+        *p++ = 0x20;
+    }
+    p = endTrack(track, p);
+
+    /* Notes a 16th apart, with running status & NOTE ON for NOTE OFF */
+    for (t = 1; t < FILE_TRACKS; t++) {
+        track = p;
+        p = startTrack(p);
+        *p++ = 0;
+        *p++ = 0xf0;
+        *p++ = 3;
+        *p++ = 0x7d;
+        *p++ = t;
+        *p++ = 0xf7;
+        for (n = 0; n < FILE_NOTES; n++) {
+            p = putLength(p, n ? 24 : 0);
+            if (!n) {
+                *p++ = 0x90 | t;
+            }
+            *p++ = 36 + (n + t) % 48;
+            *p++ = (n & 1) ? 0 : 100;
+        }
+        p = endTrack(track, p);
+    }
+
+    s.length = p - s.data;
+
+    return s;
+}
+
+
+// Reads a file held in a BenchStream, like reading it from a card would
+static unsigned int readBenchFile(unsigned long offset, unsigned char *buffer,
+                                  unsigned int size, void *context)
+{
+    const BenchStream *s = (const BenchStream *)context;
+
+
+    if (offset >= s->length) {
+        return 0;
+    }
+    if (size > s->length - offset) {
+        size = s->length - offset;
+    }
+    memcpy(buffer, s->data + offset, size);
+
+    return size;
+}
+
+
+// Play a file from start to finish over and over, as fast as the player
+//  can go, by moving the time straight to each event as it comes up
+static void benchPlay(const char *name, MidiFilePlayer &player, unsigned long length)
+{
+    FileCounter out = { 0, 0 };
+    unsigned long time;
+    double start, elapsed;
+    double bytes = 0;
+
+
+    start = now();
+    do {
+        player.start(0);
+        while (player.nextTime(&time)) {
+            player.service(out, time);
+        }
+        bytes += length;
+        elapsed = now() - start;
+    } while (elapsed < MIN_BENCH_SECONDS);
+
+    printResult(name, bytes, out.messages, elapsed);
+}
+
+
+// Play a file straight from memory, and through a MidiFileReader
+static void benchFile(const BenchStream &s)
+{
+    static MidiFileTrack tracks[MAX_FILE_TRACKS];
+    static unsigned char buffer[MAX_FILE_TRACKS * FILE_BUFFER];
+    MidiFilePlayer player(tracks, MAX_FILE_TRACKS, buffer, sizeof(buffer));
+
+
+    if (!player.open(s.data, s.length)) {
+        printf("%s: not a MIDI file that can be played\n", s.name);
+        return;
+    }
+
+    printf("%s, format %u, %u tracks:\n", s.name, player.format(), player.trackCount());
+    benchPlay("  play from memory", player, s.length);
+
+    player.open(readBenchFile, (void *)&s);
+    benchPlay("  play through reader", player, s.length);
+}
+
+
+static void benchFilePlayer(void)
+{
+    BenchStream s = buildFile();
+
+
+    benchFile(s);
+    free(s.data);
+}
+
+
+static bool isMidiFile(const char *path)
+{
+    size_t length = strlen(path);
+
+
+    return length > 4 && !strcmp(path + length - 4, ".mid");
+}
+
+
+// Play a MIDI file given on the command line, mapped into memory
+static void benchMappedFile(const char *path)
+{
+    BenchStream s;
+    struct stat st;
+    void *map;
+    int fd;
+
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        perror(path);
+        return;
+    }
+
+    if (fstat(fd, &st) < 0 || !st.st_size
+        || (map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        perror(path);
+        close(fd);
+        return;
+    }
+
+    s.name = path;
+    s.data = (unsigned char *)map;
+    s.length = st.st_size;
+    benchFile(s);
+
+    munmap(map, st.st_size);
+    close(fd);
+}
+
+
+/*****************************************************************************
+ *
+ * File recorder
+ *
+ *****************************************************************************/
+
+
+// Size of the recorder's buffer
+static const unsigned int RECORD_BUFFER = 4096;
+
+
+// Clock for the recorder: each time it's read, it moves on by the time a
+//  byte takes at MIDI speed
+static unsigned long recordTime;
+
+static unsigned long recordClock(void)
+{
+    return recordTime += 320;
+}
+
+
+// Takes what the recorder writes, wrapping around the send buffer
+static unsigned int writeBenchFile(unsigned long offset, const unsigned char *data,
+                                   unsigned int length, void *context)
+{
+    memcpy(sendBuffer + offset % (sizeof(sendBuffer) / 2), data, length);
+
+    return length;
+}
+
+
+// Receive a stream, a little at a time, with a recorder writing all of it
+//  to a file
+static void benchRecorder(const char *name, StreamBuilder build)
+{
+    static unsigned char buffer[RECORD_BUFFER];
+    BenchStream s = makeStream(name, build);
+    host_serial_buffer buf;
+    HardwareSerial port(&buf);
+    BenchMidi midi(port);
+    MidiFileRecorder recorder(buffer, RECORD_BUFFER);
+    double start, elapsed;
+    double bytes = 0;
+    unsigned long pos;
+
+
+    memset(&buf, 0, sizeof(buf));
+    midi.begin(0);
+    recorder.setClock(recordClock);
+#if MIDI_TIMESTAMPS
+    midi.setClock(recordClock);
+#endif
+    midi.addListener(&recorder);
+    recorder.start(writeBenchFile, 0);
+
+    start = now();
+    do {
+        for (pos = 0; pos < s.length; pos += QUEUE_CHUNK) {
+            port.setInput(s.data + pos, QUEUE_CHUNK);
+            midi.poll();
+            recorder.service();
+        }
+        bytes += pos;
+        elapsed = now() - start;
+    } while (elapsed < MIN_BENCH_SECONDS);
+
+    recorder.stop();
+
+    printf("%s:\n", s.name);
+    printResult("  poll + record", bytes, midi.messages, elapsed);
+    printf("    %lu bytes in the file, %lu messages didn't fit\n",
+      recorder.length(), recorder.overflows());
+
+    free(s.data);
+}
+
+
+/*****************************************************************************
+ *
+ * Capture & replay
+ *
+ *****************************************************************************/
+
+
+// Size of the capture writer's buffer (two chunks)
+static const unsigned int CAPTURE_BUFFER = 4096;
+
+
+// A capture file in memory
+struct MemoryFile {
+    unsigned char *data;
+    unsigned long size;
+    unsigned long length;
+};
+
+
+static unsigned int writeMemoryFile(unsigned long offset, const unsigned char *data,
+                                    unsigned int length, void *context)
+{
+    MemoryFile *file = (MemoryFile *)context;
+
+
+    if (offset + length > file->size) {
+        return 0;
+    }
+    memcpy(file->data + offset, data, length);
+    if (offset + length > file->length) {
+        file->length = offset + length;
+    }
+
+    return length;
+}
+
+
+// Whether a file given on the command line is a capture, rather than raw
+//  bytes
+static bool isCapture(const char *path)
+{
+    char magic[8];
+    FILE *f;
+    bool capture;
+
+
+    if ((f = fopen(path, "rb")) == NULL) {
+        return false;
+    }
+
+    capture = fread(magic, 1, sizeof(magic), f) == sizeof(magic)
+              && !memcmp(magic, "MIDICAPT", sizeof(magic));
+    fclose(f);
+
+    return capture;
+}
+
+
+// Replay a capture into a Midi instance as fast as it will go
+static void benchReplay(const BenchStream &s)
+{
+    host_serial_buffer buf;
+    HardwareSerial port(&buf);
+    BenchMidi midi(port);
+    MidiCaptureReplay replay;
+    double start, elapsed;
+    double bytes = 0;
+
+
+    memset(&buf, 0, sizeof(buf));
+    midi.begin(0);
+
+    if (!replay.open(s.data, s.length)) {
+        printf("%s: not a capture\n", s.name);
+        return;
+    }
+
+    start = now();
+    do {
+        replay.rewind();
+        bytes += replay.replay(midi);
+        elapsed = now() - start;
+    } while (elapsed < MIN_BENCH_SECONDS);
+
+    printResult("  replay", bytes, midi.messages, elapsed);
+}
+
+
+// Receive a stream, a little at a time, capturing all of it; then capture
+//  it once more into memory and replay that
+static void benchCapture(const char *name, StreamBuilder build)
+{
+    static unsigned char buffer[CAPTURE_BUFFER];
+    BenchStream s = makeStream(name, build);
+    BenchStream captured;
+    MemoryFile file;
+    host_serial_buffer buf;
+    HardwareSerial port(&buf);
+    BenchMidi midi(port);
+    MidiCaptureWriter capture(buffer, CAPTURE_BUFFER);
+    double start, elapsed;
+    double bytes = 0;
+    unsigned long pos;
+
+
+    memset(&buf, 0, sizeof(buf));
+    midi.begin(0);
+    midi.setClock(recordClock);
+    midi.setCapture(&capture);
+
+    capture.start(writeBenchFile, 0);
+    start = now();
+    do {
+        for (pos = 0; pos < s.length; pos += QUEUE_CHUNK) {
+            port.setInput(s.data + pos, QUEUE_CHUNK);
+            midi.poll();
+            capture.service();
+        }
+        bytes += pos;
+        elapsed = now() - start;
+    } while (elapsed < MIN_BENCH_SECONDS);
+    capture.stop();
+
+    printf("%s:\n", s.name);
+    printResult("  poll + capture", bytes, midi.messages, elapsed);
+
+    file.size = s.length * 2 + CAPTURE_BUFFER;
+    file.data = (unsigned char *)malloc(file.size);
+    file.length = 0;
+
+    capture.start(writeMemoryFile, &file);
+    for (pos = 0; pos < s.length; pos += QUEUE_CHUNK) {
+        port.setInput(s.data + pos, QUEUE_CHUNK);
+        midi.poll();
+        capture.service();
+    }
+    capture.stop();
+
+    printf("    %lu bytes captured in %lu, %lu lost\n", s.length, file.length, capture.lost());
+
+    captured.name = s.name;
+    captured.data = file.data;
+    captured.length = file.length;
+    benchReplay(captured);
+
+    free(file.data);
+    free(s.data);
+}
+
+
+/*****************************************************************************
+ *
+ * USB-MIDI
+ *
+ *****************************************************************************/
+
+
+// Where the encoder's frames are collected
+struct PacketBuffer {
+    unsigned char *data;
+    unsigned long length;
+};
+
+
+static void collectPackets(const unsigned char *packets, unsigned int length, void *context)
+{
+    PacketBuffer *buffer = (PacketBuffer *)context;
+
+
+    memcpy(buffer->data + buffer->length, packets, length);
+    buffer->length += length;
+}
+
+
+// Pack a stream into USB-MIDI event packets, then feed the packets back in
+//  a frame at a time, checking the handlers see the same as they do for the
+//  bytes themselves
+static void benchUsb(const char *name, StreamBuilder build)
+{
+    static unsigned char frame[MIDI_USB_FRAME_SIZE];
+    BenchStream s = makeStream(name, build);
+    PacketBuffer packets;
+    host_serial_buffer buf;
+    HardwareSerial port(&buf);
+    BenchMidi midi(port);
+    BenchMidi direct(port);
+    BenchMidi check(port);
+    MidiUsbEncoder encoder(frame, sizeof(frame), collectPackets, &packets);
+    double start, elapsed;
+    double bytes = 0;
+    double messages = 0;
+
+
+    memset(&buf, 0, sizeof(buf));
+    midi.begin(0);
+    direct.begin(0);
+    check.begin(0);
+
+    /* Real time messages take a packet each, so allow 4 per byte */
+    packets.data = (unsigned char *)malloc(s.length * MIDI_USB_PACKET_SIZE + sizeof(frame));
+    direct.receive(s.data, s.length);
+
+    start = now();
+    do {
+        packets.length = 0;
+        encoder.reset();
+        encoder.encode(s.data, s.length);
+        encoder.flush();
+        bytes += s.length;
+        messages += direct.messages;
+        elapsed = now() - start;
+    } while (elapsed < MIN_BENCH_SECONDS);
+
+    printf("%s:\n", s.name);
+    printResult("  encode", bytes, messages, elapsed);
+    printf("    %lu bytes in %lu bytes of packets\n", s.length, packets.length);
+
+    bytes = 0;
+    start = now();
+    do {
+        bytes += midiUsbReceive(packets.data, packets.length, midi);
+        elapsed = now() - start;
+    } while (elapsed < MIN_BENCH_SECONDS);
+
+    printResult("  decode + receive", bytes, midi.messages, elapsed);
+
+    midiUsbReceive(packets.data, packets.length, check);
+    if (check.messages != direct.messages || check.checksum != direct.checksum) {
+        printf("    MISMATCH: %lu messages (%08lx) from packets, %lu (%08lx) from bytes\n",
+               check.messages, check.checksum, direct.messages, direct.checksum);
+    }
+
+    free(packets.data);
+    free(s.data);
+}
+
+
+/*****************************************************************************
+ *
+ * MPE
+ *
+ *****************************************************************************/
+
+
+// Number of notes the receiver can keep, and how many the bench keeps on
+static const unsigned int MPE_NOTES = 32;
+static const unsigned int MPE_VOICES = 12;
+
+
+// Passes what a MidiMpeSender sends straight to a MidiMpeReceiver
+struct MpeLoopback {
+    MidiMpeReceiver *receiver;
+    unsigned long messages;
+
+    void send(unsigned int status, unsigned int data1, unsigned int data2)
+    {
+        MidiMessage m;
+
+
+        m.status = status;
+        m.data1 = data1;
+        m.data2 = data2;
+        m.type = MidiParser::messageType(status, data2);
+        receiver->process(m);
+        messages++;
+    }
+
+    void sendNoteOn(unsigned int channel, unsigned int note, unsigned int velocity)
+    { send(STATUS_EVENT_NOTE_ON | (channel - 1), note, velocity); }
+    void sendNoteOff(unsigned int channel, unsigned int note, unsigned int velocity)
+    { send(STATUS_EVENT_NOTE_OFF | (channel - 1), note, velocity); }
+    void sendControlChange(unsigned int channel, unsigned int controller, unsigned int value)
+    { send(STATUS_EVENT_CONTROL_CHANGE | (channel - 1), controller, value); }
+    void sendAfterTouch(unsigned int channel, unsigned int pressure)
+    { send(STATUS_AFTER_TOUCH | (channel - 1), pressure, 0); }
+    void sendPitchBend(unsigned int channel, unsigned int bend)
+    { send(STATUS_PITCH_CHANGE | (channel - 1), bend & 0x7f, bend >> 7); }
+};
+
+
+// Adds up what the receiver passes on, so it isn't optimized away
+class BenchMpeReceiver : public MidiMpeReceiver {
+public:
+    unsigned long checksum;
+
+    BenchMpeReceiver(MidiMpeNote *notes, unsigned int count)
+      : MidiMpeReceiver(notes, count), checksum(0) {}
+
+    void handleNoteStart(const MidiMpeNote &note) { checksum += note.note; }
+    void handleNoteChange(const MidiMpeNote &note, unsigned int changed) { checksum += pitch(note) + note.pressure; }
+    void handleNoteEnd(const MidiMpeNote &note) { checksum -= note.note; }
+};
+
+
+// An expressive controller playing through a 15 channel zone: notes
+//  starting & stopping, with a stream of pitch, pressure & timbre for each
+//  one in between, going through the sender's voice allocation & straight
+//  into a receiver
+static void benchMpe(void)
+{
+    static MidiMpeNote notes[MPE_NOTES];
+    BenchMpeReceiver receiver(notes, MPE_NOTES);
+    MpeLoopback out = { &receiver, 0 };
+    MidiMpeSender sender;
+    unsigned char voices[MPE_VOICES][2];
+    double start, elapsed;
+    unsigned long updates = 0;
+    unsigned long n = 0;
+    unsigned int v;
+
+
+    sender.configure(out, MIDI_MPE_LOWER, 15);
+    for (v = 0; v < MPE_VOICES; v++) {
+        voices[v][0] = sender.noteOn(out, MIDI_MPE_LOWER, 48 + v, 100);
+        voices[v][1] = 48 + v;
+    }
+
+    out.messages = 0;
+    start = now();
+    do {
+        for (unsigned int i = 0; i < 1024; i++, n++) {
+            v = n % MPE_VOICES;
+
+            /* Every so often a voice gets a new note */
+            if (n % 61 == 0) {
+                sender.noteOff(out, voices[v][0], voices[v][1]);
+                voices[v][1] = 36 + n % 48;
+                voices[v][0] = sender.noteOn(out, MIDI_MPE_LOWER, voices[v][1], 100);
+                continue;
+            }
+
+            switch (n % 3) {
+                case 0:
+                    sender.sendPitchBend(out, voices[v][0], 8192 + ((n * 37) & 0x0fff) - 0x800);
+                    break;
+                case 1:
+                    sender.sendPressure(out, voices[v][0], n >> 3);
+                    break;
+                case 2:
+                    sender.sendTimbre(out, voices[v][0], n >> 5);
+                    break;
+            }
+        }
+        updates += 1024;
+        elapsed = now() - start;
+    } while (elapsed < MIN_BENCH_SECONDS);
+
+    printResult("  allocate + send + receive", out.messages * 3.0, updates, elapsed);
+    printf("    %lu messages for %lu updates, %u notes on at the end\n",
+           out.messages, updates, receiver.active());
+}
+
+
+/*****************************************************************************/
+
+
+int main(int argc, char **argv)
+{
+    BenchStream s;
+    int i;
+
+
+    printHeader("receive");
+
+    benchStream("notes", buildNotes);
+    benchStream("notes, running status", buildNotesRunning);
+    benchStream("control sweep", buildControlSweep);
+    benchStream("clock", buildClock);
+    benchStream("pitch", buildPitch);
+    benchStream("program change", buildProgram);
+    benchStream("mixed", buildMixed);
+    benchStream("sysex", buildSysEx);
+    benchFiltered("mixed", buildMixed);
+    benchThru("mixed", buildMixed);
+
+    for (i = 1; i < argc; i++) {
+        if (isMidiFile(argv[i]) || isCapture(argv[i])) {
+            continue;
+        }
+        if (loadStream(argv[i], &s)) {
+            benchStream(s);
+            free(s.data);
+        }
+    }
+
+    printHeader("send");
+
+    BENCH_SEND("sendNoteOn", sendNoteOn);
+    BENCH_SEND("sendNoteOff", sendNoteOff);
+    BENCH_SEND("sendNoteOn, 16 channels", sendNoteOnChannels);
+    BENCH_SEND("sendControlChange", sendControlChange);
+    BENCH_SEND("sendProgramChange", sendProgramChange);
+    BENCH_SEND("sendAfterTouch", sendAfterTouch);
+    BENCH_SEND("sendPitchChange", sendPitchChange);
+    BENCH_SEND("sendPitchBend, 16 channels", sendPitchBendChannels);
+    BENCH_SEND("sendSync", sendSync);
+    BENCH_SEND("sendSysEx, 64 bytes", sendSysEx);
+
+    printHeader("sysex packing");
+
+    benchPacking();
+
+    printHeader("clock tracker");
+
+    benchTracker();
+
+    printHeader("scheduler");
+
+    benchScheduler();
+
+    printHeader("note tracker");
+
+    benchNoteTracker();
+
+    printHeader("controllers");
+
+    benchControllers();
+
+    printHeader("coalescing");
+
+    benchCoalescer();
+
+    printHeader("routing");
+
+    benchRouter("notes", buildNotes);
+    benchRouter("sysex", buildSysEx);
+
+    printHeader("file player");
+
+    benchFilePlayer();
+
+    for (i = 1; i < argc; i++) {
+        if (isMidiFile(argv[i])) {
+            benchMappedFile(argv[i]);
+        }
+    }
+
+    printHeader("file recorder");
+
+    benchRecorder("notes", buildNotes);
+    benchRecorder("mixed", buildMixed);
+    benchRecorder("sysex", buildSysEx);
+
+    printHeader("capture & replay");
+
+    benchCapture("notes", buildNotes);
+    benchCapture("mixed", buildMixed);
+
+    for (i = 1; i < argc; i++) {
+        if (isCapture(argv[i])) {
+            if (loadStream(argv[i], &s)) {
+                printf("%s:\n", s.name);
+                benchReplay(s);
+                free(s.data);
+            }
+        }
+    }
+
+    printHeader("mpe");
+
+    benchMpe();
+
+    printHeader("usb-midi");
+
+    benchUsb("notes", buildNotes);
+    benchUsb("mixed", buildMixed);
+    benchUsb("sysex", buildSysEx);
+
+    return 0;
+}
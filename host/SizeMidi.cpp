@@ -0,0 +1,48 @@
+/*  SizeMidi.cpp: Minimal receive/send program using the Midi class, for
+ *                comparing code size against SizeStaticMidi.cpp
+ *
+ *             (c) 2003-2011 Tymm Twillman <tymmothy@gmail.com>
+ *
+ *  This file is part of Tymm's Arduino Midi Library.
+ *
+ *  Tymm's Arduino Midi Library is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation, either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  Tymm's Arduino Midi Library is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with Tymm's Arduino Midi Library.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+#include "HardwareSerial.h"
+#include "Midi.h"
+
+
+// Like MidiReceiveExample: only note on & note off are handled
+class MyMidi : public Midi {
+public:
+    unsigned int notes;
+
+    MyMidi(HardwareSerial &s) : Midi(s), notes(0) {}
+
+    void handleNoteOn(unsigned int channel, unsigned int note, unsigned int velocity) { notes++; }
+    void handleNoteOff(unsigned int channel, unsigned int note, unsigned int velocity) { notes--; }
+};
+
+MyMidi midi(Serial);
+
+
+int main()
+{
+    midi.begin(0);
+    midi.poll();
+    midi.sendNoteOn(1, 40, 127);
+
+    return midi.notes;
+}